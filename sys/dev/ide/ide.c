@@ -1,6 +1,5 @@
 #include <kern/pci.h>
-#include <kern/idt.h>
-#include <kern/pic.h>
+#include <kern/irq.h>
 #include <kern/page.h>
 #include <kern/malloc.h>
 #include <kern/kernasm.h>
@@ -152,14 +151,13 @@ struct {
   u16 bmide;
   u8 nien;
   u8 irq;
-  u8 intvec;
   struct prd *prdt;
   void (*inthandler)(void);
   struct list_head req_queue;
 } ide_channel[2] = {
-  {.base = IDE_PRIMARY_BASE, .nien = 1, .intvec = IRQ_TO_INTVEC(IDE_PRIMARY_IRQ),
+  {.base = IDE_PRIMARY_BASE, .nien = 1,
    .inthandler = ide1_inthandler, .irq = IDE_PRIMARY_IRQ},
-  {.base = IDE_SECONDARY_BASE, .nien = 1, .intvec = IRQ_TO_INTVEC(IDE_SECONDARY_IRQ),
+  {.base = IDE_SECONDARY_BASE, .nien = 1,
    .inthandler = ide2_inthandler, .irq = IDE_SECONDARY_IRQ},
 };
 
@@ -331,10 +329,8 @@ DRIVER_INIT void ide_init() {
     }
   }
 
-  for(int chan = IDE_PRIMARY; chan<=IDE_SECONDARY; chan++) {
-    idt_register(ide_channel[chan].intvec, IDT_INTGATE, ide_channel[chan].inthandler);
-    pic_clearmask(ide_channel[chan].irq);
-  }
+  for(int chan = IDE_PRIMARY; chan<=IDE_SECONDARY; chan++)
+    irq_register(ide_channel[chan].irq, IRQ_EDGE, ide_channel[chan].inthandler);
 }
 
 u8 ide_judge_lbamode(u32 lba) {
@@ -510,7 +506,7 @@ void ide_isr_common(u8 chan) {
   }
 exit:
   ide_in8(chan, STATUS);
-  pic_sendeoi(ide_channel[chan].irq);
+  irq_eoi(ide_channel[chan].irq);
 }
 
 void ide1_isr() {
@@ -1,6 +1,5 @@
 #include <kern/netdev.h>
-#include <kern/idt.h>
-#include <kern/pic.h>
+#include <kern/irq.h>
 #include <kern/kernlib.h>
 #include <kern/pci.h>
 #include <kern/params.h>
@@ -142,13 +141,22 @@ static const struct netdev_ops rtl8139_ops = {
 
 static struct workqueue *rx_wq;
 static struct workqueue *tx_wq;
+//queued from the interrupt handler, a pending one is not queued twice
+static struct work rx_work;
+static struct work tx_work;
+static struct work ether_rx_work;
 
 void rtl8139_isr(void);
 void rtl8139_inthandler(void);
+void rtl8139_tx_all(void *arg);
+void rtl8139_rx_all(void *arg);
+static void rtl8139_ether_rx(void *arg);
 
 void rtl8139_init(struct pci_dev *thisdev) {
   rx_wq = workqueue_new("rtl8139_rx_wq");
   tx_wq = workqueue_new("rtl8139_tx_wq");
+  work_init(&rx_work, rtl8139_rx_all, NULL, WORK_PRIO_NORMAL);
+  work_init(&tx_work, rtl8139_tx_all, NULL, WORK_PRIO_NORMAL);
 
   rtldev.pci = thisdev;
   rtldev.iobase = pci_config_read32(thisdev, PCI_BAR0);
@@ -168,6 +176,7 @@ void rtl8139_init(struct pci_dev *thisdev) {
     return;
   }
   printf("rtl8139: devno=0x%x\n", DEVNO(RTL8139_MAJOR, 0));
+  work_init(&ether_rx_work, rtl8139_ether_rx, NULL, WORK_PRIO_NORMAL);
 
   struct ifaddr *eaddr = malloc(sizeof(struct ifaddr)+ETHER_ADDR_LEN);
   eaddr->len = ETHER_ADDR_LEN;
@@ -213,8 +222,7 @@ void rtl8139_init(struct pci_dev *thisdev) {
   //enable rx&tx
   out8(RTLREG(CR), CR_RE|CR_TE);
   //setup interrupt
-  idt_register(rtldev.irq+0x20, IDT_INTGATE, rtl8139_inthandler);
-  pic_clearmask(rtldev.irq);
+  irq_register(rtldev.irq, IRQ_LEVEL, rtl8139_inthandler);
 }
 
 DRIVER_INIT int rtl8139_probe() {
@@ -259,8 +267,8 @@ void rtl8139_tx_all(void *arg UNUSED) {
 
 int rtl8139_rx_one() {
   int error = 0;
+  //the interrupt handler doesn't touch the rx ring, the mutex is enough
   mutex_lock(&rtldev.rxqueue_mtx);
-IRQ_DISABLE
   if((in8(RTLREG(CR)) & CR_BUFE) == 1) {
     error = -1;
     goto err;
@@ -296,11 +304,14 @@ out:
   rtldev.rxbuf_index = (offset + rx_size + 4 + 3) & ~3;
   out16(RTLREG(CAPR), rtldev.rxbuf_index - 16);
 err:
-IRQ_RESTORE
   mutex_unlock(&rtldev.rxqueue_mtx);
   return error;
 }
 
+static void rtl8139_ether_rx(void *arg UNUSED) {
+  ether_rx(DEVNO(RTL8139_MAJOR, RTL8139_MINOR));
+}
+
 void rtl8139_rx_all(void *arg UNUSED) {
   int rx_count = 0;
   while(rtl8139_rx_one() == 0)
@@ -308,7 +319,7 @@ void rtl8139_rx_all(void *arg UNUSED) {
 
   if(rx_count > 0) {
     thread_wakeup(&rtl8139_ops);
-    workqueue_add(ether_wq, ether_rx, (void *)DEVNO(RTL8139_MAJOR, RTL8139_MINOR));
+    workqueue_queue(ether_wq, &ether_rx_work);
   }
 }
 
@@ -327,17 +338,17 @@ void rtl8139_isr() {
   }
 
   if(isr & ISR_TOK)
-    workqueue_add(tx_wq, rtl8139_tx_all, NULL);
+    workqueue_queue(tx_wq, &tx_work);
 
   if(isr & ISR_ROK)
-    workqueue_add(rx_wq, rtl8139_rx_all, NULL);
+    workqueue_queue(rx_wq, &rx_work);
 
   if(isr & ISR_TOK)
     out16(RTLREG(ISR), ISR_TOK);
   if(isr & (ISR_FOVW|ISR_RXOVW|ISR_ROK))
     out16(RTLREG(ISR), ISR_FOVW|ISR_RXOVW|ISR_ROK);
 
-  pic_sendeoi(rtldev.irq);
+  irq_eoi(rtldev.irq);
 }
 
 static int rtl8139_check_minor(int minor) {
@@ -369,7 +380,7 @@ int rtl8139_tx(int minor, struct pktbuf *pkt) {
   mutex_lock(&rtldev.txqueue_mtx);
   int result = queue_enqueue(&pkt->link, &rtldev.txqueue);
   if(result == 0)
-    workqueue_add(tx_wq, rtl8139_tx_all, NULL);
+    workqueue_queue(tx_wq, &tx_work);
   mutex_unlock(&rtldev.txqueue_mtx);
   return result;
 }
@@ -1,4 +1,4 @@
-#include <kern/pic.h>
+#include <kern/irq.h>
 #include <kern/chardev.h>
 #include <kern/kernasm.h>
 #include <kern/idt.h>
@@ -52,14 +52,13 @@ static struct comport{
   u8 port;
   u16 base;
   u8 irq;
-  u8 intvec;
   void (*inthandler)(void);
   struct chardev_buf *rxbuf;
   struct chardev_buf *txbuf;
   struct chardev_state state;
 } comport[COMPORT_NUM] = {
-  {.port = 0, .base = 0x3f8, .irq = 4, .intvec = IRQ_TO_INTVEC(4), .inthandler = com1_inthandler},
-  {.port = 1, .base = 0x2f8, .irq = 3, .intvec = IRQ_TO_INTVEC(3), .inthandler = com2_inthandler}
+  {.port = 0, .base = 0x3f8, .irq = 4, .inthandler = com1_inthandler},
+  {.port = 1, .base = 0x2f8, .irq = 3, .inthandler = com2_inthandler}
 };
 
 static int SERIAL_MAJOR;
@@ -74,8 +73,6 @@ DRIVER_INIT void serial_init() {
   for(int i=0; i<COMPORT_NUM; i++) {
     u16 base = comport[i].base;
 
-    idt_register(comport[i].intvec, IDT_INTGATE, comport[i].inthandler);
-
     out8(base + INTENABLE,			0x03);
     out8(base + LINECTRL,				0x80);
     out8(base + DIVISOR_LO,			0x03);
@@ -89,7 +86,7 @@ DRIVER_INIT void serial_init() {
 
     chardev_initstate(&comport[i].state, CDMODE_CANON | CDMODE_ECHO);
 
-    pic_clearmask(comport[i].irq);
+    irq_register(comport[i].irq, IRQ_EDGE, comport[i].inthandler);
 
     printf("serial: devno=0x%x\n", DEVNO(SERIAL_MAJOR, i));
   }
@@ -136,7 +133,7 @@ void serial_isr_common(int port) {
     }
   }
 
-  pic_sendeoi(comport[port].irq);
+  irq_eoi(comport[port].irq);
   thread_yield();
 }
 
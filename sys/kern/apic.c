@@ -0,0 +1,191 @@
+#include <kern/apic.h>
+#include <kern/cpu.h>
+#include <kern/kernasm.h>
+#include <kern/pagetbl.h>
+#include <kern/hrtimer.h>
+#include <kern/thread.h>
+#include <kern/sched.h>
+#include <kern/pit.h>
+#include <kern/idt.h>
+#include <kern/smp.h>
+
+#define MSR_APIC_BASE     0x1b
+#define MSR_TSC_DEADLINE  0x6e0
+
+#define APIC_BASE_ENABLE  0x800
+#define APIC_BASE_MASK    0xfffff000
+
+enum lapic_regs {
+  LAPIC_ID          = 0x20,
+  LAPIC_VER         = 0x30,
+  LAPIC_TPR         = 0x80,
+  LAPIC_EOI         = 0xb0,
+  LAPIC_SVR         = 0xf0,
+  LAPIC_ICR_LO      = 0x300,
+  LAPIC_ICR_HI      = 0x310,
+  LAPIC_LVT_TIMER   = 0x320,
+  LAPIC_TIMER_INIT  = 0x380,
+  LAPIC_TIMER_CUR   = 0x390,
+  LAPIC_TIMER_DIV   = 0x3e0,
+};
+
+#define SVR_ENABLE          0x100
+#define LVT_MASKED          0x10000
+#define LVT_TIMER_ONESHOT   0x0
+#define LVT_TIMER_PERIODIC  0x20000
+#define LVT_TIMER_DEADLINE  0x40000
+#define TIMER_DIV_16        0x3
+
+#define ICR_FIXED           0x000
+#define ICR_INIT            0x500
+#define ICR_STARTUP         0x600
+#define ICR_PENDING         0x1000
+#define ICR_ASSERT          0x4000
+
+#define LAPIC_CALIBRATE_USECS 10000
+
+void lapic_timer_inthandler(void);
+void lapic_spurious_inthandler(void);
+void lapic_timer_isr(u32 cs);
+
+int lapic_enabled = 0;
+static volatile u32 *lapic = NULL;
+static u32 lapic_timer_khz; //timer counts per msec after the divider
+static int tsc_deadline = 0;
+
+static u32 lapic_read(u32 reg) {
+  return lapic[reg / 4];
+}
+
+static void lapic_write(u32 reg, u32 value) {
+  lapic[reg / 4] = value;
+}
+
+static u32 lapic_timer_calibrate() {
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LVT_MASKED | LVT_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, 0xffffffff);
+  pit_busywait(LAPIC_CALIBRATE_USECS);
+  u32 elapsed = 0xffffffff - lapic_read(LAPIC_TIMER_CUR);
+  lapic_write(LAPIC_TIMER_INIT, 0);
+  return elapsed / (LAPIC_CALIBRATE_USECS / 1000);
+}
+
+//enables the local apic of the boot processor. needed for io apic
+//interrupts, ipis and the timer. returns 0 on success.
+int lapic_init() {
+  if(lapic_enabled)
+    return 0;
+  if(!cpu_has(CPUID_EDX_APIC) || !cpu_has(CPUID_EDX_MSR))
+    return -1;
+
+  u64 base = rdmsr(MSR_APIC_BASE);
+  wrmsr(MSR_APIC_BASE, base | APIC_BASE_ENABLE);
+  lapic = ioremap(base & APIC_BASE_MASK, PAGESIZE);
+  if(lapic == NULL)
+    return -1;
+
+  idt_register(LAPIC_SPURIOUS_VECTOR, IDT_INTGATE, lapic_spurious_inthandler);
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  lapic_enabled = 1;
+  return 0;
+}
+
+//returns 0 if the local apic timer can be used as the clock event device
+int lapic_timer_init() {
+  if(lapic_init() < 0)
+    return -1;
+  idt_register(LAPIC_TIMER_VECTOR, IDT_INTGATE, lapic_timer_inthandler);
+  lapic_timer_khz = lapic_timer_calibrate();
+  if(lapic_timer_khz == 0)
+    return -1;
+  //the deadline mode needs the tsc frequency to convert usecs
+  tsc_deadline = cpu_has_ecx(CPUID_ECX_TSC_DEADLINE) && tsc_khz != 0;
+  if(tsc_deadline)
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_DEADLINE | LAPIC_TIMER_VECTOR);
+  else
+    lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_ONESHOT | LAPIC_TIMER_VECTOR);
+
+  printf("lapic: id=%u ver=%x timer %u kHz%s\n", lapic_id(),
+           lapic_read(LAPIC_VER) & 0xff, lapic_timer_khz,
+           tsc_deadline ? " (tsc deadline)" : "");
+  return 0;
+}
+
+//the application processors only need a periodic scheduler tick, the
+//timers are run by the boot processor
+void lapic_ap_init() {
+  wrmsr(MSR_APIC_BASE, rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE);
+  lapic_write(LAPIC_TPR, 0);
+  lapic_write(LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VECTOR);
+  if(lapic_timer_khz == 0)
+    return;
+  lapic_write(LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | LAPIC_TIMER_VECTOR);
+  lapic_write(LAPIC_TIMER_INIT, lapic_timer_khz * (USEC_PER_TICK / 1000));
+}
+
+static void lapic_send(u32 apic_id, u32 cmd) {
+IRQ_DISABLE
+  lapic_write(LAPIC_ICR_HI, apic_id << 24);
+  lapic_write(LAPIC_ICR_LO, cmd);
+  while(lapic_read(LAPIC_ICR_LO) & ICR_PENDING)
+    ASM("pause");
+IRQ_RESTORE
+}
+
+void lapic_send_ipi(u32 apic_id, u32 vector) {
+  lapic_send(apic_id, ICR_FIXED | ICR_ASSERT | vector);
+}
+
+void lapic_send_init(u32 apic_id) {
+  lapic_send(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+//the processor starts in real mode at addr, which must be page aligned below 1MB
+void lapic_send_startup(u32 apic_id, paddr_t addr) {
+  lapic_send(apic_id, ICR_STARTUP | (addr >> 12));
+}
+
+u32 lapic_id() {
+  return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi() {
+  lapic_write(LAPIC_EOI, 0);
+}
+
+//fires LAPIC_TIMER_VECTOR once after usecs. a new call replaces the old one.
+void lapic_timer_oneshot(u32 usecs) {
+  usecs = MIN(MAX(usecs, 1u), (u32)LAPIC_TIMER_MAX_USECS);
+  if(tsc_deadline) {
+    wrmsr(MSR_TSC_DEADLINE, rdtsc() + (u64)usecs * tsc_khz / 1000);
+  } else {
+    u32 count = (u64)usecs * lapic_timer_khz / 1000;
+    lapic_write(LAPIC_TIMER_INIT, MAX(count, 1u));
+  }
+}
+
+void lapic_timer_stop() {
+  if(tsc_deadline)
+    wrmsr(MSR_TSC_DEADLINE, 0);
+  else
+    lapic_write(LAPIC_TIMER_INIT, 0);
+}
+
+void lapic_timer_isr(u32 cs) {
+  if(this_cpu->id != 0) {
+    lapic_eoi();
+    thread_check_signal();
+    sched_tick((cs & 3) != 0);
+    return;
+  }
+
+  int ticked = hrtimer_interrupt();
+  lapic_eoi();
+  if(ticked) {
+    thread_check_signal();
+    sched_tick((cs & 3) != 0);
+  }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <kern/kernlib.h>
+
+#define LAPIC_TIMER_VECTOR    0xef
+#define IPI_TLB_VECTOR        0xfc
+#define IPI_RESCHED_VECTOR    0xfd
+#define LAPIC_SPURIOUS_VECTOR 0xff
+
+#define LAPIC_TIMER_MAX_USECS 1000000 //longest one-shot interval
+
+extern int lapic_enabled;
+
+int lapic_init(void);
+int lapic_timer_init(void);
+void lapic_ap_init(void);
+void lapic_send_ipi(u32 apic_id, u32 vector);
+void lapic_send_init(u32 apic_id);
+void lapic_send_startup(u32 apic_id, paddr_t addr);
+u32 lapic_id(void);
+void lapic_eoi(void);
+void lapic_timer_oneshot(u32 usecs);
+void lapic_timer_stop(void);
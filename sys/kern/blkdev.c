@@ -4,7 +4,9 @@
 #include <kern/fs.h>
 #include <kern/page.h>
 #include <kern/thread.h>
+#include <kern/sched.h>
 #include <kern/lock.h>
+#include <kern/reclaim.h>
 
 struct chunk {
   struct chunk *next_chunk;
@@ -17,11 +19,25 @@ struct chunk {
 static struct blkdev_ops *blkdev_tbl[MAX_BLKDEV];
 static u16 nblkdev;
 
+#define BLKBUF_HASH_SIZE 1024
+#define BLKBUF_HASH(devno, blkno) (((devno) * 31 + (blkno)) & (BLKBUF_HASH_SIZE-1))
+
 static struct chunk *chunklist;
-static struct list_head buf_list[MAX_BLKDEV];
+static struct list_head buf_hash[BLKBUF_HASH_SIZE];
 static mutex buf_list_mtx;
 static struct list_head avail_list;
-static struct blkbuf blkbufs[NBLKBUF];
+static int navail;
+static int nblkbuf;
+static int blkbuf_max;
+
+static int blkbuf_shrinker_count(void);
+static int blkbuf_shrinker_scan(int nr);
+
+static struct shrinker blkbuf_shrinker = {
+  .name = "blkbuf",
+  .count = blkbuf_shrinker_count,
+  .scan = blkbuf_shrinker_scan,
+};
 
 int blkdev_file_open(struct file *f, int mode);
 int blkdev_file_read(struct file *f, void *buf, size_t count);
@@ -48,15 +64,15 @@ void blkdev_init() {
   nblkdev = BAD_MAJOR + 1;
 
   list_init(&avail_list);
-  for(int i=0; i<MAX_BLKDEV; i++)
-    list_init(&buf_list[i]);
+  for(int i=0; i<BLKBUF_HASH_SIZE; i++)
+    list_init(&buf_hash[i]);
 
-  for(int i=0; i<NBLKBUF; i++) {
-    blkbufs[i].ref = 0;
-    blkbufs[i].flags = 0;
-    list_pushback(&blkbufs[i].avail_link, &avail_list);
-    list_pushback(&blkbufs[i].dev_link, &buf_list[BAD_MAJOR]);
-  }
+  //up to 1/8 of memory can be used for the buffer cache
+  navail = 0;
+  nblkbuf = 0;
+  blkbuf_max = MAX(NBLKBUF_MIN, page_getnfree() * (PAGESIZE / BLOCKSIZE) / 8);
+
+  shrinker_register(&blkbuf_shrinker);
 }
 
 int blkdev_register(struct blkdev_ops *ops) {
@@ -68,7 +84,7 @@ int blkdev_register(struct blkdev_ops *ops) {
 
 static void *blkbuf_alloc() {
   struct chunk *c = chunklist;
-  while(c!=NULL && c->nfree) c = c->next_chunk;
+  while(c!=NULL && c->nfree == 0) c = c->next_chunk;
   if(c == NULL) {
     c = malloc(sizeof(struct chunk));
     c->next_chunk = chunklist;
@@ -85,28 +101,63 @@ static void *blkbuf_alloc() {
   }
   void *addr = c->freelist;
   c->freelist = *(void **)(c->freelist);
+  c->nfree--;
   return addr;
 }
 
 static void blkbuf_free(void *addr) {
   u32 chunk_addr = (u32)addr & ~(PAGESIZE-1);
-  struct chunk *c = chunklist;
-  while(c!=NULL && c->addr == (void *)chunk_addr) c = c->next_chunk;
-  if(c == NULL)
+  struct chunk **pc = &chunklist;
+  while(*pc!=NULL && (*pc)->addr != (void *)chunk_addr) pc = &(*pc)->next_chunk;
+  if(*pc == NULL)
     return;
+  struct chunk *c = *pc;
   *(void **)addr = c->freelist;
   c->freelist = addr;
+  if(++c->nfree == c->nobjs) {
+    *pc = c->next_chunk;
+    page_free(c->addr);
+    free(c);
+  }
+}
+
+static struct blkbuf *blkbuf_new() {
+  struct blkbuf *buf = malloc(sizeof(struct blkbuf));
+  if(buf == NULL)
+    return NULL;
+  bzero(buf, sizeof(struct blkbuf));
+  list_init(&buf->avail_link);
+  list_init(&buf->hash_link);
+  nblkbuf++;
+  return buf;
+}
+
+static void blkbuf_destroy(struct blkbuf *buf) {
+  list_remove(&buf->hash_link);
+  if(buf->addr != NULL)
+    blkbuf_free(buf->addr);
+  free(buf);
+  nblkbuf--;
 }
 
+//grows the cache while memory is plentiful, otherwise recycles the least recently used buffer.
 static struct blkbuf *blkbuf_get_available() {
   struct blkbuf *buf;
-IRQ_DISABLE
+  if(list_is_empty(&avail_list) ||
+     (nblkbuf < blkbuf_max && page_getnfree() > page_getwatermark(WMARK_HIGH))) {
+    if((buf = blkbuf_new()) != NULL)
+      return buf;
+  }
+
+  //avail_list is never touched by interrupt handlers
+  preempt_disable();
   while(list_is_empty(&avail_list)) {
     thread_sleep(&avail_list);
   }
   buf = list_entry(list_pop(&avail_list), struct blkbuf, avail_link);
-  list_remove(&buf->dev_link);
-IRQ_RESTORE
+  navail--;
+  list_remove(&buf->hash_link);
+  preempt_enable();
   blkbuf_flush(buf);
   return buf;
 }
@@ -125,11 +176,13 @@ struct blkbuf *blkbuf_get(devno_t devno, blkno_t blkno) {
 
   mutex_lock(&buf_list_mtx);
   struct list_head *p;
-  list_foreach(p, &buf_list[DEV_MAJOR(devno)]) {
-    struct blkbuf *blk = list_entry(p, struct blkbuf, dev_link);
-    if(blk->blkno == blkno) {
-      if(blk->ref == 0)
+  list_foreach(p, &buf_hash[BLKBUF_HASH(devno, blkno)]) {
+    struct blkbuf *blk = list_entry(p, struct blkbuf, hash_link);
+    if(blk->devno == devno && blk->blkno == blkno) {
+      if(blk->ref == 0) {
         list_remove(&blk->avail_link);
+        navail--;
+      }
       blk->ref++;
       mutex_unlock(&buf_list_mtx);
       return blk;
@@ -140,10 +193,11 @@ struct blkbuf *blkbuf_get(devno_t devno, blkno_t blkno) {
   newblk->ref = 1;
   newblk->devno = devno;
   newblk->blkno = blkno;
-  newblk->addr = blkbuf_alloc();
+  if(newblk->addr == NULL)
+    newblk->addr = blkbuf_alloc();
   newblk->flags = 0;
   newblk->state = BB_ABSENT;
-  list_pushfront(&newblk->dev_link, &buf_list[DEV_MAJOR(devno)]);
+  list_pushfront(&newblk->hash_link, &buf_hash[BLKBUF_HASH(devno, blkno)]);
   mutex_unlock(&buf_list_mtx);
   return newblk;
 }
@@ -153,6 +207,8 @@ void blkbuf_release(struct blkbuf *buf) {
   buf->ref--;
   if(buf->ref == 0) {
     list_pushback(&buf->avail_link, &avail_list);
+    navail++;
+    thread_wakeup_one(&avail_list);
   }
   mutex_unlock(&buf_list_mtx);
 }
@@ -164,12 +220,37 @@ int blkbuf_remove(struct blkbuf *buf) {
     return -1;
   }
 
-  list_remove(&buf->dev_link);
-  list_pushback(&buf->avail_link, &avail_list);
+  list_remove(&buf->hash_link);
   mutex_unlock(&buf_list_mtx);
   return 0;
 }
 
+static int blkbuf_shrinker_count() {
+  return navail;
+}
+
+//destroys unused buffers, oldest first.
+//the lock may be held by the allocating thread itself (direct reclaim), so don't wait for it.
+static int blkbuf_shrinker_scan(int nr) {
+  int count = 0;
+  struct list_head *p, *tmp;
+  if(mutex_trylock(&buf_list_mtx))
+    return 0;
+  list_foreach_safe(p, tmp, &avail_list) {
+    if(count >= nr)
+      break;
+    struct blkbuf *buf = list_entry(p, struct blkbuf, avail_link);
+    if(buf->state == BB_PENDING || blkbuf_flush(buf))
+      continue;
+    list_remove(&buf->avail_link);
+    navail--;
+    blkbuf_destroy(buf);
+    count++;
+  }
+  mutex_unlock(&buf_list_mtx);
+  return count;
+}
+
 int blkdev_open(devno_t devno) {
   if(blkdev_tbl[DEV_MAJOR(devno)] == NULL)
     return -1;
@@ -287,9 +368,12 @@ int blkdev_sync(devno_t devno) {
 
   mutex_lock(&buf_list_mtx);
   struct list_head *p;
-  list_foreach(p, &buf_list[DEV_MAJOR(devno)]) {
-    struct blkbuf *buf = list_entry(p, struct blkbuf, dev_link);
-    blkbuf_flush(buf);
+  for(int i=0; i<BLKBUF_HASH_SIZE; i++) {
+    list_foreach(p, &buf_hash[i]) {
+      struct blkbuf *buf = list_entry(p, struct blkbuf, hash_link);
+      if(DEV_MAJOR(buf->devno) == DEV_MAJOR(devno))
+        blkbuf_flush(buf);
+    }
   }
   mutex_unlock(&buf_list_mtx);
   return 0;
@@ -378,9 +462,12 @@ int blkdev_file_close(struct file *f) {
 /*
   mutex_lock(&buf_list_mtx);
   struct list_head *p;
-  list_foreach(p, &buf_list[DEV_MAJOR(vno->devno)]) {
-    struct blkbuf *buf = list_entry(p, struct blkbuf, dev_link);
-    blkbuf_remove(buf);
+  for(int i=0; i<BLKBUF_HASH_SIZE; i++) {
+    list_foreach(p, &buf_hash[i]) {
+      struct blkbuf *buf = list_entry(p, struct blkbuf, hash_link);
+      if(buf->devno == vno->devno)
+        blkbuf_remove(buf);
+    }
   }
   mutex_unlock(&buf_list_mtx);
 */
@@ -32,7 +32,7 @@ struct blkbuf {
   u32 flags;
   u32 state;
   struct list_head avail_link;
-  struct list_head dev_link;
+  struct list_head hash_link;
 };
 
 extern const struct file_ops blkdev_file_ops;
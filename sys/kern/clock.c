@@ -0,0 +1,186 @@
+#include <kern/clock.h>
+#include <kern/cpu.h>
+#include <kern/timer.h>
+#include <kern/kernasm.h>
+#include <kern/syscalls.h>
+#include <kern/vdso.h>
+#include <kern/thread.h>
+
+//the tsc is the clocksource when it was calibrated, the tick count otherwise.
+//the realtime clock is the monotonic clock plus the cmos rtc time at boot.
+
+#define CMOS_ADDR 0x70
+#define CMOS_DATA 0x71
+
+enum rtc_regs {
+  RTC_SECOND    = 0x0,
+  RTC_MINUTE    = 0x2,
+  RTC_HOUR      = 0x4,
+  RTC_DAY       = 0x7,
+  RTC_MONTH     = 0x8,
+  RTC_YEAR      = 0x9,
+  RTC_STATUS_A  = 0xa,
+  RTC_STATUS_B  = 0xb,
+};
+
+#define RTC_UPDATING  0x80 //status a
+#define RTC_BINARY    0x04 //status b
+#define RTC_24HOUR    0x02 //status b
+#define RTC_PM        0x80 //hour
+
+#define NSEC_PER_TICK (NSEC_PER_SEC / HZ)
+
+struct rtc_time {
+  u32 second;
+  u32 minute;
+  u32 hour;
+  u32 day;
+  u32 month;
+  u32 year;
+};
+
+static u64 tsc_base;
+static u32 tsc_mult; //ns = cycles * tsc_mult >> tsc_shift
+static u32 tsc_shift;
+static u64 realtime_offset; //realtime minus monotonic, in ns
+
+static u64 cycles_to_ns(u64 cycles) {
+  //split the product so that it does not overflow for any cycles
+  u64 hi = (cycles >> 32) * tsc_mult;
+  u64 lo = (cycles & 0xffffffff) * tsc_mult;
+  return (hi << (32 - tsc_shift)) + (lo >> tsc_shift);
+}
+
+u64 clock_monotonic_ns() {
+  if(tsc_mult == 0)
+    return (u64)timer_getticks() * NSEC_PER_TICK;
+  return cycles_to_ns(rdtsc() - tsc_base);
+}
+
+u64 clock_realtime_ns() {
+  return clock_monotonic_ns() + realtime_offset;
+}
+
+static u8 rtc_read_register(u8 reg) {
+  out8(CMOS_ADDR, reg);
+  return in8(CMOS_DATA);
+}
+
+static u32 from_bcd(u32 i) {
+  return (i & 0x0f) + ((i >> 4) * 10);
+}
+
+static void rtc_read_raw(struct rtc_time *t) {
+  while(rtc_read_register(RTC_STATUS_A) & RTC_UPDATING);
+  t->second = rtc_read_register(RTC_SECOND);
+  t->minute = rtc_read_register(RTC_MINUTE);
+  t->hour = rtc_read_register(RTC_HOUR);
+  t->day = rtc_read_register(RTC_DAY);
+  t->month = rtc_read_register(RTC_MONTH);
+  t->year = rtc_read_register(RTC_YEAR);
+}
+
+static void rtc_read(struct rtc_time *t) {
+  struct rtc_time last;
+  //read until two reads agree, an update may happen in between
+  rtc_read_raw(t);
+  do {
+    last = *t;
+    rtc_read_raw(t);
+  } while(memcmp(&last, t, sizeof(struct rtc_time)) != 0);
+
+  u8 regb = rtc_read_register(RTC_STATUS_B);
+  if((regb & RTC_BINARY) == 0) {
+    t->second = from_bcd(t->second);
+    t->minute = from_bcd(t->minute);
+    t->hour = from_bcd(t->hour & 0x7f) | (t->hour & RTC_PM);
+    t->day = from_bcd(t->day);
+    t->month = from_bcd(t->month);
+    t->year = from_bcd(t->year);
+  }
+  if((regb & RTC_24HOUR) == 0 && (t->hour & RTC_PM))
+    t->hour = ((t->hour & 0x7f) + 12) % 24;
+  t->year += 2000; //no century register
+}
+
+static int is_leap(u32 year) {
+  return (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+}
+
+static u64 rtc_to_epoch(struct rtc_time *t) {
+  static const u16 mdays[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+  u32 y = t->year - 1;
+  u32 leaps = (y/4 - 1969/4) - (y/100 - 1969/100) + (y/400 - 1969/400);
+  u32 days = (t->year - 1970) * 365 + leaps + mdays[(t->month - 1) % 12] + t->day - 1;
+  if(t->month > 2 && is_leap(t->year))
+    days++;
+  return (u64)days * 86400 + t->hour * 3600 + t->minute * 60 + t->second;
+}
+
+void clock_init() {
+  if(tsc_khz != 0) {
+    //pick the largest shift for which the multiplier fits in 32 bits
+    u64 mult;
+    tsc_shift = 32;
+    while((mult = ((u64)NSEC_PER_SEC / 1000 << tsc_shift) / tsc_khz) > 0xffffffffu)
+      tsc_shift--;
+    tsc_mult = mult;
+    tsc_base = rdtsc();
+  }
+
+  struct rtc_time t;
+  rtc_read(&t);
+  realtime_offset = rtc_to_epoch(&t) * NSEC_PER_SEC - clock_monotonic_ns();
+
+IRQ_DISABLE
+  vdso_update_begin();
+  vdso_data->clock_mode = tsc_mult ? VDSO_CLOCK_TSC : VDSO_CLOCK_SYSCALL;
+  vdso_data->tsc_base = tsc_base;
+  vdso_data->tsc_mult = tsc_mult;
+  vdso_data->tsc_shift = tsc_shift;
+  vdso_data->realtime_offset = realtime_offset;
+  vdso_update_end();
+IRQ_RESTORE
+
+  printf("clock: %s, rtc %u/%u/%u %u:%u:%u\n", tsc_mult ? "tsc" : "tick",
+           t.year, t.month, t.day, t.hour, t.minute, t.second);
+}
+
+int sys_clock_gettime(int clockid, struct ktimespec *ts) {
+  u64 ns;
+  if(buffer_check(ts, sizeof(struct ktimespec)))
+    return -1;
+  switch(clockid) {
+  case CLOCK_REALTIME:
+    ns = clock_realtime_ns();
+    break;
+  case CLOCK_MONOTONIC:
+    ns = clock_monotonic_ns();
+    break;
+  default:
+    return -1;
+  }
+  ts->tv_sec = ns / NSEC_PER_SEC;
+  ts->tv_nsec = ns % NSEC_PER_SEC;
+  return 0;
+}
+
+int sys_gettimeofday(struct ktimeval *tv) {
+  if(buffer_check(tv, sizeof(struct ktimeval)))
+    return -1;
+  u64 ns = clock_realtime_ns();
+  tv->tv_sec = ns / NSEC_PER_SEC;
+  tv->tv_usec = ns % NSEC_PER_SEC / NSEC_PER_USEC;
+  return 0;
+}
+
+//cpu times are in ticks. returns the ticks since boot.
+int sys_times(struct ktms *buf) {
+  if(buffer_check(buf, sizeof(struct ktms)))
+    return -1;
+  buf->tms_utime = current->utime;
+  buf->tms_stime = current->stime;
+  buf->tms_cutime = current->cutime;
+  buf->tms_cstime = current->cstime;
+  return timer_getticks();
+}
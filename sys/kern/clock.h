@@ -0,0 +1,34 @@
+#pragma once
+#include <kern/kernlib.h>
+
+#define NSEC_PER_SEC  1000000000u
+#define NSEC_PER_USEC 1000u
+
+//same values as newlib
+#define CLOCK_REALTIME  1
+#define CLOCK_MONOTONIC 4
+
+//layouts shared with userland
+struct ktimespec {
+  u64 tv_sec;
+  u32 tv_nsec;
+};
+
+struct ktimeval {
+  u64 tv_sec;
+  u32 tv_usec;
+};
+
+struct ktms {
+  u32 tms_utime;
+  u32 tms_stime;
+  u32 tms_cutime;
+  u32 tms_cstime;
+};
+
+void clock_init(void);
+u64 clock_monotonic_ns(void);
+u64 clock_realtime_ns(void);
+int sys_clock_gettime(int clockid, struct ktimespec *ts);
+int sys_gettimeofday(struct ktimeval *tv);
+int sys_times(struct ktms *buf);
@@ -0,0 +1,71 @@
+#include <kern/cpu.h>
+#include <kern/kernasm.h>
+#include <kern/kernlib.h>
+#include <kern/pit.h>
+
+u32 cpu_features_edx = 0;
+u32 cpu_features_ecx = 0;
+u32 tsc_khz = 0; //0 if there is no usable tsc
+static char cpu_vendor[13];
+
+#define TSC_CALIBRATE_USECS 10000
+
+static u32 tsc_calibrate() {
+  u64 start = rdtsc();
+  pit_busywait(TSC_CALIBRATE_USECS);
+  return (rdtsc() - start) / (TSC_CALIBRATE_USECS / 1000);
+}
+
+//control registers, done on every cpu. the features are the boot processor's.
+void cpu_setup() {
+  if(cpu_has(CPUID_EDX_FPU)) {
+    setcr0((getcr0() & ~(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+    fninit();
+  }
+  if(cpu_has(CPUID_EDX_FXSR) && cpu_has(CPUID_EDX_SSE))
+    setcr4(getcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
+void cpu_init() {
+  u32 regs[4];
+  cpuid(0, regs);
+  memcpy(cpu_vendor, &regs[1], 4);
+  memcpy(cpu_vendor + 4, &regs[3], 4);
+  memcpy(cpu_vendor + 8, &regs[2], 4);
+  cpu_vendor[12] = '\0';
+
+  if(regs[0] >= 1) {
+    cpuid(1, regs);
+    cpu_features_ecx = regs[2];
+    cpu_features_edx = regs[3];
+  }
+
+  cpu_setup();
+  if(cpu_has(CPUID_EDX_FXSR) && cpu_has(CPUID_EDX_SSE))
+    memcpy_sse2_enabled = cpu_has(CPUID_EDX_SSE2);
+
+  if(cpu_has(CPUID_EDX_TSC))
+    tsc_khz = tsc_calibrate();
+
+  printf("cpu: %s features edx=%x ecx=%x%s\n", cpu_vendor,
+           cpu_features_edx, cpu_features_ecx, memcpy_sse2_enabled ? " (sse2 memcpy)" : "");
+  if(tsc_khz)
+    printf("cpu: tsc %u kHz\n", tsc_khz);
+}
+
+//lets the kernel use SSE registers. the interrupted FPU state is kept in save
+//and interrupts stay disabled until kernel_fpu_end().
+void kernel_fpu_begin(struct fpu_state *save) {
+  save->eflags = geteflags();
+  cli();
+  save->cr0 = getcr0();
+  clts();
+  fxsave(save->fxsave);
+}
+
+void kernel_fpu_end(struct fpu_state *save) {
+  fxrstor(save->fxsave);
+  setcr0(save->cr0);
+  if(save->eflags & 0x200)
+    sti();
+}
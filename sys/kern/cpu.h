@@ -0,0 +1,42 @@
+#pragma once
+#include <kern/kernlib.h>
+
+//CPUID.1:EDX
+#define CPUID_EDX_FPU   (1<<0)
+#define CPUID_EDX_TSC   (1<<4)
+#define CPUID_EDX_MSR   (1<<5)
+#define CPUID_EDX_APIC  (1<<9)
+#define CPUID_EDX_SEP   (1<<11)
+#define CPUID_EDX_FXSR  (1<<24)
+#define CPUID_EDX_SSE   (1<<25)
+#define CPUID_EDX_SSE2  (1<<26)
+
+//CPUID.1:ECX
+#define CPUID_ECX_TSC_DEADLINE (1<<24)
+
+#define CR0_MP 0x2
+#define CR0_EM 0x4
+#define CR0_TS 0x8
+#define CR0_NE 0x20
+
+#define CR4_OSFXSR     0x200
+#define CR4_OSXMMEXCPT 0x400
+
+struct fpu_state {
+  u8 fxsave[512];
+  u32 cr0;
+  u32 eflags;
+} __attribute__ ((aligned(16)));
+
+extern u32 cpu_features_edx;
+extern u32 cpu_features_ecx;
+
+extern u32 tsc_khz;
+
+#define cpu_has(feature) ((cpu_features_edx & (feature)) != 0)
+#define cpu_has_ecx(feature) ((cpu_features_ecx & (feature)) != 0)
+
+void cpu_init(void);
+void cpu_setup(void);
+void kernel_fpu_begin(struct fpu_state *save);
+void kernel_fpu_end(struct fpu_state *save);
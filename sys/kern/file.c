@@ -10,14 +10,182 @@ int is_invalid_fd_num(int fd) {
   return (fd < 0) || (fd >= MAX_FILES);
 }
 int is_invalid_fd(int fd) {
-  return is_invalid_fd_num(fd) || (current->files[fd] == NULL);
+  struct fdtable *fdt = current->fdtab;
+  return (fd < 0) || (fd >= fdt->size) || (fdt->files[fd] == NULL);
 }
 
+//doubles the table until it has more than fd slots
+static int fdtable_grow(struct fdtable *fdt, int fd) {
+  if(fd >= MAX_FILES)
+    return -1;
+  int size = fdt->size;
+  while(size <= fd)
+    size *= 2;
+  if(size > MAX_FILES)
+    size = MAX_FILES;
+  struct file **files = malloc(size * sizeof(struct file *));
+  u32 *open_map = malloc(BITMAP_WORDS(size) * sizeof(u32) * 2);
+  if(files == NULL || open_map == NULL) {
+    if(files) free(files);
+    if(open_map) free(open_map);
+    return -1;
+  }
+  u32 *cloexec_map = open_map + BITMAP_WORDS(size);
+  int old_words = BITMAP_WORDS(fdt->size);
+  int new_words = BITMAP_WORDS(size);
+  bzero(files, size * sizeof(struct file *));
+  bzero(open_map, new_words * sizeof(u32) * 2);
+  memcpy(files, fdt->files, fdt->size * sizeof(struct file *));
+  memcpy(open_map, fdt->open_map, old_words * sizeof(u32));
+  memcpy(cloexec_map, fdt->cloexec_map, old_words * sizeof(u32));
+  if(fdt->files != fdt->files_init) {
+    free(fdt->files);
+    free(fdt->open_map);
+  }
+  fdt->files = files;
+  fdt->open_map = open_map;
+  fdt->cloexec_map = cloexec_map;
+  fdt->size = size;
+  return 0;
+}
+
+//takes a reference for the duration of a syscall, so a thread closing
+//the fd meanwhile doesn't free the file under it. dropped with close().
+struct file *fget(int fd) {
+  if(is_invalid_fd(fd))
+    return NULL;
+  return dup(current->fdtab->files[fd]);
+}
+
+//reserves the lowest free descriptor. the slot stays NULL until
+//fd_install(), so open() may sleep without another thread taking it.
 int fd_get() {
-  for(int i=0; i<MAX_FILES; i++)
-    if(current->files[i] == NULL)
-      return i;
-  return -1;
+  struct fdtable *fdt = current->fdtab;
+  int fd = bitmap_find_zero(fdt->open_map, fdt->size, fdt->next_fd);
+  if(fd < 0) {
+    fd = fdt->size;
+    if(fdtable_grow(fdt, fd) < 0)
+      return -1;
+  }
+  bitmap_setbit(fdt->open_map, fd);
+  fdt->next_fd = fd + 1;
+  return fd;
+}
+
+//fills a slot from fd_get(). gives the slot back if f is NULL.
+int fd_install(int fd, struct file *f) {
+  if(f == NULL) {
+    fd_put(fd);
+    return -1;
+  }
+  current->fdtab->files[fd] = f;
+  return fd;
+}
+
+//frees the slot, the caller closes the file
+void fd_put(int fd) {
+  struct fdtable *fdt = current->fdtab;
+  fdt->files[fd] = NULL;
+  bitmap_clearbit(fdt->open_map, fd);
+  bitmap_clearbit(fdt->cloexec_map, fd);
+  if(fd < fdt->next_fd)
+    fdt->next_fd = fd;
+}
+
+struct fdtable *fdtable_new() {
+  struct fdtable *fdt = malloc(sizeof(struct fdtable));
+  if(fdt == NULL)
+    return NULL;
+  bzero(fdt, sizeof(struct fdtable));
+  fdt->ref = 1;
+  fdt->size = FDTABLE_INITIAL;
+  fdt->files = fdt->files_init;
+  fdt->open_map = fdt->open_init;
+  fdt->cloexec_map = fdt->cloexec_init;
+  return fdt;
+}
+
+//for fork. the new table refers to the same open files. returns NULL if
+//out of memory.
+struct fdtable *fdtable_dup(struct fdtable *fdt) {
+  struct fdtable *new = fdtable_new();
+  if(new == NULL)
+    return NULL;
+  if(fdt->size > new->size && fdtable_grow(new, fdt->size - 1) < 0) {
+    free(new);
+    return NULL;
+  }
+  for(int w=0; w<BITMAP_WORDS(fdt->size); w++) {
+    for(u32 bits = fdt->open_map[w]; bits; bits &= bits - 1) {
+      int i = w*32 + __builtin_ctz(bits);
+      if(fdt->files[i] == NULL) //reserved by a sleeping open
+        continue;
+      new->files[i] = dup(fdt->files[i]);
+      bitmap_setbit(new->open_map, i);
+      if(bitmap_testbit(fdt->cloexec_map, i))
+        bitmap_setbit(new->cloexec_map, i);
+    }
+  }
+  return new;
+}
+
+struct fdtable *fdtable_hold(struct fdtable *fdt) {
+  fdt->ref++;
+  return fdt;
+}
+
+//closes the files when the last thread lets go of the table
+void fdtable_release(struct fdtable *fdt) {
+  if(--fdt->ref > 0)
+    return;
+  for(int w=0; w<BITMAP_WORDS(fdt->size); w++) {
+    for(u32 bits = fdt->open_map[w]; bits; bits &= bits - 1) {
+      int i = w*32 + __builtin_ctz(bits);
+      if(fdt->files[i])
+        close(fdt->files[i]);
+    }
+  }
+  if(fdt->files != fdt->files_init) {
+    free(fdt->files);
+    free(fdt->open_map);
+  }
+  free(fdt);
+}
+
+//gives the caller a private copy of a shared table. returns NULL if out
+//of memory, fdt is kept then.
+struct fdtable *fdtable_unshare(struct fdtable *fdt) {
+  if(fdt->ref == 1)
+    return fdt;
+  struct fdtable *new = fdtable_dup(fdt);
+  if(new == NULL)
+    return NULL;
+  fdtable_release(fdt);
+  return new;
+}
+
+//for exec, on a table from fdtable_unshare()
+void fdtable_close_on_exec(struct fdtable *fdt) {
+  for(int w=0; w<BITMAP_WORDS(fdt->size); w++) {
+    for(u32 bits = fdt->cloexec_map[w]; bits; bits &= bits - 1) {
+      int i = w*32 + __builtin_ctz(bits);
+      if(fdt->files[i])
+        close(fdt->files[i]);
+      fdt->files[i] = NULL;
+      bitmap_clearbit(fdt->open_map, i);
+      if(i < fdt->next_fd)
+        fdt->next_fd = i;
+    }
+    fdt->cloexec_map[w] = 0;
+  }
+}
+
+//number of open descriptors
+int fdtable_count(struct fdtable *fdt) {
+  int n = 0;
+  for(int w=0; w<BITMAP_WORDS(fdt->size); w++)
+    n += __builtin_popcount(fdt->open_map[w]);
+  return n;
 }
 
 void file_init() {
@@ -150,51 +318,75 @@ int getdents(struct file *f, struct dirent *dirp, size_t count) {
 int sys_close(int fd) {
   if(is_invalid_fd(fd))
     return -1;
-  int result = close(current->files[fd]);
-  current->files[fd] = NULL;
-  return result;
+  struct file *f = current->fdtab->files[fd];
+  fd_put(fd);
+  return close(f);
 }
 
 int sys_read(int fd, void *buf, size_t count) {
-  if(is_invalid_fd(fd) || buffer_check(buf, count))
+  if(buffer_check(buf, count))
     return -1;
-  return read(current->files[fd], buf, count);
+  struct file *f = fget(fd);
+  if(f == NULL)
+    return -1;
+  int result = read(f, buf, count);
+  close(f);
+  return result;
 }
 
 int sys_write(int fd, const void *buf, size_t count) {
-  if(is_invalid_fd(fd) || buffer_check(buf, count))
+  if(buffer_check(buf, count))
     return -1;
-  return write(current->files[fd], buf, count);
+  struct file *f = fget(fd);
+  if(f == NULL)
+    return -1;
+  int result = write(f, buf, count);
+  close(f);
+  return result;
 }
 
 int sys_isatty(int fd) {
   if(is_invalid_fd(fd))
     return -1;
-  return (current->files[fd]->ops == &chardev_file_ops); //TODO
+  return (current->fdtab->files[fd]->ops == &chardev_file_ops); //TODO
 }
 
 int sys_lseek(int fd, off_t offset, int whence) {
-  if(is_invalid_fd(fd))
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return lseek(current->files[fd], offset, whence);
+  int result = lseek(f, offset, whence);
+  close(f);
+  return result;
 }
 
 int sys_fsync(int fd) {
-  if(is_invalid_fd(fd))
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return fsync(current->files[fd]);
+  int result = fsync(f);
+  close(f);
+  return result;
 }
 
 int sys_truncate(int fd, size_t size) {
-  if(is_invalid_fd(fd))
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return truncate(current->files[fd], size);
+  int result = truncate(f, size);
+  close(f);
+  return result;
 }
 
 int sys_getdents(int fd, struct dirent *dirp, size_t count) {
-  if(is_invalid_fd(fd) || buffer_check(dirp, count))
+  if(buffer_check(dirp, count))
     return -1;
-  return getdents(current->files[fd], dirp, count);
+  struct file *f = fget(fd);
+  if(f == NULL)
+    return -1;
+  int result = getdents(f, dirp, count);
+  close(f);
+  return result;
 }
 
 int sys_dup(int oldfd) {
@@ -203,10 +395,7 @@ int sys_dup(int oldfd) {
   int newfd = fd_get();
   if(newfd < 0)
     return -1;
-  current->files[newfd] = dup(current->files[oldfd]);
-  if(current->files[newfd] == NULL)
-    return -1;
-  return newfd;
+  return fd_install(newfd, dup(current->fdtab->files[oldfd]));
 }
 
 int sys_dup2(int oldfd, int newfd) {
@@ -214,12 +403,43 @@ int sys_dup2(int oldfd, int newfd) {
     return -1;
   if(oldfd == newfd)
     return newfd;
-  if(current->files[newfd] != NULL) {
-    close(current->files[newfd]);
-    current->files[newfd] = NULL;
+  struct fdtable *fdt = current->fdtab;
+  if(newfd >= fdt->size && fdtable_grow(fdt, newfd) < 0)
+    return -1;
+  if(fdt->files[newfd] != NULL) {
+    struct file *f = fdt->files[newfd];
+    fd_put(newfd);
+    close(f);
+  } else if(bitmap_testbit(fdt->open_map, newfd)) {
+    return -1; //reserved by an open in another thread
   }
-  current->files[newfd] = dup(current->files[oldfd]);
-  if(current->files[newfd] == NULL)
+  bitmap_setbit(fdt->open_map, newfd);
+  return fd_install(newfd, dup(fdt->files[oldfd]));
+}
+
+int sys_fcntl(int fd, int cmd, int arg) {
+  if(is_invalid_fd(fd))
     return -1;
-  return newfd;
+  struct fdtable *fdt = current->fdtab;
+  if(cmd == F_DUPFD) {
+    if(is_invalid_fd_num(arg))
+      return -1;
+    int newfd = bitmap_find_zero(fdt->open_map, fdt->size, arg);
+    if(newfd < 0) {
+      newfd = arg > fdt->size ? arg : fdt->size;
+      if(fdtable_grow(fdt, newfd) < 0)
+        return -1;
+    }
+    bitmap_setbit(fdt->open_map, newfd);
+    return fd_install(newfd, dup(fdt->files[fd]));
+  } else if(cmd == F_GETFD) {
+    return bitmap_testbit(fdt->cloexec_map, fd) ? FD_CLOEXEC : 0;
+  } else if(cmd == F_SETFD) {
+    if(arg & FD_CLOEXEC)
+      bitmap_setbit(fdt->cloexec_map, fd);
+    else
+      bitmap_clearbit(fdt->cloexec_map, fd);
+    return 0;
+  }
+  return -1;
 }
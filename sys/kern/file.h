@@ -9,6 +9,7 @@
 #define	_FTRUNC		0x0400	/* open with truncation */
 #define	_FEXCL		0x0800	/* error on open if file exists */
 #define _FDIRECTORY     0x200000
+#define	_FNOINHERIT	0x40000
 
 #define	O_RDONLY	0		/* +1 == FREAD */
 #define	O_WRONLY	1		/* +1 == FWRITE */
@@ -19,6 +20,13 @@
 #define	O_EXCL					_FEXCL
 #define O_SYNC					_FSYNC
 #define O_DIRECTORY     _FDIRECTORY
+#define O_CLOEXEC				_FNOINHERIT
+
+//fcntl
+#define F_DUPFD 0
+#define F_GETFD 1
+#define F_SETFD 2
+#define FD_CLOEXEC 1
 
 struct file_ops;
 
@@ -34,6 +42,20 @@ struct file {
   mutex rwmtx;
 };
 
+//the descriptors of a process, shared by its threads. starts with the
+//embedded arrays and grows up to MAX_FILES.
+struct fdtable {
+  int ref;
+  int size; //slots, a multiple of 32
+  int next_fd; //no free slot below this
+  struct file **files;
+  u32 *open_map; //slots in use, including ones reserved by fd_get()
+  u32 *cloexec_map;
+  struct file *files_init[FDTABLE_INITIAL];
+  u32 open_init[BITMAP_WORDS(FDTABLE_INITIAL)];
+  u32 cloexec_init[BITMAP_WORDS(FDTABLE_INITIAL)];
+};
+
 #define FILE_VNODE		0
 #define FILE_SOCKET		1
 
@@ -57,6 +79,16 @@ enum seek_whence {
 int is_invalid_fd_num(int fd);
 int is_invalid_fd(int fd);
 int fd_get(void);
+struct file *fget(int fd);
+int fd_install(int fd, struct file *f);
+void fd_put(int fd);
+struct fdtable *fdtable_new(void);
+struct fdtable *fdtable_dup(struct fdtable *fdt);
+struct fdtable *fdtable_hold(struct fdtable *fdt);
+void fdtable_release(struct fdtable *fdt);
+struct fdtable *fdtable_unshare(struct fdtable *fdt);
+void fdtable_close_on_exec(struct fdtable *fdt);
+int fdtable_count(struct fdtable *fdt);
 struct file *file_new(void *data, const struct file_ops *ops, int type, int flags);
 int read(struct file *f, void *buf, size_t count);
 int write(struct file *f, const void *buf, size_t count);
@@ -76,3 +108,4 @@ int sys_fsync(int fd);
 int sys_truncate(int fd, size_t size);
 int sys_getdents(int fd, struct dirent *dirp, size_t count);
 int sys_dup(int oldfd);
+int sys_fcntl(int fd, int cmd, int arg);
@@ -0,0 +1,94 @@
+#include <kern/fpu.h>
+#include <kern/cpu.h>
+#include <kern/kernasm.h>
+#include <kern/kernlib.h>
+#include <kern/thread.h>
+#include <kern/smp.h>
+
+static int fpu_lazy = 0; //0 without fxsave, the fpu is then left to everyone
+static u8 fpu_init_state[FPU_AREA_SIZE] __attribute__ ((aligned(16)));
+
+//malloc only aligns to 8 bytes
+#define fpu_area(t) ((void *)(((u32)(t)->fpu_mem + 15) & ~15))
+
+static int fpu_loaded(struct thread *t) {
+  return this_cpu->fpu_owner == t && !(getcr0() & CR0_TS);
+}
+
+static void fpu_set_ts() {
+  u32 cr0 = getcr0();
+  if(!(cr0 & CR0_TS))
+    setcr0(cr0 | CR0_TS);
+}
+
+//after cpu_init(). keeps the state after fninit for new threads. CR0.TS
+//is first set when a thread is switched in.
+void fpu_init() {
+  if(!cpu_has(CPUID_EDX_FPU) || !cpu_has(CPUID_EDX_FXSR))
+    return;
+  clts();
+  fninit();
+  fxsave(fpu_init_state);
+  fpu_lazy = 1;
+}
+
+void fpu_switch_out(struct thread *t) {
+  if(fpu_lazy && t->fpu_mem && fpu_loaded(t))
+    fxsave(fpu_area(t));
+}
+
+//the registers are still t's if nobody else loaded them since
+void fpu_switch_in(struct thread *t) {
+  if(!fpu_lazy)
+    return;
+  if(this_cpu->fpu_owner == t && t->fpu_cpu == this_cpu)
+    clts();
+  else
+    fpu_set_ts();
+}
+
+//returns -1 if the parent's state can't be copied
+int fpu_fork(struct thread *child, struct thread *parent) {
+  child->fpu_mem = NULL;
+  child->fpu_cpu = NULL;
+  if(!fpu_lazy || parent->fpu_mem == NULL)
+    return 0;
+  child->fpu_mem = malloc(FPU_AREA_SIZE + 15);
+  if(child->fpu_mem == NULL)
+    return -1;
+  if(fpu_loaded(parent))
+    fxsave(fpu_area(parent));
+  memcpy(fpu_area(child), fpu_area(parent), FPU_AREA_SIZE);
+  return 0;
+}
+
+//for exec and exit. the next use starts from the initial state.
+void fpu_release(struct thread *t) {
+  struct cpu *c;
+  for_each_cpu(c) {
+    if(c->fpu_owner == t)
+      c->fpu_owner = NULL;
+  }
+  free(t->fpu_mem);
+  t->fpu_mem = NULL;
+  t->fpu_cpu = NULL;
+  if(fpu_lazy && t == current)
+    fpu_set_ts();
+}
+
+//device not available: current touched the fpu with CR0.TS set. the
+//previous owner was saved when it was switched out.
+void nm_isr() {
+  if(current->fpu_mem == NULL) {
+    current->fpu_mem = malloc(FPU_AREA_SIZE + 15);
+    if(current->fpu_mem == NULL) {
+      printf("Out of memory for the fpu in thread#%d (%s)\n", current->pid, GET_THREAD_NAME(current));
+      thread_exit_with_error();
+    }
+    memcpy(fpu_area(current), fpu_init_state, FPU_AREA_SIZE);
+  }
+  clts();
+  fxrstor(fpu_area(current));
+  this_cpu->fpu_owner = current;
+  current->fpu_cpu = this_cpu;
+}
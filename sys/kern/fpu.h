@@ -0,0 +1,20 @@
+#pragma once
+#include <kern/kernlib.h>
+
+//user threads get the fpu lazily. CR0.TS is set when a thread is switched
+//in, and its first fpu or sse instruction traps to nm_isr(), which loads
+//its registers. a thread that used the fpu is saved when it is switched
+//out, so it may run on another cpu next.
+
+#define FPU_AREA_SIZE 512 //for fxsave
+
+struct thread;
+
+void fpu_init(void);
+void fpu_switch_out(struct thread *t);
+void fpu_switch_in(struct thread *t);
+int fpu_fork(struct thread *child, struct thread *parent);
+void fpu_release(struct thread *t);
+
+void nm_inthandler(void);
+void nm_isr(void);
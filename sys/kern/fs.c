@@ -5,6 +5,8 @@
 #include <kern/file.h>
 #include <kern/syscalls.h>
 #include <kern/thread.h>
+#include <kern/page.h>
+#include <kern/reclaim.h>
 
 struct fstype {
   const char *name;
@@ -18,19 +20,33 @@ struct fs *mount_tbl[MAX_MOUNT];
 static int mounttbl_used = 0;
 
 static struct fstype fstype_tbl[MAX_FSTYPE];
-static struct vnode *vcache[NVCACHE];
-static mutex vcache_mtx;
+static struct list_head vcache_lru;
+static int nvcache;
+static int vcache_max;
+static rwlock vcache_lock; //lookups share it
 
 static struct vnode *rootdir;
 static mutex all_vnodes_mtx;
 
+static int vcache_shrinker_count(void);
+static int vcache_shrinker_scan(int nr);
+
+static struct shrinker vcache_shrinker = {
+  .name = "vcache",
+  .count = vcache_shrinker_count,
+  .scan = vcache_shrinker_scan,
+};
+
 void fs_init() {
-  mutex_init(&vcache_mtx);
+  rwlock_init(&vcache_lock);
   mutex_init(&all_vnodes_mtx);
 
-  for(int i=0; i<NVCACHE; i++) {
-    vcache[i] = NULL;
-  }
+  //allow one cached vnode per 4 free pages
+  list_init(&vcache_lru);
+  nvcache = 0;
+  vcache_max = MAX(NVCACHE_MIN, page_getnfree() / 4);
+
+  shrinker_register(&vcache_shrinker);
 }
 
 void fstype_register(const char *name, const struct fstype_ops *ops) {
@@ -86,86 +102,127 @@ void vnode_sync(struct vnode *vno) {
     vno->ops->vsync(vno);
 }
 
+//lookups only mark the vnode referenced instead of moving it on the lru
+//list, so they don't need the lock exclusively
 struct vnode *vcache_find(struct fs *fs, vno_t number) {
-  //printf("----- vcache_mtx = %x\n", &vcache_mtx);
-  mutex_lock(&vcache_mtx);
-  //printf("---locked by %d---", current->pid);
+  read_lock(&vcache_lock);
   struct list_head *p;
   list_foreach(p, &fs->vnode_list) {
     struct vnode *vno = list_entry(p, struct vnode, fs_link);
     if(vno->number == number) {
       vnode_hold(vno);
-      mutex_unlock(&vcache_mtx);
+      vno->referenced = 1;
+      read_unlock(&vcache_lock);
       return vno;
     }
   }
-  mutex_unlock(&vcache_mtx);
+  read_unlock(&vcache_lock);
   return NULL;
 }
 
+//vcache_lock must be held for writing
+static void vcache_evict(struct vnode *vno) {
+  if(vno->ops->vsync)
+    vno->ops->vsync(vno);
+
+  list_remove(&vno->fs_link);
+  list_remove(&vno->lru_link);
+  nvcache--;
+
+  if(vno->ops->vfree)
+    vno->ops->vfree(vno);
+  else
+    free(vno);
+}
+
+//vcache_lock must be held for writing. evicts up to nr unused vnodes, least
+//recently used first. a referenced one gets a second chance at the front.
+static int vcache_evict_lru(int nr) {
+  int count = 0;
+  int nscan = nvcache;
+  while(count < nr && nscan-- > 0) {
+    struct vnode *vno = list_entry(list_last(&vcache_lru), struct vnode, lru_link);
+    if(vno->referenced) {
+      vno->referenced = 0;
+      list_remove(&vno->lru_link);
+      list_pushfront(&vno->lru_link, &vcache_lru);
+    } else if(vno->ref == 0) {
+      vcache_evict(vno);
+      count++;
+    } else {
+      list_remove(&vno->lru_link);
+      list_pushfront(&vno->lru_link, &vcache_lru);
+    }
+  }
+  return count;
+}
+
 int vcache_add(struct fs *fs, struct vnode *vno) {
-  mutex_lock(&vcache_mtx);
-  //printf("---locked by %d---", current->pid);
-  vno_t i, can_free = VNO_INVALID;
-  for(i=0; i<NVCACHE; i++) {
-    if(vcache[i] == NULL)
-      break;
-    else if(vcache[i]->ref == 0)
-      can_free = i;
+  write_lock(&vcache_lock);
+  if(nvcache >= vcache_max ||
+     (nvcache >= NVCACHE_MIN && page_getnfree() < page_getwatermark(WMARK_LOW))) {
+    if(vcache_evict_lru(1) == 0 && nvcache >= vcache_max) {
+      write_unlock(&vcache_lock);
+      return -1;
+    }
   }
-  if(i != NVCACHE) {
-    vcache[i] = vno;
-    list_pushfront(&vno->fs_link, &fs->vnode_list);
-    mutex_unlock(&vcache_mtx);
-    return 0;
-  } else if(can_free != VNO_INVALID) {
-    if(vcache[can_free]->ops->vsync)
-      vcache[can_free]->ops->vsync(vcache[can_free]);
 
-    list_remove(&vno->fs_link);
+  list_pushfront(&vno->fs_link, &fs->vnode_list);
+  list_pushfront(&vno->lru_link, &vcache_lru);
+  nvcache++;
+  write_unlock(&vcache_lock);
+  //printf("---added %x by %d---\n", vno, current->pid);
+  return 0;
+}
 
-    if(vcache[can_free]->ops->vfree)
-      vcache[can_free]->ops->vfree(vcache[can_free]);
-    else
-      free(vcache[can_free]);
+void vcache_remove(struct vnode *vno) {
+  write_lock(&vcache_lock);
+  list_remove(&vno->fs_link);
+  list_remove(&vno->lru_link);
+  nvcache--;
+  write_unlock(&vcache_lock);
+}
 
-    vcache[can_free] = vno;
-    list_pushfront(&vno->fs_link, &fs->vnode_list);
-    mutex_unlock(&vcache_mtx);
-  //printf("---added %x by %d---\n", vno, current->pid);
+static int vcache_shrinker_count() {
+  int count = 0;
+  struct list_head *p;
+  if(read_trylock(&vcache_lock))
     return 0;
+  list_foreach(p, &vcache_lru) {
+    if(list_entry(p, struct vnode, lru_link)->ref == 0)
+      count++;
   }
-
-  mutex_unlock(&vcache_mtx);
-  return -1;
+  read_unlock(&vcache_lock);
+  return count;
 }
 
-void vcache_remove(struct vnode *vno) {
-  mutex_lock(&vcache_mtx);
-  //printf("---locked by %d---", current->pid);
-  for(int i=0; i<NVCACHE; i++) {
-    if(vcache[i] == vno) {
-      vcache[i] = NULL;
-      list_remove(&vno->fs_link);
-      mutex_unlock(&vcache_mtx);
-      return;
-    }
+static int vcache_shrinker_scan(int nr) {
+  if(mutex_trylock(&all_vnodes_mtx))
+    return 0;
+  if(write_trylock(&vcache_lock)) {
+    vnodes_unlock();
+    return 0;
   }
-  mutex_unlock(&vcache_mtx);
+  int count = vcache_evict_lru(nr);
+  write_unlock(&vcache_lock);
+  vnodes_unlock();
+  return count;
 }
 
 void vsync() {
   vnodes_lock();
-  mutex_lock(&vcache_mtx);
-  //printf("---locked by %d---", current->pid);
-  for(int i=0; i<NVCACHE; i++) {
-    if(vcache[i] && vcache[i]->ops->vsync) {
-      vnode_hold(vcache[i]);
-      vcache[i]->ops->vsync(vcache[i]);
-      vnode_release(vcache[i]);
+  //lookups may go on while the vnodes are written back
+  read_lock(&vcache_lock);
+  struct list_head *p;
+  list_foreach(p, &vcache_lru) {
+    struct vnode *vno = list_entry(p, struct vnode, lru_link);
+    if(vno->ops->vsync) {
+      vnode_hold(vno);
+      vno->ops->vsync(vno);
+      vnode_release(vno);
     }
   }
-  mutex_unlock(&vcache_mtx);
+  read_unlock(&vcache_lock);
   vnodes_unlock();
 }
 
@@ -469,9 +526,9 @@ int sys_open(const char *path, int flags) {
   int fd = fd_get();
   if(fd < 0)
     return -1;
-  current->files[fd] = open(path, flags);
-  if(current->files[fd] == NULL)
-    return -1;
+  fd = fd_install(fd, open(path, flags));
+  if(fd >= 0 && (flags & O_CLOEXEC))
+    bitmap_setbit(current->fdtab->cloexec_map, fd);
   return fd;
 }
 
@@ -500,7 +557,12 @@ int sys_stat(const char *path, struct stat *buf) {
 }
 
 int sys_fstat(int fd, struct stat *buf) {
-  if(is_invalid_fd(fd) || buffer_check(buf, sizeof(struct stat)))
+  if(buffer_check(buf, sizeof(struct stat)))
+    return -1;
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return fstat(current->files[fd], buf);
+  int result = fstat(f, buf);
+  close(f);
+  return result;
 }
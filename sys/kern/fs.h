@@ -30,6 +30,8 @@ struct vnode {
   mutex mtx;
   //struct addrspace addrspace;
   struct list_head fs_link;
+  struct list_head lru_link;
+  u8 referenced; //looked up since the last lru scan
 };
 
 struct stat {
@@ -0,0 +1,142 @@
+#include <kern/futex.h>
+#include <kern/kernlib.h>
+#include <kern/thread.h>
+#include <kern/vmem.h>
+#include <kern/timer.h>
+#include <kern/clock.h>
+#include <kern/syscalls.h>
+
+//a futex is private to an address space, which is shared by the threads
+//of a process. the physical page would change when a copy-on-write page
+//is unshared after fork, or when a file page is yielded.
+struct futex_key {
+  struct vm_map *map;
+  vaddr_t addr;
+};
+
+//lives on the stack of the waiting thread, which sleeps on it
+struct futex_waiter {
+  struct list_head link;
+  struct futex_key key;
+  int woken;
+  struct timer timeout; //leaves the thread's alarm alone
+};
+
+#define FUTEX_HASH_BITS 6
+static struct list_head futex_hash[1 << FUTEX_HASH_BITS];
+
+static struct list_head *futex_bucket(const struct futex_key *key) {
+  u32 h = ((u32)key->map ^ key->addr) * 2654435761u;
+  return &futex_hash[h >> (32 - FUTEX_HASH_BITS)];
+}
+
+static int futex_key_eq(const struct futex_key *a, const struct futex_key *b) {
+  return a->map == b->map && a->addr == b->addr;
+}
+
+void futex_init() {
+  for(int i=0; i<(1 << FUTEX_HASH_BITS); i++)
+    list_init(&futex_hash[i]);
+}
+
+static int futex_get_key(u32 *uaddr, struct futex_key *key) {
+  if(((u32)uaddr & 3) || buffer_check(uaddr, sizeof(u32)))
+    return -1;
+  key->map = current->vmmap;
+  key->addr = (vaddr_t)uaddr;
+  return 0;
+}
+
+//sleeps while *uaddr == val. returns 0 when woken by futex_wake.
+static int futex_wait(u32 *uaddr, u32 val, const struct ktimespec *timeout) {
+  struct futex_waiter w;
+  u32 ticks = 0;
+  u32 cur;
+  int ret;
+
+  if(futex_get_key(uaddr, &w.key))
+    return -1;
+  if(timeout) {
+    if(buffer_check(timeout, sizeof(struct ktimespec)))
+      return -1;
+    ticks = timeout->tv_sec * HZ + timeout->tv_nsec / (NSEC_PER_SEC / HZ);
+    if(ticks == 0)
+      ticks = 1;
+  }
+
+IRQ_DISABLE
+  //the word is read and the waiter queued atomically with respect to
+  //futex_wake, so a wakeup can't slip in between
+  if(vm_read_u32(current->vmmap, current->regs.cr3, (vaddr_t)uaddr, &cur) || cur != val) {
+    ret = -1;
+  } else {
+    w.woken = 0;
+    list_pushback(&w.link, futex_bucket(&w.key));
+    if(timeout) {
+      timer_init(&w.timeout, thread_wakeup, &w);
+      timer_add(&w.timeout, ticks);
+    }
+    //woken by futex_wake, the timeout or a signal. the signal is handled on
+    //the way out of the syscall, after w is off the hash.
+    thread_sleep_uninterruptible(&w);
+    if(timeout)
+      timer_cancel(&w.timeout);
+    if(!w.woken)
+      list_remove(&w.link);
+    ret = w.woken ? 0 : -1;
+  }
+IRQ_RESTORE
+  return ret;
+}
+
+//wakes up to nwake waiters on uaddr and moves up to nrequeue of the rest
+//to uaddr2. returns the number of woken and moved waiters.
+static int futex_wake_requeue(u32 *uaddr, int nwake, u32 *uaddr2, int nrequeue) {
+  struct futex_key key, key2;
+  struct list_head *h, *tmp;
+  int count = 0;
+
+  if(futex_get_key(uaddr, &key))
+    return -1;
+  if(uaddr2 && futex_get_key(uaddr2, &key2))
+    return -1;
+
+IRQ_DISABLE
+  list_foreach_safe(h, tmp, futex_bucket(&key)) {
+    struct futex_waiter *w = list_entry(h, struct futex_waiter, link);
+    if(!futex_key_eq(&w->key, &key))
+      continue;
+    if(nwake > 0) {
+      list_remove(&w->link);
+      w->woken = 1;
+      thread_wakeup(w);
+      nwake--;
+    } else if(uaddr2 && nrequeue > 0) {
+      list_remove(&w->link);
+      w->key = key2;
+      list_pushback(&w->link, futex_bucket(&key2));
+      nrequeue--;
+    } else {
+      break;
+    }
+    count++;
+  }
+IRQ_RESTORE
+  return count;
+}
+
+int futex_wake(u32 *uaddr, int nwake) {
+  return futex_wake_requeue(uaddr, nwake, NULL, 0);
+}
+
+int sys_futex(u32 *uaddr, int op, u32 val, u32 val2, u32 *uaddr2) {
+  switch(op) {
+  case FUTEX_WAIT:
+    return futex_wait(uaddr, val, (const struct ktimespec *)val2);
+  case FUTEX_WAKE:
+    return futex_wake(uaddr, val);
+  case FUTEX_REQUEUE:
+    return futex_wake_requeue(uaddr, val, uaddr2, val2);
+  }
+  return -1;
+}
@@ -0,0 +1,11 @@
+#pragma once
+#include <kern/kernlib.h>
+
+//same values as linux
+#define FUTEX_WAIT    0
+#define FUTEX_WAKE    1
+#define FUTEX_REQUEUE 3
+
+void futex_init(void);
+int futex_wake(u32 *uaddr, int nwake);
+int sys_futex(u32 *uaddr, int op, u32 val, u32 val2, u32 *uaddr2);
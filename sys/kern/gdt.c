@@ -2,6 +2,13 @@
 #include <kern/thread.h>
 #include <kern/kernasm.h>
 #include <kern/kernlib.h>
+#include <kern/cpu.h>
+#include <kern/vdso.h>
+#include <kern/params.h>
+
+#define MSR_SYSENTER_CS   0x174
+#define MSR_SYSENTER_ESP  0x175
+#define MSR_SYSENTER_EIP  0x176
 
 #define DESC_SEGMENT 0x10
 #define DESC_DATASEG 0x0
@@ -27,7 +34,8 @@
 #define GDT_DATASEG_0	2
 #define GDT_CODESEG_3	3
 #define GDT_DATASEG_3	4
-#define GDT_TSS				5
+#define GDT_TSS				5 //one per cpu from here
+#define GDT_TLS				(GDT_TSS + MAX_CPUS) //likewise
 
 static struct descriptor {
   u16 limit;
@@ -36,7 +44,7 @@ static struct descriptor {
   u8 flag0;
   u8 flag1;
   u8 basehi;
-} PACKED gdt[6] = {
+} PACKED gdt[GDT_TLS + MAX_CPUS] = {
   //null
   {0x0000, 0x0000, 0x00, 0x00, 0x00, 0x00},
   //code segment(ring 0)
@@ -47,8 +55,8 @@ static struct descriptor {
   {0xffff, 0x0000, 0x00, DESC_SEGMENT|DESC_CODESEG|DESC_READABLE|DESC_DPL_3|DESC_PRESENT, DESC_DB|DESC_G|0xf, 0x00},
   //data segment(ring 3)
   {0xffff, 0x0000, 0x00, DESC_SEGMENT|DESC_DATASEG|DESC_WRITABLE|DESC_DPL_3|DESC_PRESENT, DESC_DB|DESC_G|0xf, 0x00},
-  //tss
-  {sizeof(struct tss)&0xffff, 0x0000, 0x00, DESC_TSS|DESC_TSS32|DESC_DPL_0, sizeof(struct tss)>>16, 0x00},
+  //tss, filled by gdt_settssbase()
+  //tls, filled by gdt_settlsbase()
 };
 
 static struct gdtr {
@@ -62,11 +70,46 @@ void gdt_init() {
   lgdt(&gdtr);
 }
 
-void gdt_settssbase(void *base) {
-  gdt[GDT_TSS].baselo = (u32)base & 0xffff;
-  gdt[GDT_TSS].basemid = ((u32)base>>16) & 0xff;
-  gdt[GDT_TSS].basehi = (u32)base >> 24;
-  gdt[GDT_TSS].flag0 |= DESC_PRESENT;
+void gdt_settssbase(u32 cpu, void *base) {
+  struct descriptor *d = &gdt[GDT_TSS + cpu];
+  d->limit = sizeof(struct tss) & 0xffff;
+  d->baselo = (u32)base & 0xffff;
+  d->basemid = ((u32)base>>16) & 0xff;
+  d->flag0 = DESC_TSS|DESC_TSS32|DESC_DPL_0|DESC_PRESENT;
+  d->flag1 = sizeof(struct tss) >> 16;
+  d->basehi = (u32)base >> 24;
+}
+
+//user data segment at the thread local storage of the thread running on
+//the cpu. loaded into gs on every thread switch.
+void gdt_settlsbase(u32 cpu, vaddr_t base) {
+  struct descriptor *d = &gdt[GDT_TLS + cpu];
+  d->limit = 0xffff;
+  d->baselo = base & 0xffff;
+  d->basemid = (base>>16) & 0xff;
+  d->flag0 = DESC_SEGMENT|DESC_DATASEG|DESC_WRITABLE|DESC_DPL_3|DESC_PRESENT;
+  d->flag1 = DESC_DB|DESC_G|0xf;
+  d->basehi = base >> 24;
 }
 
+void sysenter_entry(void);
 
+//fast system call entry. sysenter_entry loads the kernel stack from
+//tss->esp0, which is updated on every thread switch. called on each cpu.
+void gdt_init_sysenter(struct tss *tss) {
+  u32 regs[4];
+  if(!cpu_has(CPUID_EDX_SEP))
+    return;
+  //the early pentium pro reports SEP without supporting it
+  cpuid(1, regs);
+  u32 family = (regs[0] >> 8) & 0xf;
+  u32 model = (regs[0] >> 4) & 0xf;
+  u32 stepping = regs[0] & 0xf;
+  if(family == 6 && model < 3 && stepping < 3)
+    return;
+
+  wrmsr(MSR_SYSENTER_CS, GDT_SEL_CODESEG_0);
+  wrmsr(MSR_SYSENTER_ESP, (u32)&tss->esp0);
+  wrmsr(MSR_SYSENTER_EIP, (u32)sysenter_entry);
+  vdso_data->features |= VDSO_SYSENTER;
+}
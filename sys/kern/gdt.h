@@ -1,4 +1,9 @@
 #pragma once
+#include <kern/types.h>
+
+struct tss;
 
 void gdt_init(void);
-void gdt_settssbase(void *base);
+void gdt_settssbase(u32 cpu, void *base);
+void gdt_settlsbase(u32 cpu, vaddr_t base);
+void gdt_init_sysenter(struct tss *tss);
@@ -0,0 +1,178 @@
+#include <kern/hrtimer.h>
+#include <kern/apic.h>
+#include <kern/cpu.h>
+#include <kern/clock.h>
+#include <kern/pit.h>
+#include <kern/smp.h>
+
+//the clock event side of the timers. when the local apic timer is usable
+//it is programmed one-shot for whichever comes first, the next periodic
+//tick or the earliest hrtimer. the idle thread stops the tick until the
+//next timer wheel expiry, missed ticks are caught up on wakeup.
+//without a local apic the pit keeps ticking and hrtimers get tick resolution.
+//all of this runs on the boot processor, the others only keep a periodic
+//scheduler tick.
+
+#define NOHZ_MAX_TICKS HZ //longest idle sleep
+
+static struct list_head hrtimer_queue = {&hrtimer_queue, &hrtimer_queue}; //sorted by expire
+static int lapic_tick = 0; //the local apic timer drives the tick
+static u64 next_tick; //when timer_tick() is due next
+static int tick_stopped = 0;
+static u64 idle_wakeup; //while the tick is stopped
+
+u64 hrtimer_now() {
+  return clock_monotonic_ns() / NSEC_PER_USEC;
+}
+
+//must be called with interrupts disabled
+static void tick_program() {
+  if(!lapic_tick)
+    return;
+  if(this_cpu->id != 0) {
+    //the boot processor reprograms its timer in the interrupt
+    lapic_send_ipi(cpus[0].apic_id, LAPIC_TIMER_VECTOR);
+    return;
+  }
+  u64 next = tick_stopped ? idle_wakeup : next_tick;
+  struct list_head *first = list_first(&hrtimer_queue);
+  if(first != NULL)
+    next = MIN(next, list_entry(first, struct hrtimer, link)->expire);
+  u64 now = hrtimer_now();
+  lapic_timer_oneshot(next > now ? MIN(next - now, (u64)LAPIC_TIMER_MAX_USECS) : 1);
+}
+
+//runs the ticks that are due. returns 1 if any
+static int tick_catchup(u64 now) {
+  int ticked = 0;
+  while(next_tick <= now) {
+    timer_tick();
+    next_tick += USEC_PER_TICK;
+    ticked = 1;
+  }
+  return ticked;
+}
+
+void hrtimer_init(struct hrtimer *t, void (*func)(const void *), const void *arg) {
+  list_init(&t->link);
+  t->func = func;
+  t->arg = arg;
+  t->expire = 0;
+  t->flags = 0;
+}
+
+//arms the timer to fire after usecs. a pending timer is re-armed.
+void hrtimer_start(struct hrtimer *t, u64 usecs) {
+IRQ_DISABLE
+  if(t->flags & HRTIMER_PENDING)
+    list_remove(&t->link);
+  t->expire = hrtimer_now() + usecs;
+  struct list_head *p;
+  list_foreach(p, &hrtimer_queue) {
+    if(list_entry(p, struct hrtimer, link)->expire > t->expire)
+      break;
+  }
+  list_pushback(&t->link, p); //inserts before p
+  t->flags |= HRTIMER_PENDING;
+  if(list_first(&hrtimer_queue) == &t->link)
+    tick_program();
+IRQ_RESTORE
+}
+
+//returns 1 if the timer was pending
+int hrtimer_cancel(struct hrtimer *t) {
+  int pending;
+IRQ_DISABLE
+  pending = (t->flags & HRTIMER_PENDING) != 0;
+  if(pending) {
+    list_remove(&t->link);
+    t->flags &= ~HRTIMER_PENDING;
+  }
+IRQ_RESTORE
+  return pending;
+}
+
+int hrtimer_pending(struct hrtimer *t) {
+  return (t->flags & HRTIMER_PENDING) != 0;
+}
+
+//must be called with interrupts disabled
+void hrtimer_run_queues() {
+  u64 now = hrtimer_now();
+  struct list_head *p;
+  while((p = list_first(&hrtimer_queue)) != NULL) {
+    struct hrtimer *t = list_entry(p, struct hrtimer, link);
+    if(t->expire > now)
+      break;
+    list_remove(p);
+    t->flags &= ~HRTIMER_PENDING;
+    //the callback may re-arm the timer
+    (t->func)(t->arg);
+  }
+}
+
+//called from the local apic timer interrupt. returns 1 if a tick has
+//passed, so that the caller can reschedule.
+int hrtimer_interrupt() {
+  tick_stopped = 0;
+  int ticked = tick_catchup(hrtimer_now());
+  hrtimer_run_queues();
+  tick_program();
+  return ticked;
+}
+
+//switches the tick from the pit to the local apic timer if possible
+void tick_init() {
+  if(tsc_khz == 0 || lapic_timer_init() < 0) {
+    puts("tick: periodic pit");
+    return;
+  }
+IRQ_DISABLE
+  next_tick = hrtimer_now() + USEC_PER_TICK;
+  lapic_tick = 1;
+  pit_stop();
+  tick_program();
+IRQ_RESTORE
+  puts("tick: one-shot lapic, nohz idle");
+}
+
+//called by the idle thread with interrupts disabled right before halting
+void tick_nohz_idle_enter() {
+  if(!lapic_tick || this_cpu->id != 0)
+    return;
+  u32 delta = timer_next_expiry(NOHZ_MAX_TICKS);
+  if(delta <= 1)
+    return;
+  tick_stopped = 1;
+  idle_wakeup = next_tick + (u64)(delta - 1) * USEC_PER_TICK;
+  tick_program();
+}
+
+//ticks the timer wheel is behind while the tick is stopped. the wheel
+//itself is only advanced on the boot processor.
+u32 tick_nohz_lag() {
+  if(!tick_stopped)
+    return 0;
+  u64 now = hrtimer_now();
+  return next_tick <= now ? (u32)((now - next_tick) / USEC_PER_TICK) + 1 : 0;
+}
+
+//called by timer_add() with interrupts disabled. a stopped tick may not
+//come back before the new timer is due, so the boot processor is woken
+//to catch up and program it. on the boot processor itself the idle
+//thread does that after the interrupt.
+void tick_nohz_kick() {
+  if(tick_stopped && this_cpu->id != 0)
+    tick_program();
+}
+
+//restarts the tick after an interrupt other than the timer woke the idle thread
+void tick_nohz_idle_exit() {
+IRQ_DISABLE
+  if(tick_stopped && this_cpu->id == 0) {
+    tick_stopped = 0;
+    tick_catchup(hrtimer_now());
+    tick_program();
+  }
+IRQ_RESTORE
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <kern/kernlib.h>
+#include <kern/timer.h>
+
+#define USEC_PER_SEC 1000000
+#define USEC_PER_TICK (USEC_PER_SEC / HZ)
+
+//one-shot timer with microsecond resolution. initialize with hrtimer_init(),
+//then arm with hrtimer_start(). callbacks run in interrupt context.
+struct hrtimer {
+  struct list_head link;
+  u64 expire; //absolute, usecs since boot
+  void (*func)(const void *);
+  const void *arg;
+  u32 flags;
+#define HRTIMER_PENDING 0x1
+};
+
+void hrtimer_init(struct hrtimer *t, void (*func)(const void *), const void *arg);
+void hrtimer_start(struct hrtimer *t, u64 usecs);
+int hrtimer_cancel(struct hrtimer *t);
+int hrtimer_pending(struct hrtimer *t);
+u64 hrtimer_now(void);
+void hrtimer_run_queues(void);
+int hrtimer_interrupt(void);
+
+void tick_init(void);
+void tick_nohz_idle_enter(void);
+void tick_nohz_idle_exit(void);
+u32 tick_nohz_lag(void);
+void tick_nohz_kick(void);
@@ -44,6 +44,11 @@ void idt_init() {
   
   idtr.limit = IDTSIZE * sizeof(struct gatedesc);
   idtr.base = idt;
+  idt_load();
+}
+
+//the table is shared by all cpus
+void idt_load() {
   lidt(&idtr);
 }
 
@@ -7,3 +7,4 @@
 void idt_register(u8 vecnum, u8 gatetype, void (*base)(void));
 void idt_unregister(u8 vecnum);
 void idt_init(void);
+void idt_load(void);
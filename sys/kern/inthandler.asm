@@ -5,14 +5,36 @@ section .text
 extern kernstack_setaddr
 extern thread_sched
 extern current
+extern need_resched
+extern preempt_count
+extern thread_yield
+extern kernel_lock
+extern kernel_unlock
 
 %macro handler_enter 0
   push eax
   push ecx
   push edx
+  cld ; the string functions assume DF=0. iretd restores the interrupted one.
+  call kernel_lock
+  mov edx, [esp]
+  mov ecx, [esp+4]
+  mov eax, [esp+8]
+%endmacro
+
+; a wakeup from the handler may have asked for a reschedule
+%macro preempt_check 0
+  cmp dword [need_resched], 0
+  je %%nopreempt
+  cmp dword [preempt_count], 0
+  jne %%nopreempt
+  call thread_yield
+%%nopreempt:
 %endmacro
 
 %macro handler_leave 0
+  preempt_check
+  call kernel_unlock
   pop edx
   pop ecx
   pop eax
@@ -23,9 +45,25 @@ extern pit_isr
 global pit_inthandler
 pit_inthandler:
   handler_enter
+  push dword [esp+16] ; interrupted cs
   call pit_isr
+  add esp, 4
   handler_leave
 
+extern lapic_timer_isr
+global lapic_timer_inthandler
+lapic_timer_inthandler:
+  handler_enter
+  push dword [esp+16] ; interrupted cs
+  call lapic_timer_isr
+  add esp, 4
+  handler_leave
+
+; spurious interrupts from the local apic must not be acknowledged
+global lapic_spurious_inthandler
+lapic_spurious_inthandler:
+  iretd
+
 extern spurious_isr
 global spurious_inthandler
 spurious_inthandler:
@@ -81,18 +119,30 @@ gpe_inthandler:
 extern pf_isr
 global pf_inthandler
 pf_inthandler:
-  add esp, 4 ; pop error code
   handler_enter
   mov ecx, esp
+  push dword [ecx+12] ;error code
   push eax
-  mov eax, [ecx+24] ;saved esp
+  mov eax, [ecx+28] ;saved esp
   push eax
-  mov eax, [ecx+12] ;saved eip
+  mov eax, [ecx+16] ;saved eip
   push eax
   mov eax, cr2
   push eax
   call pf_isr
-  add esp, 16
+  add esp, 20
+  call kernel_unlock
+  pop edx
+  pop ecx
+  pop eax
+  add esp, 4 ; pop error code
+  iretd
+
+extern nm_isr
+global nm_inthandler
+nm_inthandler:
+  handler_enter
+  call nm_isr
   handler_leave
 
 extern syscall_isr
@@ -110,3 +160,23 @@ syscall_inthandler:
   mov [esp+8], eax ;set return value
   handler_leave
 
+extern smp_resched_isr
+global smp_resched_inthandler
+smp_resched_inthandler:
+  handler_enter
+  call smp_resched_isr
+  handler_leave
+
+; the sender holds the kernel lock and waits for this one
+extern smp_tlb_isr
+global smp_tlb_inthandler
+smp_tlb_inthandler:
+  push eax
+  push ecx
+  push edx
+  cld
+  call smp_tlb_isr
+  pop edx
+  pop ecx
+  pop eax
+  iretd
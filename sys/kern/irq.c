@@ -0,0 +1,141 @@
+#include <kern/irq.h>
+#include <kern/apic.h>
+#include <kern/idt.h>
+#include <kern/kernasm.h>
+#include <kern/pagetbl.h>
+#include <kern/pic.h>
+#include <kern/smp.h>
+
+//device interrupts. with an io apic every registered irq gets a vector
+//of its own and is delivered to the boot processor's local apic, the
+//pic is masked. otherwise they go through the pic as before.
+//isa irq numbers are remapped to io apic inputs by the mp table, pci
+//interrupt lines are used as they are. the mp table may also override
+//the polarity and trigger mode the driver asks for.
+
+enum ioapic_regs {
+  IOAPIC_REGSEL = 0x00,
+  IOAPIC_WIN    = 0x10,
+};
+
+#define IOAPIC_VER      0x01
+#define IOAPIC_REDTBL   0x10
+
+#define REDTBL_LOWACTIVE 0x2000
+#define REDTBL_LEVEL     0x8000
+#define REDTBL_MASKED    0x10000
+
+#define IMCR_ADDR 0x22
+#define IMCR_DATA 0x23
+
+void lapic_spurious_inthandler(void);
+
+static volatile u32 *ioapic = NULL;
+static u32 ioapic_npins;
+static u8 irq_vector[MAX_IRQS];
+static u8 irq_pin[MAX_IRQS];
+static u8 next_vector = IRQ_VECTOR_BASE;
+
+static u32 ioapic_read(u32 reg) {
+  ioapic[IOAPIC_REGSEL / 4] = reg;
+  return ioapic[IOAPIC_WIN / 4];
+}
+
+static void ioapic_write(u32 reg, u32 value) {
+  ioapic[IOAPIC_REGSEL / 4] = reg;
+  ioapic[IOAPIC_WIN / 4] = value;
+}
+
+static void ioapic_route(u32 pin, u32 low, u32 dest) {
+  ioapic_write(IOAPIC_REDTBL + pin * 2 + 1, dest << 24);
+  ioapic_write(IOAPIC_REDTBL + pin * 2, low);
+}
+
+static u32 redtbl_mode(u32 pin, int trigger) {
+  u32 mode = trigger == IRQ_LEVEL ? REDTBL_LEVEL | REDTBL_LOWACTIVE : 0;
+  u16 flags = mp_pin_flags[pin];
+  if((flags & MP_POLARITY_MASK) == MP_POLARITY_HIGH)
+    mode &= ~REDTBL_LOWACTIVE;
+  else if((flags & MP_POLARITY_MASK) == MP_POLARITY_LOW)
+    mode |= REDTBL_LOWACTIVE;
+  if((flags & MP_TRIGGER_MASK) == MP_TRIGGER_EDGE)
+    mode &= ~REDTBL_LEVEL;
+  else if((flags & MP_TRIGGER_MASK) == MP_TRIGGER_LEVEL)
+    mode |= REDTBL_LEVEL;
+  return mode;
+}
+
+void irq_init() {
+  //ipis need the local apic even without an io apic
+  if(lapic_init() < 0 || mp_ioapic_addr == 0)
+    return;
+  ioapic = ioremap(mp_ioapic_addr, PAGESIZE);
+  if(ioapic == NULL)
+    return;
+  ioapic_npins = ((ioapic_read(IOAPIC_VER) >> 16) & 0xff) + 1;
+  for(u32 pin = 0; pin < ioapic_npins; pin++)
+    ioapic_route(pin, REDTBL_MASKED, 0);
+
+  pic_disable();
+  //the masked pic may still raise its spurious irq 7 or 15
+  idt_register(IRQ_TO_INTVEC(7), IDT_INTGATE, lapic_spurious_inthandler);
+  idt_register(IRQ_TO_INTVEC(15), IDT_INTGATE, lapic_spurious_inthandler);
+  if(mp_imcr) {
+    out8(IMCR_ADDR, 0x70);
+    out8(IMCR_DATA, 0x01);
+  }
+  printf("irq: io apic with %u inputs\n", ioapic_npins);
+}
+
+//installs the handler and unmasks the irq. returns the vector or -1.
+int irq_register(int irq, int trigger, void (*inthandler)(void)) {
+  if(irq < 0 || irq >= MAX_IRQS)
+    return -1;
+
+  if(ioapic == NULL) {
+    if(irq >= 16)
+      return -1;
+    idt_register(IRQ_TO_INTVEC(irq), IDT_INTGATE, inthandler);
+    pic_clearmask(irq);
+    return IRQ_TO_INTVEC(irq);
+  }
+
+  u32 pin = (irq < 16 && trigger == IRQ_EDGE) ? mp_isa_irq_pin[irq] : (u32)irq;
+  if(pin >= ioapic_npins)
+    return -1;
+  if(irq_vector[irq] == 0) {
+    if(next_vector >= LAPIC_TIMER_VECTOR)
+      return -1;
+    irq_vector[irq] = next_vector++;
+  }
+  irq_pin[irq] = pin;
+  idt_register(irq_vector[irq], IDT_INTGATE, inthandler);
+  ioapic_route(pin, irq_vector[irq] | redtbl_mode(pin, trigger), cpus[0].apic_id);
+  return irq_vector[irq];
+}
+
+void irq_mask(int irq) {
+  if(ioapic == NULL) {
+    pic_setmask(irq);
+  } else if(irq_vector[irq]) {
+    u32 reg = IOAPIC_REDTBL + irq_pin[irq] * 2;
+    ioapic_write(reg, ioapic_read(reg) | REDTBL_MASKED);
+  }
+}
+
+void irq_unmask(int irq) {
+  if(ioapic == NULL) {
+    pic_clearmask(irq);
+  } else if(irq_vector[irq]) {
+    u32 reg = IOAPIC_REDTBL + irq_pin[irq] * 2;
+    ioapic_write(reg, ioapic_read(reg) & ~REDTBL_MASKED);
+  }
+}
+
+//also clears the remote irr of a level triggered io apic input
+void irq_eoi(int irq) {
+  if(ioapic == NULL)
+    pic_sendeoi(irq);
+  else
+    lapic_eoi();
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include <kern/kernlib.h>
+#include <kern/params.h>
+
+#define IRQ_EDGE  0 //isa devices, active high
+#define IRQ_LEVEL 1 //pci devices, active low
+
+#define IRQ_VECTOR_BASE 0x30 //allocated upwards, above the pic range
+#define MAX_IRQS MAX_IOAPIC_PINS
+
+void irq_init(void);
+int irq_register(int irq, int trigger, void (*inthandler)(void));
+void irq_mask(int irq);
+void irq_unmask(int irq);
+void irq_eoi(int irq);
@@ -125,6 +125,103 @@ geteflags:
   pop eax
   ret
 
+global getcr0
+getcr0:
+  mov eax, cr0
+  ret
+
+global getcr3
+getcr3:
+  mov eax, cr3
+  ret
+
+global gettr
+gettr:
+  xor eax, eax
+  str ax
+  ret
+
+global setcr0
+setcr0:
+  mov eax, [esp+4]
+  mov cr0, eax
+  ret
+
+global getcr4
+getcr4:
+  mov eax, cr4
+  ret
+
+global setcr4
+setcr4:
+  mov eax, [esp+4]
+  mov cr4, eax
+  ret
+
+global clts
+clts:
+  clts
+  ret
+
+global fninit
+fninit:
+  fninit
+  ret
+
+global fxsave
+fxsave:
+  mov eax, [esp+4]
+  fxsave [eax]
+  ret
+
+global fxrstor
+fxrstor:
+  mov eax, [esp+4]
+  fxrstor [eax]
+  ret
+
+; void cpuid(u32 leaf, u32 *regs) stores eax, ebx, ecx, edx to regs[0..3]
+global cpuid
+cpuid:
+  push ebx
+  push edi
+  mov eax, [esp+12]
+  mov edi, [esp+16]
+  xor ecx, ecx
+  cpuid
+  mov [edi], eax
+  mov [edi+4], ebx
+  mov [edi+8], ecx
+  mov [edi+12], edx
+  pop edi
+  pop ebx
+  ret
+
+; void sse2_copy_blocks(void *dest, const void *src, size_t nblocks)
+; copies 64-byte blocks. dest must be 16-byte aligned.
+global sse2_copy_blocks
+sse2_copy_blocks:
+  mov edx, [esp+4]
+  mov eax, [esp+8]
+  mov ecx, [esp+12]
+  test ecx, ecx
+  jz .done
+.loop:
+  movdqu xmm0, [eax]
+  movdqu xmm1, [eax+16]
+  movdqu xmm2, [eax+32]
+  movdqu xmm3, [eax+48]
+  movdqa [edx], xmm0
+  movdqa [edx+16], xmm1
+  movdqa [edx+32], xmm2
+  movdqa [edx+48], xmm3
+  add eax, 64
+  add edx, 64
+  dec ecx
+  jnz .loop
+.done:
+  ret
+
 extern current
 global flushtlb
 flushtlb:
@@ -134,6 +231,12 @@ flushtlb:
 .flush:
   ret
 
+global invlpg
+invlpg:
+  mov eax, [esp+4]
+  invlpg [eax]
+  ret
+
 global a20_enable
 a20_enable:
   call .waitkbdin
@@ -184,6 +287,8 @@ extern thread_sched
 extern kstack_setaddr
 extern show_line
 extern show_number
+extern kernel_lock
+extern kernel_unlock
 
 global _thread_yield
 _thread_yield:
@@ -223,6 +328,14 @@ cpu_halt:
   hlt
   ret
 
+; called with interrupts disabled. sti delays them by one instruction,
+; so a wakeup can not slip in between the check and the hlt.
+global cpu_idle_halt
+cpu_idle_halt:
+  sti
+  hlt
+  ret
+
 global xchg
 xchg:
   mov eax, [esp+4]
@@ -230,6 +343,33 @@ xchg:
   xchg eax, [ecx]
   ret
 
+; returns the old value
+global xadd
+xadd:
+  mov eax, [esp+4]
+  mov ecx, [esp+8]
+  lock xadd [ecx], eax
+  ret
+
+global rdtsc
+rdtsc:
+  rdtsc
+  ret
+
+global rdmsr
+rdmsr:
+  mov ecx, [esp+4]
+  rdmsr
+  ret
+
+global wrmsr
+wrmsr:
+  mov ecx, [esp+4]
+  mov eax, [esp+8]
+  mov edx, [esp+12]
+  wrmsr
+  ret
+
 global jmpto_current
 jmpto_current:
   mov eax, [current]
@@ -253,13 +393,14 @@ int80:
 global jmpto_userspace
 jmpto_userspace:
   cli
+  call kernel_unlock
   mov eax, [esp+4]
   mov ecx, [esp+8]
   mov dx, 0x1b ;RPL
   mov ds, edx
   mov es, edx
   mov fs, edx
-  mov gs, edx
+  ; gs is the tls segment, see thread_load_tls()
   push dword 0x23
   push ecx
   push dword 0x200
@@ -267,12 +408,58 @@ jmpto_userspace:
   push eax
   iretd
 
+global setgs
+setgs:
+  mov eax, [esp+4]
+  mov gs, ax
+  ret
+
 global getesp
 getesp:
   mov eax, esp
   add eax, 4
   ret
 
+; user calling convention: eax=number, ebx,ecx,edx,esi,edi=args and
+; ebp=user esp with the return address on top of it.
+extern syscall_isr
+extern thread_exit_with_error
+extern need_resched
+extern preempt_count
+extern thread_yield
+global sysenter_entry
+sysenter_entry:
+  mov esp, [esp] ; tss.esp0, see gdt_init_sysenter()
+  cld
+  cmp ebp, 0xc0000000 - 4
+  ja .badstack
+  push ebp
+  push edi
+  push esi
+  push edx
+  push ecx
+  push ebx
+  push eax
+  call kernel_lock
+  call syscall_isr
+  add esp, 24
+  push eax
+  cmp dword [need_resched], 0
+  je .nopreempt
+  cmp dword [preempt_count], 0
+  jne .nopreempt
+  call thread_yield
+.nopreempt:
+  call kernel_unlock
+  pop eax
+  pop ecx ; sysexit loads esp from ecx and eip from edx
+  mov edx, [ecx]
+  sti ; sysexit runs in the shadow of sti
+  sysexit
+.badstack:
+  call kernel_lock
+  call thread_exit_with_error
+
 global fork_prologue
 fork_prologue:
   mov ecx, esp
@@ -16,14 +16,33 @@ void sti(void);
 void cli(void);
 u32 getcr2(void);
 u32 geteflags(void);
+u32 getcr0(void);
+u32 getcr3(void);
+u16 gettr(void);
+void setcr0(u32 cr0);
+u32 getcr4(void);
+void setcr4(u32 cr4);
+void clts(void);
+void fninit(void);
+void fxsave(void *area);
+void fxrstor(void *area);
+void cpuid(u32 leaf, u32 *regs);
+void sse2_copy_blocks(void *dest, const void *src, size_t nblocks);
 void flushtlb(void *addr);
+void invlpg(vaddr_t addr);
 void a20_enable(void);
 void saveesp(void);
 void _thread_yield(void);
 void cpu_halt(void);
+void cpu_idle_halt(void);
 u32 xchg(u32 value, void *mem);
+u32 xadd(u32 value, void *mem);
+u64 rdtsc(void);
+u64 rdmsr(u32 msr);
+void wrmsr(u32 msr, u64 value);
 void jmpto_current(void);
 void jmpto_userspace(void *entrypoint, void *userstack);
+void setgs(u32 sel);
 u32 getesp(void);
 u32 fork_prologue(u32 (*func)(u32, u32, u32, u32, u32, u32));
 u32 fork_child_epilogue(void);
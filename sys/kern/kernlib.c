@@ -1,4 +1,6 @@
 #include <kern/kernlib.h>
+#include <kern/kernasm.h>
+#include <kern/cpu.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -48,49 +50,133 @@ char *strdup(const char *str) {
   return copied;
 }
 
+#define SSE2_COPY_MIN 2048 //below this, saving the FPU state costs more than it gains
+
+int memcpy_sse2_enabled = 0;
+
+//byte copy for heads and tails
+static inline void copy_bytes(void *dest, const void *src, size_t n) {
+  u32 d0, d1, d2;
+  ASM("rep movsb"
+      : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+      : "0"(n), "1"(dest), "2"(src)
+      : "memory");
+}
+
+//aligns the destination to 4 bytes, then copies dwords with rep movsd
+static inline void copy_forward(void *dest, const void *src, size_t n) {
+  u32 d0, d1, d2;
+  if(n < 16) {
+    copy_bytes(dest, src, n);
+    return;
+  }
+  size_t head = (-(u32)dest) & 3;
+  ASM("rep movsb\n\t"
+      "mov %4, %%ecx\n\t"
+      "shr $2, %%ecx\n\t"
+      "rep movsl\n\t"
+      "mov %4, %%ecx\n\t"
+      "and $3, %%ecx\n\t"
+      "rep movsb"
+      : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+      : "0"(head), "r"(n - head), "1"(dest), "2"(src)
+      : "memory");
+}
+
+static void copy_sse2(void *dest, const void *src, size_t n) {
+  struct fpu_state fpu;
+  size_t head = (-(u32)dest) & 15;
+  copy_bytes(dest, src, head);
+  dest += head;
+  src += head;
+  n -= head;
+
+  kernel_fpu_begin(&fpu);
+  sse2_copy_blocks(dest, src, n / 64);
+  kernel_fpu_end(&fpu);
+
+  copy_bytes(dest + (n & ~63), src + (n & ~63), n & 63);
+}
+
 void *memcpy(void *dest, const void *src, size_t n) {
-  for(size_t i=0; i<n; i++)
-    *(u8 *)dest++ = *(u8 *)src++;
+  copy_forward(dest, src, n);
   return dest;
 }
 
-void bzero(void *s, size_t n) {
-  u8 *ptr = s;
-  while(n--)
-    *ptr++ = 0;
+//memcpy between kernel mappings that can't fault, such as whole pages. a
+//fault in the sse loop may switch threads while the fpu is borrowed.
+void *memcpy_kernel(void *dest, const void *src, size_t n) {
+  if(n >= SSE2_COPY_MIN && memcpy_sse2_enabled)
+    copy_sse2(dest, src, n);
+  else
+    copy_forward(dest, src, n);
+  return dest;
 }
 
 void *memset(void *s, int c, size_t n) {
-  for(size_t i=0; i<n; i++)
-    *(u8 *)s++ = (u8)c;
+  u32 d0, d1;
+  u32 pattern = (u8)c * 0x01010101u;
+  if(n < 16) {
+    ASM("rep stosb"
+        : "=&c"(d0), "=&D"(d1)
+        : "0"(n), "1"(s), "a"(pattern)
+        : "memory");
+    return s;
+  }
+  size_t head = (-(u32)s) & 3;
+  ASM("rep stosb\n\t"
+      "mov %3, %%ecx\n\t"
+      "shr $2, %%ecx\n\t"
+      "rep stosl\n\t"
+      "mov %3, %%ecx\n\t"
+      "and $3, %%ecx\n\t"
+      "rep stosb"
+      : "=&c"(d0), "=&D"(d1)
+      : "0"(head), "r"(n - head), "1"(s), "a"(pattern)
+      : "memory");
   return s;
 }
 
-int memcmp(const void *s1, const void *s2, size_t n) {
-  size_t i;
-  u8 *p1 = (u8 *)s1;
-  u8 *p2 = (u8 *)s2;
+void bzero(void *s, size_t n) {
+  memset(s, 0, n);
+}
 
-  for (i = 0; i < n; i++, p1++, p2++) {
-    if (*p1 != *p2)
-      break;
+int memcmp(const void *s1, const void *s2, size_t n) {
+  const u8 *p1 = s1;
+  const u8 *p2 = s2;
+
+  //skip equal dwords, then find the differing byte
+  while(n >= 4 && *(const u32 *)p1 == *(const u32 *)p2) {
+    p1 += 4;
+    p2 += 4;
+    n -= 4;
   }
-  if (i == n)
-    return 0;
-  else
-    return *p1 - *p2;
+  for(; n > 0; n--, p1++, p2++) {
+    if(*p1 != *p2)
+      return *p1 - *p2;
+  }
+  return 0;
 }
 
 void *memmove(void *dest, const void *src, size_t n) {
-  if (src + n > dest) {
-    src += n - 1;
-    dest += n - 1;
-    for(size_t i=0; i<n; i++)
-      *(u8 *)dest-- = *(u8 *)src--;
-  } else {
+  if(dest <= src || dest >= src + n) {
+    //forward copy never overwrites unread bytes
     memcpy(dest, src, n);
+    return dest;
   }
 
+  //copy backward: the unaligned tail bytes first, then dwords
+  u32 d0, d1, d2;
+  ASM("std\n\t"
+      "rep movsb\n\t"
+      "sub $3, %%esi\n\t"
+      "sub $3, %%edi\n\t"
+      "mov %4, %%ecx\n\t"
+      "rep movsl\n\t"
+      "cld"
+      : "=&c"(d0), "=&D"(d1), "=&S"(d2)
+      : "0"(n & 3), "r"(n >> 2), "1"(dest + n - 1), "2"(src + n - 1)
+      : "memory");
   return dest;
 }
 
@@ -238,6 +324,20 @@ error:
   return result;
 }
 
+//returns the lowest clear bit at or after start, or -1. a word at a time.
+int bitmap_find_zero(const u32 *map, int nbits, int start) {
+  for(int i = start/32; i < BITMAP_WORDS(nbits); i++) {
+    u32 w = map[i];
+    if(i == start/32)
+      w |= (1u << (start%32)) - 1;
+    if(w != 0xffffffff) {
+      int bit = i*32 + __builtin_ctz(~w);
+      return bit < nbits ? bit : -1;
+    }
+  }
+  return -1;
+}
+
 void show_line() {
   puts("-------------------");
 }
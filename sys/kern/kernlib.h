@@ -11,6 +11,7 @@
 #define PACKED __attribute__ ((packed))
 #define UNUSED __attribute__ ((unused))
 #define ASM __asm__ __volatile__
+#define barrier() ASM("" ::: "memory")
 #define container_of(ptr, type, member) ({ \
           const typeof(((type *)0)->member) *__mptr=(ptr); \
           (type *)((char*)__mptr-offsetof(type, member));})
@@ -25,6 +26,11 @@
 #define IRQ_DISABLE do{ int __ie = geteflags()&0x200; if(__ie) cli();
 #define IRQ_RESTORE if(__ie) sti(); }while(0);
 
+#define BITMAP_WORDS(nbits) (((nbits)+31)/32)
+#define bitmap_setbit(map, bit)   ((map)[(bit)/32] |= 1u << ((bit)%32))
+#define bitmap_clearbit(map, bit) ((map)[(bit)/32] &= ~(1u << ((bit)%32)))
+#define bitmap_testbit(map, bit)  (((map)[(bit)/32] >> ((bit)%32)) & 1)
+
 #define pagealign(a) ((a)&~(PAGESIZE-1))
 #define align(a, b) ((a)&~(b-1))
 
@@ -42,11 +48,13 @@ int strcmp(const char *s1, const char *s2);
 int strncmp(const char *s1, const char *s2, size_t n);
 char *strdup(const char *str);
 void *memcpy(void *dest, const void *src, size_t n);
+void *memcpy_kernel(void *dest, const void *src, size_t n);
 void bzero(void *s, size_t n);
 void *memset(void *s, int c, size_t n);
 int memcmp(const void *s1, const void *s2, size_t n);
 void *memmove(void *dest, const void *src, size_t n);
 void *memchr(const void *s, int c, size_t n);
+extern int memcpy_sse2_enabled;
 char *strchr(const char *s, int c);
 char *strcpy(char *dest, const char *src);
 char *strncat(char *dest, const char *src, size_t n);
@@ -68,3 +76,4 @@ void show_number(u32);
 void abort(void);
 void exit(int status);
 void panic(const char *msg);
+int bitmap_find_zero(const u32 *map, int nbits, int start);
@@ -22,6 +22,16 @@
 #include <net/socket/socket.h>
 #include <net/util.h>
 #include <kern/multiboot.h>
+#include <kern/reclaim.h>
+#include <kern/cpu.h>
+#include <kern/membench.h>
+#include <kern/hrtimer.h>
+#include <kern/clock.h>
+#include <kern/vdso.h>
+#include <kern/smp.h>
+#include <kern/irq.h>
+#include <kern/futex.h>
+#include <kern/fpu.h>
 
 
 void _init(void);
@@ -29,18 +39,30 @@ void _init(void);
 void kernel_main(struct multiboot_info *bootinfo) {
 	vga_init();
 	puts("Starting kernel...");
+  //held until the first thread leaves the kernel
+  kernel_lock();
+  cpu_init();
+  fpu_init();
   malloc_init();
   page_init(bootinfo);
+  if(MEMBENCH_AT_BOOT)
+    membench_run();
 
   idt_init();
   //for(int i=0; i<=0xff; i++)
     //idt_register(i, IDT_INTGATE, spurious_inthandler);
   idt_register(13, IDT_INTGATE, gpe_inthandler);
+  idt_register(7, IDT_INTGATE, nm_inthandler);
   idt_register(14, IDT_INTGATE, pf_inthandler);
   idt_register(0x80, IDT_INTGATE, syscall_inthandler);
   pic_init();
   pagetbl_init();
+  smp_init();
+  irq_init();
+  vdso_init();
   dispatcher_init();
+  futex_init();
+  reclaim_init();
   vmem_init();
   pci_init();
   blkdev_init();
@@ -56,6 +78,9 @@ void kernel_main(struct multiboot_info *bootinfo) {
 
 	ip_set_defaultgw(IPADDR(192,168,4,1));
   pit_init();
+  clock_init();
+  tick_init();
+  smp_boot_aps();
 
   dispatcher_run();
 
@@ -72,9 +97,9 @@ void thread_main(void *arg UNUSED) {
   if(!f) {
     puts("tty1 open failed.");
   }
-  current->files[0] = f;
-  current->files[1] = dup(f);
-  current->files[2] = dup(f);
+  fd_install(fd_get(), f);
+  fd_install(fd_get(), dup(f));
+  fd_install(fd_get(), dup(f));
 
   thread_chdir("/");
 
@@ -1,5 +1,6 @@
 #include <kern/kernmrb.h>
 #include <kern/kernlib.h>
+#include <kern/reclaim.h>
 #include <mruby.h>
 #include <mruby/irep.h>
 #include <mruby/compile.h>
@@ -8,10 +9,33 @@
 
 static mrb_state *global_state = NULL;
 
+static int mrb_shrinker_count(void);
+static int mrb_shrinker_scan(int nr);
+
+static struct shrinker mrb_shrinker = {
+  .name = "mruby_gc",
+  .count = mrb_shrinker_count,
+  .scan = mrb_shrinker_scan,
+};
+
 void kernelmrb_init() {
   global_state = mrb_open();
   if (!global_state)
     panic("failed to initialize mruby");
+  shrinker_register(&mrb_shrinker);
+}
+
+//the mruby heap is opaque, so it is counted as a single object
+//and scanning it runs a full gc.
+static int mrb_shrinker_count() {
+  return global_state ? 1 : 0;
+}
+
+static int mrb_shrinker_scan(int nr UNUSED) {
+  if (!global_state)
+    return 0;
+  mrb_full_gc(global_state);
+  return 1;
 }
 
 static void dump_error(mrb_state *mrb) {
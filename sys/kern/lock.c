@@ -1,29 +1,208 @@
 #include <kern/lock.h>
 #include <kern/kernasm.h>
 #include <kern/thread.h>
+#include <kern/sched.h>
+#include <kern/kernlib.h>
+#include <kern/params.h>
 #include <stdint.h>
 #include <stddef.h>
 
 void mutex_init(mutex *mtx) {
-  *mtx = 0;
+  bzero(mtx, sizeof(mutex));
 }
 
+//the owner runs at the lowest nice lent by the mutexes it still holds
+static void mutex_update_pi(struct thread *t) {
+  int nice = NICE_MAX;
+  struct list_head *p;
+  list_foreach(p, &t->pi_mutexes) {
+    mutex *m = list_entry(p, mutex, pi_link);
+    nice = MIN(nice, m->waiter_nice);
+  }
+  t->pi_nice = nice;
+  sched_update_nice(t);
+}
+
+//a waiter with a lower nice lends it to the owner until the unlock, so
+//that a user thread holding a lock can't hold up system threads
+static void mutex_boost(mutex *mtx) {
+  struct thread *owner = mtx->owner;
+  if(!MUTEX_PRIORITY_INHERIT || current->nice >= owner->base_nice)
+    return;
+  if(!mtx->boosted) {
+    mtx->boosted = 1;
+    mtx->waiter_nice = current->nice;
+    list_pushback(&mtx->pi_link, &owner->pi_mutexes);
+  } else {
+    mtx->waiter_nice = MIN(mtx->waiter_nice, current->nice);
+  }
+  mutex_update_pi(owner);
+}
+
+//waiting doesn't spin. under the kernel lock the owner can't make
+//progress meanwhile anyway.
 void mutex_lock(mutex *mtx) {
-  cli();
-  while(xchg(1, mtx))
-    thread_sleep(mtx);
-  sti();
+IRQ_DISABLE
+  mtx->nlocks++;
+  if(mtx->owner == NULL) {
+    mtx->owner = current;
+  } else {
+    mtx->ncontended++;
+    mtx->nwaiters++;
+    mutex_boost(mtx);
+    //woken up when the lock is handed over. a spurious wakeup may find
+    //it released with nobody to hand it to.
+    while(mtx->owner != current) {
+      if(mtx->owner == NULL) {
+        mtx->owner = current;
+        break;
+      }
+      thread_sleep_uninterruptible(mtx);
+    }
+    mtx->nwaiters--;
+  }
+IRQ_RESTORE
 }
 
 int mutex_trylock(mutex *mtx) {
-  if(xchg(1, mtx) == 0)
-    return 0;
-  else
-    return -1;
+  int ret = -1;
+IRQ_DISABLE
+  if(mtx->owner == NULL) {
+    mtx->owner = current;
+    mtx->nlocks++;
+    ret = 0;
+  }
+IRQ_RESTORE
+  return ret;
 }
 
 void mutex_unlock(mutex *mtx) {
-  xchg(0, mtx);
-  thread_wakeup(mtx);
+IRQ_DISABLE
+  struct thread *next = mtx->nwaiters ? thread_wakeup_one(mtx) : NULL;
+  if(mtx->boosted) {
+    list_remove(&mtx->pi_link);
+    //the waiters left behind keep lending to the new owner. the nice
+    //may have been the woken one's, then it stays too low until the
+    //next unlock.
+    if(next && mtx->nwaiters > 1) {
+      list_pushback(&mtx->pi_link, &next->pi_mutexes);
+      mutex_update_pi(next);
+    } else {
+      mtx->boosted = 0;
+    }
+    mutex_update_pi(current);
+  }
+  mtx->owner = next;
+IRQ_RESTORE
 }
 
+void spinlock_init(spinlock *lock) {
+  *lock = 0;
+}
+
+void spin_lock(spinlock *lock) {
+  preempt_disable();
+  while(xchg(1, lock))
+    ASM("pause");
+}
+
+int spin_trylock(spinlock *lock) {
+  preempt_disable();
+  if(xchg(1, lock) == 0)
+    return 0;
+  preempt_enable();
+  return -1;
+}
+
+void spin_unlock(spinlock *lock) {
+  xchg(0, lock);
+  preempt_enable();
+}
+
+void rwlock_init(rwlock *rw) {
+  bzero(rw, sizeof(rwlock));
+}
+
+void read_lock(rwlock *rw) {
+IRQ_DISABLE
+  while(rw->writer || rw->writers_waiting)
+    thread_sleep_uninterruptible(rw);
+  rw->readers++;
+IRQ_RESTORE
+}
+
+int read_trylock(rwlock *rw) {
+  int ret = -1;
+IRQ_DISABLE
+  if(rw->writer == NULL && rw->writers_waiting == 0) {
+    rw->readers++;
+    ret = 0;
+  }
+IRQ_RESTORE
+  return ret;
+}
+
+void read_unlock(rwlock *rw) {
+IRQ_DISABLE
+  if(--rw->readers == 0 && rw->writers_waiting)
+    thread_wakeup(rw);
+IRQ_RESTORE
+}
+
+void write_lock(rwlock *rw) {
+IRQ_DISABLE
+  rw->writers_waiting++;
+  while(rw->writer || rw->readers)
+    thread_sleep_uninterruptible(rw);
+  rw->writers_waiting--;
+  rw->writer = current;
+IRQ_RESTORE
+}
+
+int write_trylock(rwlock *rw) {
+  int ret = -1;
+IRQ_DISABLE
+  if(rw->writer == NULL && rw->readers == 0) {
+    rw->writer = current;
+    ret = 0;
+  }
+IRQ_RESTORE
+  return ret;
+}
+
+//wakes everyone, the readers go in together unless another writer waits
+void write_unlock(rwlock *rw) {
+IRQ_DISABLE
+  rw->writer = NULL;
+  thread_wakeup(rw);
+IRQ_RESTORE
+}
+
+void seqlock_init(seqlock *sl) {
+  sl->seq = 0;
+}
+
+u32 read_seqbegin(seqlock *sl) {
+  u32 seq;
+  while((seq = sl->seq) & 1)
+    ASM("pause");
+  barrier();
+  return seq;
+}
+
+int read_seqretry(seqlock *sl, u32 start) {
+  barrier();
+  return sl->seq != start;
+}
+
+void write_seqlock(seqlock *sl) {
+  preempt_disable();
+  sl->seq++;
+  barrier();
+}
+
+void write_sequnlock(seqlock *sl) {
+  barrier();
+  sl->seq++;
+  preempt_enable();
+}
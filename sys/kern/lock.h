@@ -1,9 +1,68 @@
 #pragma once
 #include <kern/types.h>
+#include <kern/list.h>
 
-typedef u32 mutex;
+struct thread;
+
+//a sleeping lock for threads. the unlocking thread hands it directly to
+//the longest waiting one. all zero is an unlocked mutex.
+typedef struct {
+  struct thread *owner;
+  u32 nwaiters;
+  int boosted; //the owner runs at the nice of a waiter
+  int waiter_nice; //the lowest one lent while boosted
+  struct list_head pi_link; //on pi_mutexes of the owner while boosted
+  //statistics
+  u32 nlocks;
+  u32 ncontended;
+} mutex;
 
 void mutex_init(mutex *mtx);
 void mutex_lock(mutex *mtx);
 int mutex_trylock(mutex *mtx);
 void mutex_unlock(mutex *mtx);
+
+//short critical sections shared only between threads. holding one
+//disables preemption but not interrupts, so the holder must not sleep
+//and interrupt handlers must not take it.
+typedef u32 spinlock;
+
+void spinlock_init(spinlock *lock);
+void spin_lock(spinlock *lock);
+int spin_trylock(spinlock *lock);
+void spin_unlock(spinlock *lock);
+
+//sleeping lock for read-mostly data. readers share it, a waiting writer
+//holds off new readers so it can't be starved. not recursive for readers.
+typedef struct {
+  int readers;
+  struct thread *writer;
+  u32 writers_waiting;
+} rwlock;
+
+void rwlock_init(rwlock *rw);
+void read_lock(rwlock *rw);
+int read_trylock(rwlock *rw);
+void read_unlock(rwlock *rw);
+void write_lock(rwlock *rw);
+int write_trylock(rwlock *rw);
+void write_unlock(rwlock *rw);
+
+//readers take no lock at all and retry when a writer ran meanwhile:
+//  do {
+//    seq = read_seqbegin(&sl);
+//    ...
+//  } while(read_seqretry(&sl, seq));
+//writers must be serialized by the caller and must not sleep, and must
+//disable interrupts if an interrupt handler reads. the data
+//read may be inconsistent before the retry check, so it must not be
+//freed under a reader.
+typedef struct {
+  volatile u32 seq; //odd while a write is in progress
+} seqlock;
+
+void seqlock_init(seqlock *sl);
+u32 read_seqbegin(seqlock *sl);
+int read_seqretry(seqlock *sl, u32 start);
+void write_seqlock(seqlock *sl);
+void write_sequnlock(seqlock *sl);
@@ -49,9 +49,10 @@ static struct chunkhdr *getnewchunk(size_t objsize) {
   return newchunk;
 }
 
-static void *getobj(int binindex) {
+//interrupt handlers allocate too, so the bins are protected by disabling
+//interrupts. the page allocator is called outside of that window.
+static void *takeobj(int binindex) {
   struct list_head *p;
-retry:
   list_foreach(p, &bin[binindex]) {
     struct chunkhdr *ch = list_entry(p, struct chunkhdr, link);
     if(ch->nfree > 0) {
@@ -61,14 +62,26 @@ retry:
       return obj;
     }
   }
+  return NULL;
+}
+
+static void *getobj(int binindex) {
+  void *obj;
+IRQ_DISABLE
+  obj = takeobj(binindex);
+IRQ_RESTORE
+  if(obj != NULL)
+    return obj;
 
   struct chunkhdr *newch = getnewchunk(binindex * SIZE_BASE);
   if(newch == NULL)
     return NULL;
 
+IRQ_DISABLE
   list_pushfront(&newch->link, &bin[binindex]);
-
-  goto retry;
+  obj = takeobj(binindex);
+IRQ_RESTORE
+  return obj;
 }
 
 void *malloc(size_t request) {
@@ -77,7 +90,6 @@ void *malloc(size_t request) {
   if (request == 0)
     return NULL;
 
-IRQ_DISABLE
   size_t size = (request + (SIZE_BASE-1)) & ~(SIZE_BASE-1);
 
   if(size > USE_BIN_THRESHOLD) {
@@ -92,7 +104,6 @@ IRQ_DISABLE
     if(m == NULL)
      puts("warn: malloc failed.");
   }
-IRQ_RESTORE
   return m;
 }
 
@@ -100,21 +111,25 @@ void free(void *addr) {
   if (addr == NULL)
     return;
 
-IRQ_DISABLE
   struct chunkhdr *ch = GET_CHUNKHDR(addr);
   if (ch->size > USE_BIN_THRESHOLD) {
     page_free(ch);
+    return;
+  }
+
+  struct chunkhdr *empty = NULL;
+IRQ_DISABLE
+  ch->nfree++;
+  if (ch->nfree == ch->nobjs) {
+    list_remove(&ch->link);
+    empty = ch;
   } else {
-    ch->nfree++;
-    if (ch->nfree == ch->nobjs) {
-      list_remove(&ch->link);
-      page_free(ch);
-    } else {
-      *(void **)addr = ch->freelist;
-      ch->freelist = addr;
-    }
+    *(void **)addr = ch->freelist;
+    ch->freelist = addr;
   }
 IRQ_RESTORE
+  if (empty != NULL)
+    page_free(empty);
 }
 
 void *realloc(void *ptr, size_t size) {
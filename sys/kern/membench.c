@@ -0,0 +1,67 @@
+#include <kern/membench.h>
+#include <kern/kernlib.h>
+#include <kern/kernasm.h>
+#include <kern/page.h>
+
+#define MEMBENCH_BUFSIZE (64 * 1024)
+#define MEMBENCH_BYTES   (4 * 1024 * 1024) //bytes processed per measurement
+
+static const size_t size_classes[] = { 16, 64, 256, 1024, 4096, 16384, 65536 };
+
+static u8 *bufa, *bufb;
+
+static void bench_memcpy(size_t n) { memcpy(bufa, bufb, n); }
+static void bench_memcpy_kernel(size_t n) { memcpy_kernel(bufa, bufb, n); }
+static void bench_memcpy_unaligned(size_t n) { memcpy(bufa + 1, bufb + 3, n - 3); }
+static void bench_memmove(size_t n) { memmove(bufa + 8, bufa, n - 8); }
+static void bench_memset(size_t n) { memset(bufa, 0x5a, n); }
+static void bench_bzero(size_t n) { bzero(bufa, n); }
+static void bench_memcmp(size_t n) { memcmp(bufa, bufb, n); }
+
+static void measure(const char *name, void (*func)(size_t)) {
+  printf("membench: %s:", name);
+  for(u32 i = 0; i < sizeof(size_classes) / sizeof(size_classes[0]); i++) {
+    size_t n = size_classes[i];
+    u32 iter = MEMBENCH_BYTES / n;
+    func(n); //warm up
+
+    u64 begin = rdtsc();
+    for(u32 j = 0; j < iter; j++)
+      func(n);
+    u32 cycles = (u32)(rdtsc() - begin);
+
+    //bytes/cycle in 1/100
+    u32 bpc = (u32)((u64)iter * n * 100 / MAX(cycles, 1u));
+    printf(" %u.%u%u", bpc / 100, (bpc / 10) % 10, bpc % 10);
+  }
+  printf("\n");
+}
+
+//prints bytes/cycle of each mem* function for each size class
+void membench_run() {
+  bufa = page_alloc(MEMBENCH_BUFSIZE, 0);
+  bufb = page_alloc(MEMBENCH_BUFSIZE, 0);
+  if(bufa == NULL || bufb == NULL) {
+    puts("membench: failed to allocate buffers");
+    return;
+  }
+  bzero(bufa, MEMBENCH_BUFSIZE);
+  bzero(bufb, MEMBENCH_BUFSIZE);
+
+  printf("membench: bytes/cycle for sizes");
+  for(u32 i = 0; i < sizeof(size_classes) / sizeof(size_classes[0]); i++)
+    printf(" %u", size_classes[i]);
+  printf("\n");
+
+  measure("memcpy", bench_memcpy);
+  if(memcpy_sse2_enabled)
+    measure("memcpy-sse2", bench_memcpy_kernel);
+  measure("memcpy-ua", bench_memcpy_unaligned);
+  measure("memmove", bench_memmove);
+  measure("memset", bench_memset);
+  measure("bzero", bench_bzero);
+  measure("memcmp", bench_memcmp);
+
+  page_free(bufa);
+  page_free(bufb);
+}
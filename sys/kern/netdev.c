@@ -1,10 +1,12 @@
 #include <kern/netdev.h>
 #include <kern/thread.h>
+#include <kern/sched.h>
 
 const struct netdev_ops *netdev_tbl[MAX_NETDEV];
 struct list_head ifaddr_list[MAX_NETDEV];
 
 struct list_head ifaddr_tbl[MAX_PF];
+seqlock ifaddr_seq;
 static u16 nnetdev;
 
 void netdev_init() {
@@ -15,6 +17,7 @@ void netdev_init() {
 
   for(int i=0; i<MAX_PF; i++)
     list_init(&ifaddr_tbl[i]);
+  seqlock_init(&ifaddr_seq);
 
   nnetdev = BAD_MAJOR + 1;
 }
@@ -29,13 +32,14 @@ int netdev_register(const struct netdev_ops *ops) {
 int netdev_tx(devno_t devno, struct pktbuf *pkt) {
   int res = -1;
   const struct netdev_ops *dev = netdev_tbl[DEV_MAJOR(devno)];
-IRQ_DISABLE
+  //drivers wake dev from their workqueues, never from interrupt handlers
+  preempt_disable();
   while(res < 0) {
     res = dev->tx(DEV_MINOR(devno), pkt);
     if(res < 0)
       thread_sleep(dev);
   }
-IRQ_RESTORE
+  preempt_enable();
   return 0;
 }
 
@@ -47,13 +51,13 @@ int netdev_tx_nowait(devno_t devno, struct pktbuf *pkt) {
 struct pktbuf *netdev_rx(devno_t devno) {
   struct pktbuf *pkt = NULL;
   const struct netdev_ops *dev = netdev_tbl[DEV_MAJOR(devno)];
-IRQ_DISABLE
+  preempt_disable();
   while(pkt == NULL) {
     pkt = dev->rx(DEV_MINOR(devno));
     if(pkt == NULL)
       thread_sleep(dev);
   }
-IRQ_RESTORE
+  preempt_enable();
   return pkt;
 }
 
@@ -64,18 +68,28 @@ struct pktbuf *netdev_rx_nowait(devno_t devno) {
 
 void netdev_add_ifaddr(devno_t devno, struct ifaddr *addr) {
   addr->devno = devno;
+  write_seqlock(&ifaddr_seq);
   list_pushback(&addr->dev_link, &ifaddr_list[DEV_MAJOR(devno)]);
   list_pushback(&addr->family_link, &ifaddr_tbl[addr->family]);
+  write_sequnlock(&ifaddr_seq);
 }
 
 struct ifaddr *netdev_find_addr(devno_t devno, u16 pf) {
   struct list_head *p;
-  list_foreach(p, &ifaddr_list[DEV_MAJOR(devno)]) {
-    struct ifaddr *addr = list_entry(p, struct ifaddr, dev_link);
-    if(addr->devno == devno && addr->family == pf)
-      return addr;
-  }
-  return NULL;
+  struct ifaddr *found;
+  u32 seq;
+  do {
+    seq = read_seqbegin(&ifaddr_seq);
+    found = NULL;
+    list_foreach(p, &ifaddr_list[DEV_MAJOR(devno)]) {
+      struct ifaddr *addr = list_entry(p, struct ifaddr, dev_link);
+      if(addr->devno == devno && addr->family == pf) {
+        found = addr;
+        break;
+      }
+    }
+  } while(read_seqretry(&ifaddr_seq, seq));
+  return found;
 }
 
 
@@ -3,6 +3,7 @@
 #include <kern/netdev.h>
 #include <kern/pktbuf.h>
 #include <kern/queue.h>
+#include <kern/lock.h>
 #include <net/socket/socket.h>
 
 struct netdev_ops {
@@ -22,6 +23,8 @@ struct ifaddr {
 };
 
 extern struct list_head ifaddr_tbl[MAX_PF];
+//the address lists and the ip routes are read under it. addresses are never freed.
+extern seqlock ifaddr_seq;
 
 void netdev_init(void);
 int netdev_register(const struct netdev_ops *ops);
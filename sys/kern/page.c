@@ -1,15 +1,17 @@
 #include <kern/page.h>
+#include <kern/pagetbl.h>
 #include <kern/thread.h>
+#include <kern/reclaim.h>
+#include <kern/vmem.h>
 #include <kern/kernlib.h>
 #include <kern/multiboot.h>
+#include <kern/kernasm.h>
 
 #define PAGE_ALLOCATED 0x1
-#define PAGE_RESERVED  0x2
-#define PAGE_NOTFREE   (PAGE_ALLOCATED | PAGE_RESERVED)
+#define PAGE_BUDDY     0x2 //head of a free block linked to a buddy list
+#define PAGE_ISOLATED  0x4 //taken off the buddy lists by compaction
 
-#define PAGE_ALLOC_ZEROPAGE 0x1
-
-#define MAX_ORDER 10
+#define MAX_ORDER 12 //largest block is 8MiB
 
 #define BUDDY(i) ((i) ^ (1 << pageinfo[(i)].order))
 #define BUDDY_OF_ORDER(i, ord) ((i) ^ (1 << (ord)))
@@ -18,24 +20,49 @@ struct page {
   struct list_head link;
   u32 flags;
   u32 order;
+  void *owner; //page_info of a movable user page
 };
 
 typedef u32 pageindex_t;
 
+struct zone {
+  const char *name;
+  pageindex_t start;
+  pageindex_t end;
+  struct list_head buddy_list[MAX_ORDER];
+  u32 buddy_count[MAX_ORDER];
+  u32 nfree;
+};
+
 static size_t memsize;
 struct page *pageinfo = NULL;
 static u32 page_total;
 static u32 protmem_freearea_addr;
+static u32 nfree_total;
+static u32 watermark[3];
+static u32 compact_success, compact_fail, compact_migrated, compact_deferred;
+//failed compactions back off exponentially, up to 1 << COMPACT_MAX_DEFER_SHIFT
+//skipped attempts
+#define COMPACT_MAX_DEFER_SHIFT 6
+static u32 compact_considered, compact_defer_shift;
+
+static struct zone zones[MAX_ZONE] = {
+  [ZONE_NORMAL] = { .name = "normal" },
+  [ZONE_HIGHMEM] = { .name = "highmem" },
+};
 
-struct list_head buddy_list[MAX_ORDER];
-u32 buddy_count[MAX_ORDER];
+#define ZONE_OF(i) (((pageindex_t)(i) >= zones[ZONE_HIGHMEM].start) ? &zones[ZONE_HIGHMEM] : &zones[ZONE_NORMAL])
+
+int page_getnfree_zone(int zoneid) {
+  return zones[zoneid].nfree;
+}
 
 int page_getnfree() {
-  int sum = 0;
-  for (int i=0; i<MAX_ORDER; i++)
-    sum += buddy_count[i] * (1 << i);
+  return nfree_total;
+}
 
-  return sum;
+int page_getwatermark(int wmark) {
+  return watermark[wmark];
 }
 
 int is_valid_page_index(pageindex_t idx) {
@@ -49,25 +76,33 @@ int is_free_page_index(pageindex_t idx) {
   if (!is_valid_page_index(idx))
     return 0;
 
-  if (pageinfo[idx].flags & PAGE_NOTFREE)
+  if (!(pageinfo[idx].flags & PAGE_BUDDY))
     return 0;
 
   return 1;
 }
 
 static void return_to_freelist(struct page *page) {
-  list_pushback(&page->link, &buddy_list[page->order]);
-  buddy_count[page->order] += 1;
+  struct zone *z = ZONE_OF(page - pageinfo);
+  page->flags |= PAGE_BUDDY;
+  list_pushback(&page->link, &z->buddy_list[page->order]);
+  z->buddy_count[page->order] += 1;
+  z->nfree += 1 << page->order;
+  nfree_total += 1 << page->order;
 }
 
 static void take_from_freelist(struct page *page) {
+  struct zone *z = ZONE_OF(page - pageinfo);
+  page->flags &= ~PAGE_BUDDY;
   list_remove(&page->link);
-  buddy_count[page->order] -= 1;
+  z->buddy_count[page->order] -= 1;
+  z->nfree -= 1 << page->order;
+  nfree_total -= 1 << page->order;
 }
 
 // returns 0 if merge performed
 // assigns merged page's index to merged_idx
-static int try_merge_buddy(pageindex_t this_idx, pageindex_t *merged_idx, int is_init) {
+static int try_merge_buddy(pageindex_t this_idx, pageindex_t *merged_idx) {
   struct page *this = &pageinfo[this_idx];
   if (!is_free_page_index(this_idx) || this->order+1 == MAX_ORDER)
     return -1;
@@ -76,15 +111,13 @@ static int try_merge_buddy(pageindex_t this_idx, pageindex_t *merged_idx, int is
   if (!is_free_page_index(buddy_idx))
     return -1;
 
-  struct page *buddy = &pageinfo[buddy_idx];
-  if (!is_init && this->order != buddy->order)
+  //buddies never cross a zone boundary
+  if (ZONE_OF(this_idx) != ZONE_OF(buddy_idx))
     return -1;
 
-  if (is_init) {
-    for (pageindex_t i = 0; i < (1 << this->order); i++)
-      if (!is_free_page_index(buddy_idx + i))
-        return -1;
-  }
+  struct page *buddy = &pageinfo[buddy_idx];
+  if (this->order != buddy->order)
+    return -1;
 
   if (this > buddy) {
     // swap
@@ -97,16 +130,12 @@ static int try_merge_buddy(pageindex_t this_idx, pageindex_t *merged_idx, int is
     this_idx = temp2;
   }
 
-  if (!is_init) {
-    take_from_freelist(this);
-    take_from_freelist(buddy);
+  take_from_freelist(this);
+  take_from_freelist(buddy);
 
-    this->order++;
-    this->flags = 0;
-    return_to_freelist(this);
-  } else {
-    this->order++;
-  }
+  this->order++;
+  this->flags = 0;
+  return_to_freelist(this);
 
   if (merged_idx)
     *merged_idx = this_idx;
@@ -133,126 +162,399 @@ static int split_to_buddy(pageindex_t this_idx) {
   return 0;
 }
 
-void show_buddyinfo() {
-  printf("buddy:");
+//fragmentation index of an allocation of the order, in 1/1000.
+//near 0 means a failure would be due to lack of memory, near 1000 due to
+//fragmentation. -1 if the allocation would succeed.
+int page_fragmentation_index(int zoneid, int order) {
+  struct zone *z = &zones[zoneid];
+  u32 nblocks = 0;
   for (int i=0; i<MAX_ORDER; i++) {
-    printf(" %u", buddy_count[i]);
+    if (i >= order && z->buddy_count[i] > 0)
+      return -1;
+    nblocks += z->buddy_count[i];
   }
-  printf("\n");
+  if (nblocks == 0)
+    return 0;
+
+  int index = 1000 - (1000 + (1000 * z->nfree) / (1u << order)) / nblocks;
+  return MAX(index, 0);
 }
 
-static void buddy_init(paddr_t start, size_t size) {
-  pageindex_t startindex = (start+(PAGESIZE-1)) / PAGESIZE;
-  pageindex_t endindex = startindex + size / PAGESIZE;
+void show_buddyinfo() {
+  for (int z=0; z<MAX_ZONE; z++) {
+    if (zones[z].start == zones[z].end)
+      continue;
+    printf("buddy(%s):", zones[z].name);
+    for (int i=0; i<MAX_ORDER; i++) {
+      printf(" %u", zones[z].buddy_count[i]);
+    }
+    printf("\nfrag(%s):", zones[z].name);
+    for (int i=0; i<MAX_ORDER; i++) {
+      printf(" %d", page_fragmentation_index(z, i));
+    }
+    printf("\n");
+  }
+  printf("compaction: %u succeeded, %u failed, %u deferred, %u pages migrated\n",
+           compact_success, compact_fail, compact_deferred, compact_migrated);
+}
 
-  for (int i=0; i<MAX_ORDER; i++) {
-    list_init(&buddy_list[i]);
-    buddy_count[i] = 0;
+//frees [start, end) as maximal aligned blocks. pages outside free blocks are
+//never looked at, so the cost depends on the number of blocks, not pages.
+static void buddy_init(pageindex_t start, pageindex_t end) {
+  while (start < end) {
+    u32 order = MAX_ORDER - 1;
+    while ((start & ((1u << order) - 1)) || start + (1u << order) > end)
+      order--;
+
+    pageindex_t idx = start;
+    pageinfo[idx].order = order;
+    pageinfo[idx].flags = 0;
+    return_to_freelist(&pageinfo[idx]);
+    //merges with the block from an adjacent range, if any
+    while (try_merge_buddy(idx, &idx) == 0);
+
+    start += 1u << order;
   }
+}
 
-  for (pageindex_t i=startindex; i<endindex; i++) {
-    pageinfo[i].flags &= ~PAGE_RESERVED;
-    pageinfo[i].order = 0;
+static pageindex_t zone_alloc(struct zone *z, int req_order) {
+  int free_order;
+  for (free_order = req_order; free_order < MAX_ORDER; free_order++) {
+    if(z->buddy_count[free_order] > 0)
+      break;
   }
+  if (free_order == MAX_ORDER)
+    return 0;
+
+  struct page *allocated = list_entry(list_first(&z->buddy_list[free_order]), struct page, link);
 
-  for (pageindex_t i=startindex; i<endindex; ) {
-    pageindex_t merged_idx = i;
-    while(try_merge_buddy(merged_idx, &merged_idx, 1) == 0);
-    struct page *merged = &pageinfo[merged_idx];
-    return_to_freelist(merged);
-    i = merged_idx + (1 << merged->order);
+  pageindex_t allocated_idx = allocated - pageinfo;
+  while (free_order-- != req_order) {
+    split_to_buddy(allocated_idx);
   }
 
-  show_buddyinfo();
+  allocated->flags |= PAGE_ALLOCATED;
+  take_from_freelist(allocated);
+
+  return allocated_idx;
 }
 
-void *page_alloc(size_t request, int flags) {
-  if (request == 0)
-    return NULL;
+//counts pages to be migrated to free the block. -1 if it has an unmovable page.
+static int block_count_movable(pageindex_t start, int order) {
+  int nmovable = 0;
+  for (pageindex_t i = start; i < start + (1u << order); ) {
+    struct page *p = &pageinfo[i];
+    if (p->flags & PAGE_BUDDY) {
+      i += 1u << p->order;
+    } else if ((p->flags & PAGE_ALLOCATED) && p->order == 0 && p->owner) {
+      nmovable++;
+      i++;
+    } else {
+      return -1;
+    }
+  }
+  return nmovable;
+}
 
-  size_t req_pages = (request + (PAGESIZE - 1)) / PAGESIZE;
-  int msb = 0;
-  for (int i=0; i<MAX_ORDER; i++) {
-    if (req_pages & (1 << i))
-      msb = i;
+//gives back isolated pieces of the block after a failed migration
+static void block_putback(pageindex_t start, int order) {
+  for (pageindex_t i = start; i < start + (1u << order); ) {
+    struct page *p = &pageinfo[i];
+    if (p->flags & PAGE_ISOLATED) {
+      u32 piece = 1u << p->order;
+      p->flags = 0;
+      page_free_phys(i * PAGESIZE);
+      i += piece;
+    } else {
+      i++;
+    }
   }
+}
 
-  int req_order = msb;
-  if (req_order >= MAX_ORDER)
-    return NULL;
+//isolates free pieces of the block, then moves its used pages out of it.
+static int block_migrate(pageindex_t start, int order) {
+  pageindex_t end = start + (1u << order);
+  for (pageindex_t i = start; i < end; ) {
+    struct page *p = &pageinfo[i];
+    if (p->flags & PAGE_BUDDY) {
+      take_from_freelist(p);
+      p->flags |= PAGE_ISOLATED;
+      i += 1u << p->order;
+    } else {
+      i++;
+    }
+  }
 
-  int free_order;
-alloc_try:
-  for (free_order = req_order; free_order < MAX_ORDER; free_order++) {
-    if(buddy_count[free_order] > 0)
-      break;
+  for (pageindex_t i = start; i < end; i++) {
+    struct page *p = &pageinfo[i];
+    if (!(p->flags & PAGE_ALLOCATED))
+      continue;
+
+    pageindex_t to = zone_alloc(&zones[ZONE_HIGHMEM], 0);
+    if (to == 0)
+      to = zone_alloc(&zones[ZONE_NORMAL], 0);
+    if (to == 0) {
+      block_putback(start, order);
+      return -1;
+    }
+    if (vmem_migrate_page(p->owner, i * PAGESIZE, to * PAGESIZE)) {
+      page_free_phys(to * PAGESIZE);
+      block_putback(start, order);
+      return -1;
+    }
+    pageinfo[to].owner = p->owner;
+    p->owner = NULL;
+    p->flags = PAGE_ISOLATED;
+    p->order = 0;
+    compact_migrated++;
   }
-  if (free_order == MAX_ORDER) {
-    if(thread_yield_pages() == 0)
-      goto alloc_try;
-    else
-      return NULL;
+
+  for (pageindex_t i = start; i < end; i++)
+    pageinfo[i].flags = 0;
+  pageinfo[start].order = order;
+  page_free_phys(start * PAGESIZE);
+  return 0;
+}
+
+//makes a free block of the order by migrating movable pages.
+//the block needing the fewest migrations is chosen.
+static int compact_zone(struct zone *z, int order) {
+  u32 size = 1u << order;
+  if (z->nfree < size * 2)
+    return -1;
+
+  pageindex_t best = 0;
+  int best_count = -1;
+  for (pageindex_t start = (z->start + size - 1) & ~(size - 1); start + size <= z->end; start += size) {
+    int n;
+    //interrupts are let in between blocks
+IRQ_DISABLE
+    n = block_count_movable(start, order);
+IRQ_RESTORE
+    if (n >= 0 && (best_count < 0 || n < best_count)) {
+      best = start;
+      best_count = n;
+    }
   }
 
-  struct page *allocated = list_entry(list_first(&buddy_list[free_order]), struct page, link);
+  int result = -1;
+  if (best_count >= 0) {
+IRQ_DISABLE
+    //the block may have changed since it was counted
+    if (block_count_movable(best, order) >= 0 && block_migrate(best, order) == 0)
+      result = 0;
+IRQ_RESTORE
+  }
+  if (result)
+    compact_fail++;
+  else
+    compact_success++;
+  return result;
+}
 
-  pageindex_t allocated_idx = allocated - pageinfo;
-  while (free_order-- != req_order) {
-    split_to_buddy(allocated_idx);
+static int compact_pages(int order, int flags) {
+  if (compact_defer_shift > 0 && ++compact_considered < (1u << compact_defer_shift)) {
+    compact_deferred++;
+    return -1;
   }
+  compact_considered = 0;
+
+  int result = -1;
+  if ((flags & PAGE_ALLOC_HIGHMEM) && compact_zone(&zones[ZONE_HIGHMEM], order) == 0)
+    result = 0;
+  else if (compact_zone(&zones[ZONE_NORMAL], order) == 0)
+    result = 0;
+
+  if (result == 0)
+    compact_defer_shift = 0;
+  else if (compact_defer_shift < COMPACT_MAX_DEFER_SHIFT)
+    compact_defer_shift++;
+  return result;
+}
 
-  allocated->flags |= PAGE_ALLOCATED;
-  take_from_freelist(allocated);
+//marks a user page as movable. owner is passed to vmem_migrate_page().
+void page_set_owner(paddr_t paddr, void *owner) {
+  pageinfo[paddr / PAGESIZE].owner = owner;
+}
+
+static int size_to_order(size_t request) {
+  size_t req_pages = (request + (PAGESIZE - 1)) / PAGESIZE;
+  int order = 0;
+  while ((1u << order) < req_pages)
+    order++;
+
+  return order;
+}
+
+static pageindex_t pages_alloc(size_t request, int flags) {
+  if (request == 0)
+    return 0;
+
+  int req_order = size_to_order(request);
+  if (req_order >= MAX_ORDER)
+    return 0;
+
+  pageindex_t idx;
+  for (;;) {
+    //malloc frees pages from interrupt handlers
+IRQ_DISABLE
+    idx = 0;
+    if (flags & PAGE_ALLOC_HIGHMEM)
+      idx = zone_alloc(&zones[ZONE_HIGHMEM], req_order);
+    if (idx == 0)
+      idx = zone_alloc(&zones[ZONE_NORMAL], req_order);
+IRQ_RESTORE
+    if (idx != 0)
+      break;
+    kswapd_wakeup();
+    //high-order allocations may fail only because free pages are scattered
+    if (req_order > 0 && compact_pages(req_order, flags) == 0)
+      continue;
+    if (reclaim_direct(1 << req_order) == 0
+        && thread_yield_pages(1 << req_order) == 0)
+      return 0;
+  }
+
+  //below the min watermark, the allocating thread has to help kswapd.
+  if (nfree_total < watermark[WMARK_MIN])
+    thread_yield_pages(watermark[WMARK_MIN] - nfree_total);
+  if (nfree_total < watermark[WMARK_LOW])
+    kswapd_wakeup();
+
+  return idx;
+}
+
+void *page_alloc(size_t request, int flags) {
+  pageindex_t idx = pages_alloc(request, flags & ~PAGE_ALLOC_HIGHMEM);
+  if (idx == 0)
+    return NULL;
 
-  paddr_t paddr = (paddr_t)(allocated_idx * PAGESIZE);
-  void *vaddr = (void *)PHYS_TO_KERN_VMEM(paddr);
+  void *vaddr = (void *)PHYS_TO_KERN_VMEM(idx * PAGESIZE);
   if (flags & PAGE_ALLOC_ZEROPAGE)
-    bzero(vaddr, PAGESIZE << req_order);
+    bzero(vaddr, PAGESIZE << pageinfo[idx].order);
 
   return vaddr;
 }
 
-void page_free(void *addr) {
-  paddr_t paddr = KERN_VMEM_TO_PHYS(addr);
+paddr_t page_alloc_phys(size_t request, int flags) {
+  pageindex_t idx = pages_alloc(request, flags);
+  if (idx == 0)
+    return 0;
+
+  paddr_t paddr = (paddr_t)(idx * PAGESIZE);
+  if (flags & PAGE_ALLOC_ZEROPAGE) {
+    for (u32 i = 0; i < (1u << pageinfo[idx].order); i++) {
+      void *vaddr = kmap(paddr + i * PAGESIZE);
+      bzero(vaddr, PAGESIZE);
+      kunmap(vaddr);
+    }
+  }
+
+  return paddr;
+}
+
+void page_free_phys(paddr_t paddr) {
   pageindex_t this_idx = paddr / PAGESIZE;
 
   struct page *this = &pageinfo[this_idx];
+IRQ_DISABLE
   this->flags &= ~PAGE_ALLOCATED;
+  this->owner = NULL;
   return_to_freelist(this);
 
-  while(try_merge_buddy(this_idx, &this_idx, 0) == 0);
+  while(try_merge_buddy(this_idx, &this_idx) == 0);
+IRQ_RESTORE
+}
+
+void page_free(void *addr) {
+  page_free_phys(KERN_VMEM_TO_PHYS(addr));
+}
+
+int page_is_highmem(paddr_t paddr) {
+  return (paddr / PAGESIZE) >= zones[ZONE_HIGHMEM].start;
 }
 
 extern void *_kernel_end;
 
+static pageindex_t free_start;
+
+//adds a usable physical memory range to the zones it covers
+static void page_add_range(u64 start, u64 end) {
+  start = MAX(start, (u64)free_start * PAGESIZE);
+  end = MIN(end, (u64)memsize);
+  if (start >= end)
+    return;
+
+  pageindex_t s = (start + (PAGESIZE-1)) / PAGESIZE;
+  pageindex_t e = end / PAGESIZE;
+  pageindex_t highmem = zones[ZONE_HIGHMEM].start;
+  if (s < highmem)
+    buddy_init(s, MIN(e, highmem));
+  if (e > highmem)
+    buddy_init(MAX(s, highmem), e);
+}
+
+#define MMAP_FOREACH(m, info) \
+  for ((m) = (struct multiboot_mmap_entry *)PHYS_TO_KERN_VMEM((info)->mmap_addr); \
+       (u8 *)(m) < (u8 *)PHYS_TO_KERN_VMEM((info)->mmap_addr) + (info)->mmap_length; \
+       (m) = (struct multiboot_mmap_entry *)((u8 *)(m) + (m)->size + sizeof((m)->size)))
+
 void page_init(struct multiboot_info *bootinfo) {
+  u64 begin = rdtsc();
+  struct multiboot_mmap_entry *mmap;
+
   if (bootinfo->flags & 0x40) {
-    struct multiboot_mmap_entry *mmap = (u32 *)PHYS_TO_KERN_VMEM((char *)bootinfo->mmap_addr);
-    struct multiboot_mmap_entry *mmap_end = (struct multiboot_mmap_entry *)((u8 *)mmap + bootinfo->mmap_length);
-    //printf("memory map: %x / %x\n", mmap, bootinfo->mmap_length);
-    for (; mmap < mmap_end; mmap = (u8 *)mmap + mmap->size + sizeof(mmap->size)) {
+    MMAP_FOREACH(mmap, bootinfo) {
       //printf("size=%u, addr=%x, len=%x, type=%d\n", mmap->size, (u32)(mmap->addr & 0xffffffff), (u32)(mmap->length & 0xffffffff), mmap->type);
-      if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE)
-        memsize = MAX(memsize, (u32)(mmap->addr & 0xffffffff) + (u32)(mmap->length & 0xffffffff));
+      if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE && mmap->addr < MAX_PHYS_MEM_SIZE)
+        memsize = MAX(memsize, (u32)MIN(mmap->addr + mmap->length, MAX_PHYS_MEM_SIZE));
     }
   } else if (bootinfo->flags & 0x2) {
-    memsize = bootinfo->mem_upper * 1024;
+    memsize = 0x100000 + bootinfo->mem_upper * 1024;
   } else {
     panic("can't detect memory info.");
   }
 
-  memsize = MIN(memsize, KERN_STRAIGHT_MAP_SIZE);
   memsize = memsize & ~(PAGESIZE-1);
   pageinfo = (struct page *)&_kernel_end;
   page_total = memsize / PAGESIZE;
-  for (u32 i=0; i<page_total; i++)
-    pageinfo[i].flags = PAGE_RESERVED;
+  //zero means "not free": pages become free only through buddy_init()
+  bzero(pageinfo, sizeof(struct page) * page_total);
 
   protmem_freearea_addr = (u32)&pageinfo[page_total];
+  free_start = (KERN_VMEM_TO_PHYS(protmem_freearea_addr) + (PAGESIZE-1)) / PAGESIZE;
+
+  size_t normal_end = MIN(memsize, KERN_STRAIGHT_MAP_SIZE);
+  zones[ZONE_NORMAL].start = 0;
+  zones[ZONE_NORMAL].end = normal_end / PAGESIZE;
+  zones[ZONE_HIGHMEM].start = normal_end / PAGESIZE;
+  zones[ZONE_HIGHMEM].end = page_total;
+  for (int z=0; z<MAX_ZONE; z++) {
+    for (int i=0; i<MAX_ORDER; i++) {
+      list_init(&zones[z].buddy_list[i]);
+      zones[z].buddy_count[i] = 0;
+    }
+  }
+
+  if (bootinfo->flags & 0x40) {
+    MMAP_FOREACH(mmap, bootinfo) {
+      if (mmap->type == MULTIBOOT_MEMORY_AVAILABLE)
+        page_add_range(mmap->addr, mmap->addr + mmap->length);
+    }
+  } else {
+    page_add_range(0x100000, memsize);
+  }
+
+  u32 kcycles = (u32)((rdtsc() - begin) >> 10);
+
+  show_buddyinfo();
 
-  buddy_init(KERN_VMEM_TO_PHYS(protmem_freearea_addr), memsize - (((u32)KERN_VMEM_TO_PHYS(protmem_freearea_addr))));
+  watermark[WMARK_MIN] = MAX(page_getnfree() / 256, 32);
+  watermark[WMARK_LOW] = watermark[WMARK_MIN] * 2;
+  watermark[WMARK_HIGH] = watermark[WMARK_MIN] * 3;
 
-  printf("page: %d MB(%d pages) free\n", (page_getnfree()*4)/1024, page_getnfree());
+  printf("page: %d MB(%d pages) free, %d MB highmem\n", (page_getnfree()*4)/1024, page_getnfree(), (page_getnfree_zone(ZONE_HIGHMEM)*4)/1024);
+  printf("page: %u MB managed, initialized in %u Kcycles\n", memsize / (1024*1024), kcycles);
 }
 
 void *get_zeropage(size_t request) {
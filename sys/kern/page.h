@@ -2,9 +2,24 @@
 #include <kern/kernlib.h>
 #include <kern/multiboot.h>
 
+#define ZONE_NORMAL  0 //straight mapped into the kernel space
+#define ZONE_HIGHMEM 1 //beyond KERN_STRAIGHT_MAP_SIZE, accessed via kmap()
+#define MAX_ZONE     2
+
+#define PAGE_ALLOC_ZEROPAGE 0x1
+#define PAGE_ALLOC_HIGHMEM  0x2 //prefer highmem (page_alloc_phys only)
+
 void page_init(struct multiboot_info *);
 int page_getnfree(void);
+int page_getnfree_zone(int zoneid);
+int page_getwatermark(int wmark);
 void *page_alloc(size_t, int);
 void page_free(void *addr);
+paddr_t page_alloc_phys(size_t, int);
+void page_free_phys(paddr_t paddr);
+int page_is_highmem(paddr_t paddr);
+void show_buddyinfo(void);
+int page_fragmentation_index(int zoneid, int order);
+void page_set_owner(paddr_t paddr, void *owner);
 void bzero(void *s, size_t n);
 void *get_zeropage(size_t);
@@ -6,6 +6,7 @@
 #include <kern/vga.h>
 #include <kern/page.h>
 #include <kern/thread.h>
+#include <kern/smp.h>
 
 #define PDE_PRESENT		 		0x1
 #define PDE_RW				 		0x2
@@ -24,6 +25,7 @@
 #define PTE_ACCESS				0x20
 #define PTE_DIRTY					0x40
 #define PTE_GLOBAL				0x100
+#define PTE_MIGRATING			0x200 //available to software
 
 #define TOTAL_NUM_PDE     (PAGESIZE >> 2)
 #define TOTAL_NUM_PTE     (PAGESIZE >> 2)
@@ -31,6 +33,12 @@ static u32 KERN_PDE_START;
 
 static u32 *kernspace_pdt; //beyond 0xc0000000
 
+static u32 *kmap_pt = NULL; //page table for KMAP_ADDR ... +KMAP_NPAGES
+static u32 kmap_next = 0;
+
+static u32 *ioremap_pt = NULL; //page table for IOREMAP_ADDR ... +IOREMAP_NPAGES
+static u32 ioremap_next = 0;
+
 void pagetbl_init() {
   //setup kernel space
   kernspace_pdt = get_zeropage(PAGESIZE);
@@ -50,10 +58,81 @@ void pagetbl_init() {
     u32 *pt = get_zeropage(PAGESIZE);
     kernspace_pdt[i] = KERN_VMEM_TO_PHYS((vaddr_t)pt) | PDE_PRESENT | PDE_RW;
   }
+  kmap_pt = (u32 *)PHYS_TO_KERN_VMEM(kernspace_pdt[KMAP_ADDR>>22] & ~0xfff);
+  ioremap_pt = (u32 *)PHYS_TO_KERN_VMEM(kernspace_pdt[IOREMAP_ADDR>>22] & ~0xfff);
 
   flushtlb(KERN_VMEM_TO_PHYS(kernspace_pdt));
 }
 
+//the page directory with only the kernel space
+paddr_t pagetbl_kernel() {
+  return KERN_VMEM_TO_PHYS(kernspace_pdt);
+}
+
+//temporary kernel mapping of a physical page.
+//straight mapped pages are returned as is.
+void *kmap(paddr_t paddr) {
+  if(paddr < KERN_STRAIGHT_MAP_SIZE)
+    return (void *)PHYS_TO_KERN_VMEM(paddr);
+
+  vaddr_t vaddr;
+IRQ_DISABLE
+  while(1) {
+    u32 i;
+    for(i = 0; i < KMAP_NPAGES; i++) {
+      u32 slot = (kmap_next + i) % KMAP_NPAGES;
+      if((kmap_pt[slot] & PTE_PRESENT) == 0) {
+        kmap_pt[slot] = pagealign(paddr) | PTE_PRESENT | PTE_RW;
+        kmap_next = (slot + 1) % KMAP_NPAGES;
+        vaddr = KMAP_ADDR + slot * PAGESIZE;
+        break;
+      }
+    }
+    if(i != KMAP_NPAGES)
+      break;
+    thread_sleep(&kmap_pt);
+  }
+  invlpg(vaddr);
+IRQ_RESTORE
+  return (void *)(vaddr + (paddr & (PAGESIZE-1)));
+}
+
+void kunmap(void *addr) {
+  vaddr_t vaddr = pagealign((vaddr_t)addr);
+  if(vaddr < KMAP_ADDR || vaddr >= KMAP_ADDR + KMAP_NPAGES * PAGESIZE)
+    return;
+
+IRQ_DISABLE
+  kmap_pt[(vaddr - KMAP_ADDR) / PAGESIZE] = 0;
+  invlpg(vaddr);
+  smp_flush_tlb_kernel();
+  thread_wakeup(&kmap_pt);
+IRQ_RESTORE
+}
+
+//maps device registers uncached into the kernel space.
+//mappings are permanent, returns NULL when the window is exhausted.
+void *ioremap(paddr_t paddr, size_t size) {
+  paddr_t base = pagealign(paddr);
+  u32 npages = (paddr - base + size + PAGESIZE - 1) / PAGESIZE;
+  vaddr_t vaddr = 0;
+
+IRQ_DISABLE
+  if(ioremap_next + npages <= IOREMAP_NPAGES) {
+    vaddr = IOREMAP_ADDR + ioremap_next * PAGESIZE;
+    for(u32 i = 0; i < npages; i++) {
+      ioremap_pt[ioremap_next + i] = (base + i * PAGESIZE) |
+        PTE_PRESENT | PTE_RW | PTE_WRITETHRU | PTE_CACHE_DISABLE;
+      invlpg(vaddr + i * PAGESIZE);
+    }
+    ioremap_next += npages;
+  }
+IRQ_RESTORE
+  if(vaddr == 0)
+    return NULL;
+  return (void *)(vaddr + (paddr - base));
+}
+
 
 paddr_t pagetbl_new() {
   u32 *pdt = get_zeropage(PAGESIZE);
@@ -64,16 +143,33 @@ paddr_t pagetbl_new() {
   return KERN_VMEM_TO_PHYS(pdt);
 }
 
-void pagetbl_add_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr) {
+//returns -1 if no page is left for the page table
+static int add_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr, u32 rw) {
   u32 *v_pdt = (u32 *)PHYS_TO_KERN_VMEM(pdt);
   int pdtindex = vaddr>>22;
   int ptindex = (vaddr>>12) & 0x3ff;
   if((v_pdt[pdtindex] & PDE_PRESENT) == 0) {
-    v_pdt[pdtindex] = KERN_VMEM_TO_PHYS((u32)get_zeropage(PAGESIZE)) | PDE_PRESENT | PDE_RW | PDE_USER;
+    paddr_t pt_paddr = page_alloc_phys(PAGESIZE, PAGE_ALLOC_ZEROPAGE | PAGE_ALLOC_HIGHMEM);
+    if(pt_paddr == 0)
+      return -1;
+    v_pdt[pdtindex] = pt_paddr | PDE_PRESENT | PDE_RW | PDE_USER;
   }
 
-  u32 *pt = (u32 *)(PHYS_TO_KERN_VMEM(v_pdt[pdtindex] & ~0xfff));
-  pt[ptindex] = (paddr & ~0xfff) | PTE_PRESENT | PTE_RW | PTE_USER;
+  u32 *pt = kmap(v_pdt[pdtindex] & ~0xfff);
+  u32 dirty = 0;
+  if((pt[ptindex] & ~0xfff) == (paddr & ~0xfff))
+    dirty = pt[ptindex] & PTE_DIRTY;
+  pt[ptindex] = (paddr & ~0xfff) | PTE_PRESENT | rw | PTE_USER | dirty;
+  kunmap(pt);
+  return 0;
+}
+
+int pagetbl_add_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr) {
+  return add_mapping(pdt, vaddr, paddr, PTE_RW);
+}
+
+int pagetbl_add_readonly_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr) {
+  return add_mapping(pdt, vaddr, paddr, 0);
 }
 
 void pagetbl_remove_mapping(u32 *pdt, vaddr_t vaddr) {
@@ -83,8 +179,79 @@ void pagetbl_remove_mapping(u32 *pdt, vaddr_t vaddr) {
   if((v_pdt[pdtindex] & PDE_PRESENT) == 0)
     return;
 
-  u32 *pt = (u32 *)(PHYS_TO_KERN_VMEM(v_pdt[pdtindex] & ~0xfff));
+  u32 *pt = kmap(v_pdt[pdtindex] & ~0xfff);
   pt[ptindex] &= ~PTE_PRESENT;
+  kunmap(pt);
+  //the owner may be running on another cpu
+  smp_flush_tlb_user((paddr_t)pdt);
+}
+
+//unmaps vaddr unless the page has been written, and returns 1 if it is
+//gone. a write on another cpu sets DIRTY before the tlb flush, or faults
+//after it, so no write is lost.
+int pagetbl_remove_clean_mapping(u32 *pdt, vaddr_t vaddr) {
+  u32 *v_pdt = (u32 *)PHYS_TO_KERN_VMEM(pdt);
+  int pdtindex = vaddr>>22;
+  int ptindex = (vaddr>>12) & 0x3ff;
+  if((v_pdt[pdtindex] & PDE_PRESENT) == 0)
+    return 1;
+
+  u32 *pt = kmap(v_pdt[pdtindex] & ~0xfff);
+  u32 old = __atomic_fetch_and(&pt[ptindex], ~PTE_PRESENT, __ATOMIC_SEQ_CST);
+  int removed = (old & PTE_DIRTY) == 0;
+  if(old & PTE_PRESENT) {
+    smp_flush_tlb_user((paddr_t)pdt);
+    if(pt[ptindex] & PTE_DIRTY) {
+      //nobody can write it while it is not present
+      pt[ptindex] |= PTE_PRESENT;
+      removed = 0;
+    }
+  }
+  kunmap(pt);
+  return removed;
+}
+
+//takes the mapping of vaddr away from user mode if it maps paddr, so the
+//page can be copied. the entry keeps the frame and flags for
+//pagetbl_replace_mapping(). returns 1 if blocked.
+int pagetbl_block_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr) {
+  u32 *v_pdt = (u32 *)PHYS_TO_KERN_VMEM(pdt);
+  int pdtindex = vaddr>>22;
+  int ptindex = (vaddr>>12) & 0x3ff;
+  if((v_pdt[pdtindex] & PDE_PRESENT) == 0)
+    return 0;
+
+  int blocked = 0;
+  u32 *pt = kmap(v_pdt[pdtindex] & ~0xfff);
+  if((pt[ptindex] & PTE_PRESENT) && (pt[ptindex] & ~0xfff) == (paddr & ~0xfff)) {
+    pt[ptindex] = (pt[ptindex] & ~PTE_PRESENT) | PTE_MIGRATING;
+    blocked = 1;
+  }
+  kunmap(pt);
+  //writes on other cpus stop here, before the copy
+  if(blocked)
+    smp_flush_tlb_user((paddr_t)pdt);
+  return blocked;
+}
+
+//points a mapping blocked by pagetbl_block_mapping() to "to" and makes it
+//present again. returns 1 if rewritten.
+int pagetbl_replace_mapping(u32 *pdt, vaddr_t vaddr, paddr_t from, paddr_t to) {
+  u32 *v_pdt = (u32 *)PHYS_TO_KERN_VMEM(pdt);
+  int pdtindex = vaddr>>22;
+  int ptindex = (vaddr>>12) & 0x3ff;
+  if((v_pdt[pdtindex] & PDE_PRESENT) == 0)
+    return 0;
+
+  int replaced = 0;
+  u32 *pt = kmap(v_pdt[pdtindex] & ~0xfff);
+  if((pt[ptindex] & PTE_MIGRATING) && (pt[ptindex] & ~0xfff) == (from & ~0xfff)) {
+    //not present until now, so no tlb holds it
+    pt[ptindex] = (to & ~0xfff) | (pt[ptindex] & 0xfff & ~PTE_MIGRATING) | PTE_PRESENT;
+    replaced = 1;
+  }
+  kunmap(pt);
+  return replaced;
 }
 
 void pagetbl_free(paddr_t pdt) {
@@ -92,29 +259,39 @@ void pagetbl_free(paddr_t pdt) {
   for(int i = 0; i < KERN_PDE_START; i++) {
     u32 ent = v_pdt[i];
     if((ent & PDE_PRESENT)) {
-      page_free(PHYS_TO_KERN_VMEM(ent & ~0xfff));
+      page_free_phys(ent & ~0xfff);
     }
   }
 
   page_free(v_pdt);
 }
 
-static vaddr_t pagetbl_dup_one(vaddr_t oldpt) {
+static paddr_t pagetbl_dup_one(paddr_t oldpt_paddr) {
   //copy page table entry
-  u32 *newpt = get_zeropage(PAGESIZE);
+  paddr_t newpt_paddr = page_alloc_phys(PAGESIZE, PAGE_ALLOC_ZEROPAGE | PAGE_ALLOC_HIGHMEM);
+  if(newpt_paddr == 0)
+    return 0;
+  u32 *oldpt = kmap(oldpt_paddr);
+  u32 *newpt = kmap(newpt_paddr);
 
   for(int i=0; i<TOTAL_NUM_PTE; i++) {
-    u32 oldent = ((u32 *)oldpt)[i];
+    u32 oldent = oldpt[i];
     if(oldent & PTE_PRESENT) {
-      newpt[i] = (oldent & ~0xfff) | PTE_PRESENT | PTE_USER; //Do not set PTE_RW due to copy-on-write.
-      ((u32 *)oldpt)[i] &= ~PTE_RW; //for copy-on-write
+      newpt[i] = (oldent & ~0xfff) | PTE_PRESENT | PTE_USER | (oldent & PTE_DIRTY); //Do not set PTE_RW due to copy-on-write.
+      oldpt[i] &= ~PTE_RW; //for copy-on-write
     }
   }
-  return (vaddr_t)newpt;
+
+  kunmap(newpt);
+  kunmap(oldpt);
+  return newpt_paddr;
 }
 
+//returns 0 if out of pages
 paddr_t pagetbl_dup_for_fork(paddr_t oldpdt) {
   u32 *pdt = page_alloc(PAGESIZE, 0);
+  if(pdt == NULL)
+    return 0;
   u32 *v_oldpdt = (u32 *)PHYS_TO_KERN_VMEM(oldpdt);
 
   //fill kernel space page directory entry
@@ -125,8 +302,13 @@ paddr_t pagetbl_dup_for_fork(paddr_t oldpdt) {
   for(int i = 0; i < KERN_PDE_START; i++) {
     u32 oldent = v_oldpdt[i];
     if(oldent & PDE_PRESENT) {
-      vaddr_t newpt = pagetbl_dup_one(PHYS_TO_KERN_VMEM(oldent & ~0xfff));
-      pdt[i] = KERN_VMEM_TO_PHYS(newpt) | PDE_PRESENT | PDE_RW | PDE_USER;
+      paddr_t newpt = pagetbl_dup_one(oldent & ~0xfff);
+      if(newpt == 0) {
+        //frees the tables copied so far
+        pagetbl_free(KERN_VMEM_TO_PHYS(pdt));
+        return 0;
+      }
+      pdt[i] = newpt | PDE_PRESENT | PDE_RW | PDE_USER;
     }
   }
 
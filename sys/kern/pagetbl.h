@@ -2,8 +2,16 @@
 #include <kern/kernlib.h>
 
 void pagetbl_init(void);
+paddr_t pagetbl_kernel(void);
 paddr_t pagetbl_new(void);
 void pagetbl_free(paddr_t pdt);
-void pagetbl_add_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr);
+int pagetbl_add_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr);
+int pagetbl_add_readonly_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr);
 void pagetbl_remove_mapping(u32 *pdt, vaddr_t vaddr);
+int pagetbl_remove_clean_mapping(u32 *pdt, vaddr_t vaddr);
+int pagetbl_block_mapping(u32 *pdt, vaddr_t vaddr, paddr_t paddr);
+int pagetbl_replace_mapping(u32 *pdt, vaddr_t vaddr, paddr_t from, paddr_t to);
 paddr_t pagetbl_dup_for_fork(paddr_t oldtbl);
+void *kmap(paddr_t paddr);
+void kunmap(void *addr);
+void *ioremap(paddr_t paddr, size_t size);
@@ -4,6 +4,11 @@
 #define KERN_VMEM_ADDR					((vaddr_t)0xc0000000u)
 #define PROTMEM_ADDR						((paddr_t)0x100000u)
 #define KERN_STRAIGHT_MAP_SIZE	((size_t)0x38000000) //896MB
+#define MAX_PHYS_MEM_SIZE				((u64)0xfffff000u)
+#define KMAP_ADDR								((vaddr_t)(KERN_VMEM_ADDR + KERN_STRAIGHT_MAP_SIZE))
+#define KMAP_NPAGES							1024 //4MB window for highmem pages
+#define IOREMAP_ADDR						((vaddr_t)(KMAP_ADDR + KMAP_NPAGES * PAGESIZE))
+#define IOREMAP_NPAGES					1024 //4MB window for memory mapped devices
 
 #define KERN_VMEM_TO_PHYS(v)		((paddr_t)((((vaddr_t)(v)) - KERN_VMEM_ADDR)))
 #define PHYS_TO_KERN_VMEM(p)		((vaddr_t)(((paddr_t)(p)) + KERN_VMEM_ADDR))
@@ -12,19 +17,27 @@
 
 #define KSTACK_SIZE (PAGESIZE * 8)
 
+#define MAX_CPUS 8
+#define AP_TRAMPOLINE_ADDR ((paddr_t)0x7000) //real mode entry of the application processors
+#define MAX_IOAPIC_PINS 24
+
 #define MAX_BLKDEV		64
 #define MAX_CHARDEV		128
 #define MAX_NETDEV		64
 #define MAX_FSTYPE		32
 #define MAX_MOUNT			32
-#define MAX_FILES			256
+#define MAX_FILES			4096 //per process
+#define FDTABLE_INITIAL	32 //slots before the table first grows
 #define MAX_THREADS   1024
 
 #define MAX_FILENAME_LEN   255 //null is not contained
 #define MAX_THREADNAME_LEN 64  //null is not contained
 
-#define NBLKBUF				1024
-#define NVCACHE				1024
+#define MEMBENCH_AT_BOOT 0 //run the mem* microbenchmark in kernel_main
+#define MUTEX_PRIORITY_INHERIT 1 //a mutex owner runs at the nice of its best waiter
+
+#define NBLKBUF_MIN			64  //block buffer cache grows from here while memory allows
+#define NVCACHE_MIN			64  //vnode cache, likewise
 
 #define CLASS_BLKDEV	1
 #define CLASS_CHARDEV	2
@@ -36,8 +49,10 @@
 #define GDT_SEL_CODESEG_3	3*8
 #define GDT_SEL_DATASEG_3	4*8
 #define GDT_SEL_TSS				5*8
+#define GDT_SEL_TLS				((5+MAX_CPUS)*8)
 
-#define USER_STACK_BOTTOM ((vaddr_t)0xc0000000)
+#define VDSO_ADDR ((vaddr_t)0xbfffe000) //2 pages right below the kernel space
+#define USER_STACK_BOTTOM VDSO_ADDR
 #define USER_STACK_INITIAL_SIZE ((size_t)0x1000)
 #define USER_STACK_GROW_SIZE ((size_t)0x1000)
 
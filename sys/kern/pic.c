@@ -72,3 +72,11 @@ void pic_sendeoi(int irq) {
     out8(SLAVE_CMD, 0x20);
   out8(MASTER_CMD, 0x20);
 }
+
+//the io apic took over
+void pic_disable() {
+  master_imr = MASK_ALL;
+  slave_imr = MASK_ALL;
+  out8(MASTER_IMR, master_imr);
+  out8(SLAVE_IMR, slave_imr);
+}
@@ -8,4 +8,5 @@ void pic_sendeoi(int irq);
 
 void pic_setmask(int irq);
 void pic_clearmask(int irq);
+void pic_disable(void);
 
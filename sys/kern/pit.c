@@ -1,9 +1,10 @@
 #include <kern/pit.h>
-#include <kern/pic.h>
-#include <kern/idt.h>
+#include <kern/irq.h>
 #include <kern/timer.h>
 #include <kern/kernasm.h>
 #include <kern/thread.h>
+#include <kern/hrtimer.h>
+#include <kern/sched.h>
 
 #define PIT_CH0_DATA 0x40
 #define PIT_CH1_DATA 0x41
@@ -14,21 +15,29 @@
 #define PIT_OPMODE_RATE 0x4
 #define PIT_OPMODE_SQUARE 0x6
 #define PIT_LOAD16 0x30
+#define PIT_OPMODE_ONESHOT 0x0
 #define PIT_CNT0 0x0
+#define PIT_CNT2 0x80
+
+#define PIT_CH2_GATE_PORT 0x61
+#define PIT_CH2_GATE 0x01
+#define PIT_SPEAKER 0x02
+#define PIT_CH2_OUT 0x20
 
 #define PIT_IRQ 0
 
 #define CNT_100HZ 0x2e9b
 
 
-void pit_isr(void);
+void pit_isr(u32 cs);
 void pit_inthandler(void);
 
-void pit_isr() {
+void pit_isr(u32 cs) {
   timer_tick();
-  pic_sendeoi(PIT_IRQ);
+  hrtimer_run_queues();
+  irq_eoi(PIT_IRQ);
   thread_check_signal();
-  thread_yield();
+  sched_tick((cs & 3) != 0);
 }
 
 void pit_init() {
@@ -36,6 +45,24 @@ void pit_init() {
         PIT_CNTMODE_BIN | PIT_OPMODE_RATE | PIT_LOAD16 | PIT_CNT0);
   out8(PIT_CH0_DATA, CNT_100HZ & 0xff);
   out8(PIT_CH0_DATA, CNT_100HZ >> 8);
-  idt_register(IRQ_TO_INTVEC(PIT_IRQ), IDT_INTGATE, pit_inthandler);
-  pic_clearmask(PIT_IRQ);
+  irq_register(PIT_IRQ, IRQ_EDGE, pit_inthandler);
+}
+
+//the local apic timer took over the tick
+void pit_stop() {
+  irq_mask(PIT_IRQ);
+}
+
+//busy waits on channel 2, which is not wired to an interrupt.
+//used to calibrate the other clocks. usecs must be below 54ms.
+void pit_busywait(u32 usecs) {
+  u32 count = (u64)usecs * PIT_FREQ / 1000000;
+  u8 gate = in8(PIT_CH2_GATE_PORT);
+  out8(PIT_CH2_GATE_PORT, (gate & ~PIT_SPEAKER) | PIT_CH2_GATE);
+  out8(PIT_MODE_CMD_REG,
+        PIT_CNTMODE_BIN | PIT_OPMODE_ONESHOT | PIT_LOAD16 | PIT_CNT2);
+  out8(PIT_CH2_DATA, count & 0xff);
+  out8(PIT_CH2_DATA, count >> 8);
+  while((in8(PIT_CH2_GATE_PORT) & PIT_CH2_OUT) == 0);
+  out8(PIT_CH2_GATE_PORT, gate);
 }
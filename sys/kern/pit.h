@@ -1,6 +1,9 @@
 #pragma once
-#include <stdint.h>
+#include <kern/types.h>
 
 #define PIT_HZ 100
+#define PIT_FREQ 1193182
 
 void pit_init(void);
+void pit_stop(void);
+void pit_busywait(u32 usecs);
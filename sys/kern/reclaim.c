@@ -0,0 +1,84 @@
+#include <kern/reclaim.h>
+#include <kern/page.h>
+#include <kern/thread.h>
+#include <kern/timer.h>
+#include <kern/kernlib.h>
+#include <kern/kernasm.h>
+
+#define RECLAIM_PRIORITY 4 //first pass scans 1/16 of each cache
+
+static struct list_head shrinker_list;
+static struct thread *kswapd_thread = NULL;
+static int kswapd_is_running = 0;
+static int in_direct_reclaim = 0;
+
+void shrinker_register(struct shrinker *s) {
+  list_pushback(&s->link, &shrinker_list);
+}
+
+//returns number of freed pages
+int reclaim_pages(int target) {
+  int before = page_getnfree();
+  struct list_head *p;
+
+  for(int prio = RECLAIM_PRIORITY; prio >= 0; prio--) {
+    list_foreach(p, &shrinker_list) {
+      struct shrinker *s = list_entry(p, struct shrinker, link);
+      int nr = s->count();
+      if(nr <= 0)
+        continue;
+      s->scan(MAX(nr >> prio, 1));
+      if(page_getnfree() - before >= target)
+        return page_getnfree() - before;
+    }
+  }
+
+  return MAX(page_getnfree() - before, 0);
+}
+
+//called by the page allocator on failure. shrinkers may sleep, so this is
+//skipped in interrupt context and when reclaim is already in progress.
+int reclaim_direct(int target) {
+  if(!(geteflags() & 0x200) || current == kswapd_thread || in_direct_reclaim)
+    return 0;
+
+  in_direct_reclaim = 1;
+  int freed = reclaim_pages(target);
+  in_direct_reclaim = 0;
+  return freed;
+}
+
+void kswapd_wakeup() {
+  if(kswapd_thread == NULL || kswapd_is_running)
+    return;
+
+  kswapd_is_running = 1;
+  thread_wakeup(&kswapd_thread);
+}
+
+static void kswapd(void *arg UNUSED) {
+  while(1) {
+    cli();
+    while(page_getnfree() >= page_getwatermark(WMARK_LOW)) {
+      kswapd_is_running = 0;
+      thread_sleep(&kswapd_thread);
+      cli();
+    }
+    kswapd_is_running = 1;
+    sti();
+
+    while(page_getnfree() < page_getwatermark(WMARK_HIGH)) {
+      if(reclaim_pages(page_getwatermark(WMARK_HIGH) - page_getnfree()) == 0) {
+        //nothing to reclaim now. back off for a while.
+        thread_set_alarm(&kswapd_thread, HZ);
+        thread_sleep(&kswapd_thread);
+      }
+    }
+  }
+}
+
+void reclaim_init() {
+  list_init(&shrinker_list);
+  kswapd_thread = kthread_new(kswapd, NULL, "kswapd", PRIORITY_USER, 1);
+  thread_run(kswapd_thread);
+}
@@ -0,0 +1,19 @@
+#pragma once
+#include <kern/kernlib.h>
+
+#define WMARK_MIN  0
+#define WMARK_LOW  1
+#define WMARK_HIGH 2
+
+struct shrinker {
+  struct list_head link;
+  const char *name;
+  int (*count)(void);   //number of reclaimable objects
+  int (*scan)(int nr);  //try to free nr objects, returns number of freed objects
+};
+
+void reclaim_init(void);
+void shrinker_register(struct shrinker *s);
+int reclaim_pages(int target);
+int reclaim_direct(int target);
+void kswapd_wakeup(void);
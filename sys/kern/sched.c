@@ -0,0 +1,311 @@
+#include <kern/sched.h>
+#include <kern/thread.h>
+#include <kern/clock.h>
+#include <kern/hrtimer.h>
+#include <kern/smp.h>
+
+//fair scheduler. each thread accumulates virtual runtime, its cpu time
+//scaled by NICE_0_WEIGHT/weight, and the one with the smallest vruntime
+//runs next. every runnable thread gets a share of SCHED_LATENCY_NS
+//proportional to its weight. the idle threads are not queued.
+
+#define SCHED_LATENCY_NS          20000000u //20ms
+#define SCHED_MIN_GRANULARITY_NS   4000000u
+#define SCHED_WAKEUP_GRANULARITY_NS 1000000u
+
+//weight of nice -20 ... 19, each step is about 10% of cpu time
+static const u32 nice_to_weight[NICE_MAX - NICE_MIN + 1] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+   9548,  7620,  6100,  4904,  3906,
+   3121,  2501,  1991,  1586,  1277,
+   1024,   820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,    87,    70,    56,    45,
+     36,    29,    23,    18,    15,
+};
+
+#define SCHED_BALANCE_TICKS 10 //between periodic load balancing
+
+int need_resched = 0; //checked on interrupt return and syscall exit
+//preemption is allowed only while this is 0. it belongs to the current
+//thread and is swapped on every context switch, so a thread may sleep
+//with preemption disabled just like with interrupts disabled.
+int preempt_count = 0;
+
+//every cpu has its own run queue. all of them are protected by the
+//kernel lock, so a cpu may look at and move threads on the others.
+#define this_rq() (&this_cpu->rq)
+
+void sched_init_cpu(struct cpu *c, struct thread *idle) {
+  list_init(&c->rq.queue);
+  c->rq.nr_running = 0;
+  c->rq.weight = 0;
+  c->rq.min_vruntime = 0;
+  c->rq.balance_ticks = 0;
+  c->rq.idle = idle;
+  idle->cpu = c;
+}
+
+static struct thread *cpu_curr(struct cpu *c) {
+  return c == this_cpu ? current : c->current;
+}
+
+static struct thread *first_queued(struct runqueue *rq) {
+  struct list_head *first = list_first(&rq->queue);
+  return first ? list_entry(first, struct thread, link) : NULL;
+}
+
+static void update_min_vruntime(struct runqueue *rq) {
+  u64 vruntime = rq->min_vruntime;
+  struct thread *first = first_queued(rq);
+  if(current != rq->idle && current->state == TASK_STATE_RUNNING) {
+    vruntime = current->vruntime;
+    if(first)
+      vruntime = MIN(vruntime, first->vruntime);
+  } else if(first) {
+    vruntime = first->vruntime;
+  }
+  //never goes backwards
+  rq->min_vruntime = MAX(rq->min_vruntime, vruntime);
+}
+
+//charges the time since the last update to the current thread
+void sched_update_curr() {
+  u64 now = clock_monotonic_ns();
+  u64 delta = now - current->exec_start;
+  current->exec_start = now;
+  current->sum_exec_runtime += delta;
+  if(current == this_rq()->idle)
+    return;
+  current->vruntime += delta * NICE_0_WEIGHT / current->weight;
+  update_min_vruntime(this_rq());
+}
+
+//the cpu time the thread gets in one scheduling period
+static u64 sched_slice(struct runqueue *rq, struct thread *t) {
+  u32 nr = rq->nr_running + 1;
+  u64 period = SCHED_LATENCY_NS;
+  if(nr * SCHED_MIN_GRANULARITY_NS > period)
+    period = (u64)nr * SCHED_MIN_GRANULARITY_NS;
+  return period * t->weight / (rq->weight + t->weight);
+}
+
+//the nice of the thread itself. a waiter on one of its mutexes may lend
+//it a lower one meanwhile.
+int sched_set_nice(struct thread *t, int nice) {
+  nice = MIN(MAX(nice, NICE_MIN), NICE_MAX);
+  t->base_nice = nice;
+  sched_update_nice(t);
+  return nice;
+}
+
+//applies a change of base_nice or pi_nice
+void sched_update_nice(struct thread *t) {
+  int nice = MIN(t->base_nice, t->pi_nice);
+  u32 weight = nice_to_weight[nice - NICE_MIN];
+  if(t->on_rq)
+    t->cpu->rq.weight += weight - t->weight;
+  t->nice = nice;
+  t->weight = weight;
+}
+
+//a new thread starts at the current min_vruntime, a forked one
+//also inherits the runtime debt of its parent
+void sched_fork(struct thread *t, struct thread *parent) {
+  t->cpu = this_cpu;
+  t->pi_nice = NICE_MAX;
+  list_init(&t->pi_mutexes);
+  if(parent)
+    sched_set_nice(t, parent->base_nice);
+  u64 min_vruntime = this_rq()->min_vruntime;
+  t->vruntime = parent ? MAX(parent->vruntime, min_vruntime) : min_vruntime;
+  t->sum_exec_runtime = 0;
+  t->prev_sum_exec_runtime = 0;
+  t->exec_start = clock_monotonic_ns();
+  t->utime = t->stime = 0;
+  t->cutime = t->cstime = 0;
+  t->preempt_count = 0;
+  t->lock_depth = 1; //it starts inside the kernel
+  t->on_rq = 0;
+}
+
+static void enqueue(struct runqueue *rq, struct thread *t) {
+  struct list_head *p;
+  list_foreach(p, &rq->queue) {
+    if(list_entry(p, struct thread, link)->vruntime > t->vruntime)
+      break;
+  }
+  list_pushback(&t->link, p); //inserts before p
+  rq->nr_running++;
+  rq->weight += t->weight;
+  t->on_rq = 1;
+}
+
+static void dequeue(struct runqueue *rq, struct thread *t) {
+  list_remove(&t->link);
+  rq->nr_running--;
+  rq->weight -= t->weight;
+  t->on_rq = 0;
+}
+
+//vruntime is relative to the min_vruntime of each queue, keep the lag
+static void set_cpu(struct thread *t, struct cpu *to) {
+  s64 lag = (s64)(t->vruntime - t->cpu->rq.min_vruntime);
+  u64 min_vruntime = to->rq.min_vruntime;
+  t->vruntime = (lag < 0 && (u64)-lag > min_vruntime) ? 0 : min_vruntime + lag;
+  t->cpu = to;
+}
+
+//must be called with interrupts disabled. t is queued on its last cpu.
+void sched_enqueue(struct thread *t) {
+  struct runqueue *rq = &t->cpu->rq;
+  if(t == rq->idle)
+    return;
+  enqueue(rq, t);
+}
+
+//a waking thread stays on its last cpu unless that one is busy and
+//another one is idle
+static struct cpu *select_cpu(struct thread *t) {
+  struct cpu *c;
+  if(cpu_curr(t->cpu) == t->cpu->rq.idle)
+    return t->cpu;
+  for_each_cpu(c) {
+    if(c->started && cpu_curr(c) == c->rq.idle && c->rq.nr_running == 0)
+      return c;
+  }
+  return t->cpu;
+}
+
+//must be called with interrupts disabled. t is off every list.
+void sched_wakeup(struct thread *t) {
+  struct cpu *c = select_cpu(t);
+  struct runqueue *rq = &c->rq;
+  if(c != t->cpu)
+    set_cpu(t, c);
+  //a sleeper gets at most half a period of credit, so that it runs
+  //soon without monopolizing the cpu
+  u64 credit = SCHED_LATENCY_NS / 2;
+  u64 floor = rq->min_vruntime > credit ? rq->min_vruntime - credit : 0;
+  t->vruntime = MAX(t->vruntime, floor);
+  enqueue(rq, t);
+
+  struct thread *curr = cpu_curr(c);
+  if(curr == rq->idle) {
+    smp_send_resched(c);
+  } else if(t != curr) {
+    if(c == this_cpu)
+      sched_update_curr();
+    if(t->vruntime + SCHED_WAKEUP_GRANULARITY_NS < curr->vruntime)
+      smp_send_resched(c);
+  }
+}
+
+static u32 cpu_load(struct cpu *c) {
+  return c->rq.nr_running + (cpu_curr(c) != c->rq.idle);
+}
+
+static struct cpu *find_busiest() {
+  struct cpu *c, *busiest = NULL;
+  for_each_cpu(c) {
+    if(c != this_cpu && c->started && c->rq.nr_running > 0 &&
+       (busiest == NULL || cpu_load(c) > cpu_load(busiest)))
+      busiest = c;
+  }
+  return busiest;
+}
+
+//pulls queued threads from the busiest cpu until the loads are even.
+//the ones that would run last there go first.
+static void load_balance(int newly_idle) {
+  struct cpu *busiest = find_busiest();
+  if(busiest == NULL)
+    return;
+  int moved = 0;
+  while(busiest->rq.nr_running > 0 &&
+        (newly_idle ? this_rq()->nr_running == 0 : cpu_load(busiest) > cpu_load(this_cpu) + 1)) {
+    struct thread *t = list_entry(list_last(&busiest->rq.queue), struct thread, link);
+    dequeue(&busiest->rq, t);
+    set_cpu(t, this_cpu);
+    enqueue(this_rq(), t);
+    moved = 1;
+  }
+  if(moved && current == this_rq()->idle)
+    need_resched = 1;
+}
+
+//must be called with interrupts disabled. returns the idle thread if
+//nothing else is runnable.
+struct thread *sched_pick_next() {
+  struct runqueue *rq = this_rq();
+  //an interrupt may preempt the idle thread while its tick is stopped
+  if(current == rq->idle)
+    tick_nohz_idle_exit();
+  if(rq->nr_running == 0)
+    load_balance(1);
+  struct thread *next = first_queued(rq);
+  need_resched = 0;
+  if(next == NULL) {
+    next = rq->idle;
+  } else {
+    dequeue(rq, next);
+  }
+  next->exec_start = clock_monotonic_ns();
+  next->prev_sum_exec_runtime = next->sum_exec_runtime;
+  return next;
+}
+
+//called from the timer interrupt. sets need_resched if the current
+//thread should give up the cpu, the interrupt return path preempts it.
+void sched_tick(int user_mode) {
+  struct runqueue *rq = this_rq();
+  if(user_mode)
+    current->utime++;
+  else
+    current->stime++;
+
+  if(current == rq->idle) {
+    load_balance(1);
+    if(rq->nr_running > 0)
+      need_resched = 1;
+    return;
+  }
+
+  if(++rq->balance_ticks >= SCHED_BALANCE_TICKS) {
+    rq->balance_ticks = 0;
+    load_balance(0);
+  }
+
+  sched_update_curr();
+  struct thread *first = first_queued(rq);
+  if(first == NULL)
+    return;
+  u64 slice = sched_slice(rq, current);
+  u64 ran = current->sum_exec_runtime - current->prev_sum_exec_runtime;
+  if(ran >= slice)
+    need_resched = 1;
+  //someone fell too far behind
+  else if(ran >= SCHED_MIN_GRANULARITY_NS && current->vruntime > first->vruntime + slice)
+    need_resched = 1;
+}
+
+void preempt_disable() {
+  preempt_count++;
+}
+
+//a preemption point. interrupt handlers run with interrupts disabled and
+//must not switch threads before returning, so only reschedule when they
+//are enabled. otherwise the next interrupt return will.
+void preempt_enable() {
+  if(--preempt_count == 0 && need_resched && (geteflags() & 0x200))
+    thread_yield();
+}
+
+void preempt_enable_no_resched() {
+  preempt_count--;
+}
+
+u32 sched_nr_running() {
+  return this_rq()->nr_running;
+}
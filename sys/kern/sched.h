@@ -0,0 +1,37 @@
+#pragma once
+#include <kern/kernlib.h>
+#include <kern/list.h>
+
+struct thread;
+struct cpu;
+
+#define NICE_MIN    (-20)
+#define NICE_MAX    19
+#define NICE_SYSTEM (-5) //kernel service threads
+#define NICE_0_WEIGHT 1024
+
+struct runqueue {
+  struct list_head queue; //sorted by vruntime
+  u32 nr_running; //queued, not counting the running thread
+  u32 weight;
+  u64 min_vruntime;
+  u32 balance_ticks;
+  struct thread *idle;
+};
+
+extern int need_resched;
+extern int preempt_count;
+
+void sched_init_cpu(struct cpu *c, struct thread *idle);
+void sched_fork(struct thread *t, struct thread *parent);
+int sched_set_nice(struct thread *t, int nice);
+void sched_update_nice(struct thread *t);
+void sched_update_curr(void);
+void sched_enqueue(struct thread *t);
+void sched_wakeup(struct thread *t);
+struct thread *sched_pick_next(void);
+void sched_tick(int user_mode);
+void preempt_disable(void);
+void preempt_enable(void);
+void preempt_enable_no_resched(void);
+u32 sched_nr_running(void);
@@ -0,0 +1,400 @@
+#include <kern/smp.h>
+#include <kern/apic.h>
+#include <kern/cpu.h>
+#include <kern/gdt.h>
+#include <kern/idt.h>
+#include <kern/kernasm.h>
+#include <kern/page.h>
+#include <kern/pagetbl.h>
+#include <kern/pit.h>
+
+//multiprocessor bring-up from the intel mp tables, and the big kernel lock
+
+struct mp_floating {
+  char signature[4]; //"_MP_"
+  u32 config;
+  u8 length; //in 16 bytes
+  u8 spec_rev;
+  u8 checksum;
+  u8 type;
+  u8 imcrp;
+  u8 reserved[3];
+} PACKED;
+
+struct mp_config {
+  char signature[4]; //"PCMP"
+  u16 length;
+  u8 spec_rev;
+  u8 checksum;
+  char oem[8];
+  char product[12];
+  u32 oem_table;
+  u16 oem_table_size;
+  u16 entry_count;
+  u32 lapic_addr;
+  u16 ext_length;
+  u8 ext_checksum;
+  u8 reserved;
+} PACKED;
+
+#define MP_PROCESSOR 0
+#define MP_BUS       1
+#define MP_IOAPIC    2
+#define MP_IOINT     3
+#define MP_LINT      4
+
+struct mp_processor {
+  u8 type;
+  u8 apic_id;
+  u8 apic_ver;
+  u8 flags;
+  u32 signature;
+  u32 features;
+  u32 reserved[2];
+} PACKED;
+
+#define MP_CPU_ENABLED 0x1
+#define MP_CPU_BSP     0x2
+
+struct mp_ioapic {
+  u8 type;
+  u8 id;
+  u8 ver;
+  u8 flags;
+  u32 addr;
+} PACKED;
+
+struct mp_bus {
+  u8 type;
+  u8 id;
+  char name[6]; //"ISA   ", "PCI   "
+} PACKED;
+
+struct mp_ioint {
+  u8 type;
+  u8 int_type;
+  u16 flags;
+  u8 src_bus;
+  u8 src_irq;
+  u8 dst_apic;
+  u8 dst_pin;
+} PACKED;
+
+#define MP_INT_VECTORED 0
+#define MP_IMCR_PRESENT 0x80
+
+#define AP_STARTUP_TIMEOUT_USECS 100000
+
+struct cpu cpus[MAX_CPUS];
+u32 ncpus = 1;
+struct cpu *this_cpu = &cpus[0];
+paddr_t mp_ioapic_addr = 0;
+u8 mp_isa_irq_pin[16]; //io apic input of each isa irq
+u16 mp_pin_flags[MAX_IOAPIC_PINS]; //polarity and trigger, 0 if the bus default
+int mp_imcr = 0;
+
+//read by ap_start before the ap has a stack of its own
+u32 ap_boot_cr3;
+u32 ap_boot_stack;
+static struct cpu *ap_boot_cpu;
+
+void ap_trampoline(void);
+void ap_trampoline_end(void);
+void ap_start(void);
+void ap_main(void);
+void smp_resched_inthandler(void);
+void smp_tlb_inthandler(void);
+void smp_resched_isr(void);
+void smp_tlb_isr(void);
+void thread_idle(void *arg);
+
+//a ticket lock, so that a cpu leaving and re-entering the kernel in a
+//loop can't starve the others
+static volatile u32 kernel_lock_next = 0;
+static volatile u32 kernel_lock_serving = 0;
+static struct cpu *volatile kernel_lock_owner = NULL;
+int kernel_lock_depth = 0; //per thread, swapped on context switch
+
+static volatile u32 tlb_gen = 0;
+
+struct cpu *cpu_self() {
+  u16 tr = gettr();
+  //before ltr only the boot processor runs
+  return tr ? &cpus[(tr - GDT_SEL_TSS) / 8] : &cpus[0];
+}
+
+static u8 mp_checksum(const void *p, u32 len) {
+  u8 sum = 0;
+  for(u32 i = 0; i < len; i++)
+    sum += ((const u8 *)p)[i];
+  return sum;
+}
+
+static struct mp_floating *mp_search_range(paddr_t start, u32 len) {
+  for(paddr_t p = start; p + sizeof(struct mp_floating) <= start + len; p += 16) {
+    struct mp_floating *mpf = (struct mp_floating *)PHYS_TO_KERN_VMEM(p);
+    if(memcmp(mpf->signature, "_MP_", 4) == 0 && mp_checksum(mpf, mpf->length * 16) == 0)
+      return mpf;
+  }
+  return NULL;
+}
+
+//the floating pointer is in the first kb of the ebda, the last kb of
+//base memory or the bios rom
+static struct mp_floating *mp_search() {
+  struct mp_floating *mpf;
+  paddr_t ebda = *(u16 *)PHYS_TO_KERN_VMEM(0x40e) << 4;
+  if(ebda != 0 && (mpf = mp_search_range(ebda, 1024)) != NULL)
+    return mpf;
+  paddr_t basemem = (*(u16 *)PHYS_TO_KERN_VMEM(0x413)) * 1024;
+  if(basemem != 0 && (mpf = mp_search_range(basemem - 1024, 1024)) != NULL)
+    return mpf;
+  return mp_search_range(0xf0000, 0x10000);
+}
+
+static void mp_add_cpu(struct mp_processor *proc) {
+  if((proc->flags & MP_CPU_ENABLED) == 0)
+    return;
+  if(proc->flags & MP_CPU_BSP) {
+    cpus[0].apic_id = proc->apic_id;
+  } else if(ncpus < MAX_CPUS) {
+    cpus[ncpus].apic_id = proc->apic_id;
+    ncpus++;
+  }
+}
+
+//isa irqs are wired to the same io apic input unless overridden here,
+//usually the pit on input 2. bus entries come before these.
+static void mp_add_ioint(struct mp_ioint *ioint, int isa_bus) {
+  if(ioint->int_type != MP_INT_VECTORED)
+    return;
+  if(ioint->src_bus == isa_bus && ioint->src_irq < 16)
+    mp_isa_irq_pin[ioint->src_irq] = ioint->dst_pin;
+  if(ioint->dst_pin < MAX_IOAPIC_PINS)
+    mp_pin_flags[ioint->dst_pin] = ioint->flags;
+}
+
+//finds the processors and the io apic. without mp tables only the boot
+//processor is used.
+void smp_init() {
+  for(u32 i = 0; i < MAX_CPUS; i++)
+    cpus[i].id = i;
+  cpus[0].started = 1;
+  for(u32 i = 0; i < 16; i++)
+    mp_isa_irq_pin[i] = i;
+
+  struct mp_floating *mpf = mp_search();
+  if(mpf == NULL || mpf->config == 0 || mpf->config >= KERN_STRAIGHT_MAP_SIZE) {
+    puts("smp: no mp table");
+    return;
+  }
+  mp_imcr = (mpf->imcrp & MP_IMCR_PRESENT) != 0;
+  struct mp_config *conf = (struct mp_config *)PHYS_TO_KERN_VMEM(mpf->config);
+  if(memcmp(conf->signature, "PCMP", 4) != 0 || mp_checksum(conf, conf->length) != 0) {
+    puts("smp: bad mp config table");
+    return;
+  }
+
+  int isa_bus = -1;
+  u8 *p = (u8 *)(conf + 1);
+  for(u32 i = 0; i < conf->entry_count; i++) {
+    switch(*p) {
+    case MP_PROCESSOR:
+      mp_add_cpu((struct mp_processor *)p);
+      p += sizeof(struct mp_processor);
+      break;
+    case MP_IOAPIC:
+      if(mp_ioapic_addr == 0 && (((struct mp_ioapic *)p)->flags & 1))
+        mp_ioapic_addr = ((struct mp_ioapic *)p)->addr;
+      p += sizeof(struct mp_ioapic);
+      break;
+    case MP_BUS:
+      if(memcmp(((struct mp_bus *)p)->name, "ISA", 3) == 0)
+        isa_bus = ((struct mp_bus *)p)->id;
+      p += sizeof(struct mp_bus);
+      break;
+    case MP_IOINT:
+      mp_add_ioint((struct mp_ioint *)p, isa_bus);
+      p += sizeof(struct mp_ioint);
+      break;
+    case MP_LINT:
+      p += 8;
+      break;
+    default:
+      printf("smp: unknown mp entry %u\n", *p);
+      i = conf->entry_count;
+      break;
+    }
+  }
+  printf("smp: %u cpus, io apic at %x\n", ncpus, mp_ioapic_addr);
+}
+
+//per-cpu descriptor tables. called on each cpu.
+void smp_cpu_init(struct cpu *c) {
+  bzero(&c->tss, sizeof(struct tss));
+  c->tss.ss0 = GDT_SEL_DATASEG_0;
+  gdt_init();
+  gdt_settssbase(c->id, &c->tss);
+  ltr(GDT_SEL_TSS + c->id * 8);
+  gdt_init_sysenter(&c->tss);
+}
+
+static int ap_boot(struct cpu *c) {
+  struct thread *idle = kthread_new(thread_idle, NULL, "idle", PRIORITY_IDLE, 1);
+  if(idle == NULL)
+    return -1;
+  sched_init_cpu(c, idle);
+  c->current = idle;
+  c->preempt_count = 0;
+  c->need_resched = 0;
+  ap_boot_cpu = c;
+  ap_boot_stack = (u32)get_zeropage(PAGESIZE) + PAGESIZE;
+
+  //INIT, then STARTUP twice as the mp spec says
+  lapic_send_init(c->apic_id);
+  pit_busywait(10000);
+  for(int i = 0; i < 2 && !c->started; i++) {
+    lapic_send_startup(c->apic_id, AP_TRAMPOLINE_ADDR);
+    pit_busywait(200);
+  }
+  for(u32 waited = 0; !c->started && waited < AP_STARTUP_TIMEOUT_USECS; waited += 1000)
+    pit_busywait(1000);
+  return c->started ? 0 : -1;
+}
+
+//starts the application processors. they wait for the kernel lock, which
+//the boot processor holds until its first thread leaves the kernel.
+void smp_boot_aps() {
+  idt_register(IPI_RESCHED_VECTOR, IDT_INTGATE, smp_resched_inthandler);
+  idt_register(IPI_TLB_VECTOR, IDT_INTGATE, smp_tlb_inthandler);
+  if(ncpus == 1 || !lapic_enabled)
+    return;
+
+  memcpy((void *)PHYS_TO_KERN_VMEM(AP_TRAMPOLINE_ADDR), ap_trampoline,
+           (u32)ap_trampoline_end - (u32)ap_trampoline);
+  ap_boot_cr3 = pagetbl_kernel();
+
+  u32 online = 1;
+  for(u32 i = 1; i < ncpus; i++) {
+    if(ap_boot(&cpus[i]) == 0)
+      online++;
+    else
+      printf("smp: cpu%u (apic %u) did not start\n", i, cpus[i].apic_id);
+  }
+  printf("smp: %u cpus online\n", online);
+}
+
+//the c entry point of an application processor, on its boot stack
+void ap_main() {
+  struct cpu *c = ap_boot_cpu;
+  cpu_setup();
+  idt_load();
+  smp_cpu_init(c);
+  lapic_ap_init();
+  c->started = 1;
+
+  kernel_lock();
+  kstack_setaddr();
+  jmpto_current();
+}
+
+//called on every entry into the kernel with interrupts disabled
+void kernel_lock() {
+  struct cpu *c = cpu_self();
+  if(kernel_lock_owner == c) {
+    kernel_lock_depth++;
+    return;
+  }
+
+  c->in_user = 0;
+  u32 ticket = xadd(1, (void *)&kernel_lock_next);
+  while(kernel_lock_serving != ticket)
+    ASM("pause");
+  barrier();
+  kernel_lock_owner = c;
+  kernel_lock_depth = 1;
+  this_cpu = c;
+  current = c->current;
+  preempt_count = c->preempt_count;
+  need_resched = c->need_resched;
+  //kernel mappings may have changed while this cpu was outside
+  if(c->tlb_gen != tlb_gen) {
+    c->tlb_gen = tlb_gen;
+    flushtlb((void *)getcr3());
+  }
+}
+
+static void lock_release(struct cpu *c) {
+  c->current = current;
+  c->preempt_count = preempt_count;
+  c->need_resched = need_resched;
+  kernel_lock_owner = NULL;
+  barrier();
+  xadd(1, (void *)&kernel_lock_serving);
+}
+
+void kernel_unlock() {
+  if(--kernel_lock_depth > 0)
+    return;
+  this_cpu->in_user = 1;
+  lock_release(this_cpu);
+}
+
+//lets waiting cpus in before a context switch. a cpu switching between
+//kernel threads would hold the lock forever otherwise.
+void kernel_lock_relax() {
+  if(kernel_lock_next == kernel_lock_serving + 1)
+    return;
+  int depth = kernel_lock_depth;
+  lock_release(this_cpu);
+  kernel_lock();
+  kernel_lock_depth = depth;
+}
+
+void smp_send_resched(struct cpu *c) {
+  if(c == this_cpu) {
+    need_resched = 1;
+  } else {
+    c->need_resched = 1;
+    lapic_send_ipi(c->apic_id, IPI_RESCHED_VECTOR);
+  }
+}
+
+//need_resched has been loaded by the kernel lock, the return path does the rest
+void smp_resched_isr() {
+  lapic_eoi();
+}
+
+//runs without the kernel lock
+void smp_tlb_isr() {
+  struct cpu *c = cpu_self();
+  flushtlb((void *)getcr3());
+  c->tlb_gen = tlb_gen;
+  lapic_eoi();
+}
+
+//the other cpus only touch kernel mappings while holding the lock, so
+//they flush when they take it next time
+void smp_flush_tlb_kernel() {
+  tlb_gen++;
+  this_cpu->tlb_gen = tlb_gen;
+}
+
+//cpus running user code of pdt are interrupted and waited for. a cpu
+//that enters the kernel meanwhile flushes when it gets the lock.
+void smp_flush_tlb_user(paddr_t pdt) {
+  struct cpu *c;
+  u32 gen = ++tlb_gen;
+  this_cpu->tlb_gen = gen;
+  if(current != NULL && current->regs.cr3 == pdt)
+    flushtlb((void *)pdt);
+  for_each_cpu(c) {
+    if(c != this_cpu && c->in_user && c->current && c->current->regs.cr3 == pdt)
+      lapic_send_ipi(c->apic_id, IPI_TLB_VECTOR);
+  }
+  for_each_cpu(c) {
+    while(c != this_cpu && c->in_user && c->current && c->current->regs.cr3 == pdt
+          && c->tlb_gen != gen)
+      ASM("pause");
+  }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <kern/kernlib.h>
+#include <kern/params.h>
+#include <kern/sched.h>
+#include <kern/thread.h>
+
+//the kernel runs on every cpu under one big kernel lock. a cpu takes it
+//on each entry from user mode or from the halted idle loop and drops it
+//when it goes back. user code runs in parallel, kernel code does not, so
+//current, need_resched and the other per-cpu globals are simply loaded
+//from and saved to struct cpu by the lock holder.
+
+struct cpu {
+  u32 id; //index into cpus[], 0 is the boot processor
+  u32 apic_id;
+  volatile int started;
+  struct tss tss;
+  struct runqueue rq;
+  //saved while the cpu doesn't hold the kernel lock
+  struct thread *current;
+  int preempt_count;
+  int need_resched;
+  volatile int in_user; //may be using user mappings without the lock
+  volatile u32 tlb_gen; //last tlb_gen this cpu has flushed for
+  struct thread *fpu_owner; //last loaded its fpu registers here
+};
+
+extern struct cpu cpus[MAX_CPUS];
+extern u32 ncpus;
+extern struct cpu *this_cpu; //valid while holding the kernel lock
+extern int kernel_lock_depth;
+extern paddr_t mp_ioapic_addr; //0 if there is no io apic
+extern u8 mp_isa_irq_pin[16];
+extern u16 mp_pin_flags[MAX_IOAPIC_PINS];
+extern int mp_imcr; //the pic is connected directly to the cpu
+
+#define MP_POLARITY_MASK 0x3
+#define MP_POLARITY_HIGH 0x1
+#define MP_POLARITY_LOW  0x3
+#define MP_TRIGGER_MASK  0xc
+#define MP_TRIGGER_EDGE  0x4
+#define MP_TRIGGER_LEVEL 0xc
+
+#define for_each_cpu(c) for((c) = cpus; (c) < cpus + ncpus; (c)++)
+
+struct cpu *cpu_self(void);
+void smp_init(void);
+void smp_cpu_init(struct cpu *c);
+void smp_boot_aps(void);
+void kernel_lock(void);
+void kernel_unlock(void);
+void kernel_lock_relax(void);
+void smp_send_resched(struct cpu *c);
+void smp_flush_tlb_kernel(void);
+void smp_flush_tlb_user(paddr_t pdt);
@@ -3,6 +3,9 @@
 #include <kern/thread.h>
 #include <kern/fs.h>
 #include <kern/file.h>
+#include <kern/clock.h>
+#include <kern/futex.h>
+#include <kern/workqueue.h>
 #include <net/socket/socket.h>
 
 u32 syscall_exit(u32, u32, u32, u32, u32);
@@ -41,6 +44,15 @@ u32 syscall_dup2(u32, u32, u32, u32, u32);
 u32 syscall_mknod(u32, u32, u32, u32, u32);
 u32 syscall_gettents(u32, u32, u32, u32, u32);
 u32 syscall_getsents(u32, u32, u32, u32, u32);
+u32 syscall_clock_gettime(u32, u32, u32, u32, u32);
+u32 syscall_gettimeofday(u32, u32, u32, u32, u32);
+u32 syscall_nice(u32, u32, u32, u32, u32);
+u32 syscall_futex(u32, u32, u32, u32, u32);
+u32 syscall_clone(u32, u32, u32, u32, u32);
+u32 syscall_exit_thread(u32, u32, u32, u32, u32);
+u32 syscall_set_tls(u32, u32, u32, u32, u32);
+u32 syscall_fcntl(u32, u32, u32, u32, u32);
+u32 syscall_getwents(u32, u32, u32, u32, u32);
 
 u32 (*syscall_table[NSYSCALLS])(u32, u32, u32, u32, u32) = {
   syscall_exit,     //0
@@ -77,6 +89,15 @@ u32 (*syscall_table[NSYSCALLS])(u32, u32, u32, u32, u32) = {
   syscall_mknod,    //31
   syscall_gettents, //32
   syscall_getsents, //33
+  syscall_clock_gettime, //34
+  syscall_gettimeofday,  //35
+  syscall_nice,     //36
+  syscall_futex,    //37
+  syscall_clone,    //38
+  syscall_exit_thread, //39
+  syscall_set_tls,  //40
+  syscall_fcntl,    //41
+  syscall_getwents, //42
 };
 
 
@@ -96,8 +117,7 @@ int buffer_check(const void *buf, size_t count) {
 }
 
 u32 syscall_exit(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
-  thread_exit(a0);
-  return 0;
+  return sys_exit(a0);
 }
 
 u32 syscall_write(u32 a0, u32 a1, u32 a2, u32 a3 UNUSED, u32 a4 UNUSED) {
@@ -157,8 +177,8 @@ u32 syscall_sbrk(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNU
   return sys_sbrk(a0);
 }
 
-u32 syscall_times(u32 a0 UNUSED, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
-  return -1;
+u32 syscall_times(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_times((void *)a0);
 }
 
 u32 syscall_unlink(u32 a0 UNUSED, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
@@ -240,3 +260,39 @@ u32 syscall_gettents(u32 a0, u32 a1, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED
 u32 syscall_getsents(u32 a0, u32 a1, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
   return sys_getsents((void *)a0, a1);
 }
+
+u32 syscall_getwents(u32 a0, u32 a1, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_getwents((void *)a0, a1);
+}
+
+u32 syscall_clock_gettime(u32 a0, u32 a1, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_clock_gettime(a0, (void *)a1);
+}
+
+u32 syscall_gettimeofday(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_gettimeofday((void *)a0);
+}
+
+u32 syscall_nice(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_nice(a0);
+}
+
+u32 syscall_futex(u32 a0, u32 a1, u32 a2, u32 a3, u32 a4) {
+  return sys_futex((void *)a0, a1, a2, a3, (void *)a4);
+}
+
+u32 syscall_clone(u32 a0, u32 a1, u32 a2, u32 a3, u32 a4 UNUSED) {
+  return sys_clone((void *)a0, (void *)a1, a2, (void *)a3);
+}
+
+u32 syscall_exit_thread(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_exit_thread(a0);
+}
+
+u32 syscall_set_tls(u32 a0, u32 a1 UNUSED, u32 a2 UNUSED, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_set_tls(a0);
+}
+
+u32 syscall_fcntl(u32 a0, u32 a1, u32 a2, u32 a3 UNUSED, u32 a4 UNUSED) {
+  return sys_fcntl(a0, a1, a2);
+}
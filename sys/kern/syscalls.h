@@ -1,6 +1,6 @@
 #include <kern/kernlib.h>
 
-#define NSYSCALLS 34
+#define NSYSCALLS 43
 
 extern u32 (*syscall_table[NSYSCALLS])(u32, u32, u32, u32, u32);
 
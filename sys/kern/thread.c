@@ -1,4 +1,7 @@
 #include <kern/thread.h>
+#include <kern/hrtimer.h>
+#include <kern/vdso.h>
+#include <kern/sched.h>
 #include <kern/pit.h>
 #include <kern/page.h>
 #include <kern/pagetbl.h>
@@ -10,49 +13,73 @@
 #include <kern/elf.h>
 #include <kern/file.h>
 #include <kern/fs.h>
+#include <kern/smp.h>
+#include <kern/futex.h>
+#include <kern/fpu.h>
+#include <kern/syscalls.h>
 
 
-static struct tss tss;
-
 struct thread *current = NULL;
 static struct thread *thread_tbl[MAX_THREADS];
+static u32 pid_map[BITMAP_WORDS(MAX_THREADS)];
 static pid_t pid_last = INVALID_PID+1;
 
-static struct list_head run_queue[MAX_PRIORITY];
-static struct list_head wait_queue;
+//sleeping threads are hashed by their wait cause, so a wakeup only looks at one bucket
+#define WAIT_HASH_BITS 8
+#define WAIT_HASH(cause) (((u32)(cause) * 2654435761u) >> (32 - WAIT_HASH_BITS))
+static struct list_head wait_hash[1 << WAIT_HASH_BITS];
 
 
 extern void thread_main(void *arg UNUSED);
+static void thread_kill_siblings(void);
 
 
 void thread_idle(UNUSED void *arg) {
-  while(1)
-    cpu_halt();
+  while(1) {
+    cli();
+    if(sched_nr_running() == 0) {
+      //stop the tick until the next timer is due
+      tick_nohz_idle_enter();
+      //let the other cpus into the kernel while halted
+      kernel_unlock();
+      cpu_idle_halt();
+      cli();
+      kernel_lock();
+      sti();
+    } else {
+      sti();
+    }
+    tick_nohz_idle_exit();
+    thread_yield();
+  }
+}
+
+static int priority_to_nice(u32 priority) {
+  return priority == PRIORITY_SYSTEM ? NICE_SYSTEM : 0;
 }
 
 void thread_set_priority(u32 priority) {
-  if(priority < MAX_PRIORITY)
+  if(priority < MAX_PRIORITY) {
     current->priority = priority;
+    sched_set_nice(current, priority_to_nice(priority));
+  }
 }
 
 void dispatcher_init() {
   for(int i=0; i<MAX_THREADS; i++)
     thread_tbl[i] = NULL;
-
-  for(int i=0; i<MAX_PRIORITY; i++)
-    list_init(&run_queue[i]);
+  bzero(pid_map, sizeof(pid_map));
+  bitmap_setbit(pid_map, INVALID_PID);
 
   current = NULL;
-  list_init(&wait_queue);
-
-  bzero(&tss, sizeof(struct tss));
-  tss.ss0 = GDT_SEL_DATASEG_0;
+  for(int i=0; i<(1 << WAIT_HASH_BITS); i++)
+    list_init(&wait_hash[i]);
 
-  gdt_init();
-  gdt_settssbase(&tss);
-  ltr(GDT_SEL_TSS);
+  smp_cpu_init(&cpus[0]);
 
-  thread_run(kthread_new(thread_idle, NULL, "idle", PRIORITY_IDLE, 1));
+  struct thread *idle = kthread_new(thread_idle, NULL, "idle", PRIORITY_IDLE, 1);
+  sched_init_cpu(&cpus[0], idle);
+  thread_run(idle);
   thread_run(kthread_new(thread_main, NULL, "main", PRIORITY_USER, 1));
 }
 
@@ -61,25 +88,36 @@ void dispatcher_run() {
 }
 
 void kstack_setaddr() {
-  tss.esp0 = (u32)((u8 *)(current->kstack) + current->kstacksize);
+  this_cpu->tss.esp0 = (u32)((u8 *)(current->kstack) + current->kstacksize);
+}
+
+//points gs at the tls of current. the descriptor is per cpu, so the
+//segment is reloaded whenever a thread is switched in.
+static void thread_load_tls() {
+  gdt_settlsbase(this_cpu->id, current->tls_base);
+  setgs((GDT_SEL_TLS + this_cpu->id * 8) | 3);
 }
 
+//the pid is reserved until thread_free()
 pid_t get_next_pid() {
-  pid_t pid;
-  for(pid = pid_last; pid < MAX_THREADS; pid++) {
-    if(thread_tbl[pid] == NULL) {
-      pid_last = pid+1;
-      return pid;
-    }
-  }
+  int pid = bitmap_find_zero(pid_map, MAX_THREADS, pid_last);
+  if(pid < 0)
+    pid = bitmap_find_zero(pid_map, MAX_THREADS, INVALID_PID+1);
+  if(pid < 0)
+    return INVALID_PID;
+  bitmap_setbit(pid_map, pid);
+  pid_last = pid+1;
+  return pid;
+}
 
-  for(pid = INVALID_PID+1; pid < pid_last; pid++) {
-    if(thread_tbl[pid] == NULL) {
-      pid_last = pid+1;
-      return pid;
-    }
-  }
-  return INVALID_PID;
+static void thread_init_family(struct thread *t, struct thread *parent) {
+  t->parent = parent;
+  t->ppid = parent ? parent->pid : INVALID_PID;
+  list_init(&t->sibling);
+  list_init(&t->children);
+  list_init(&t->zombies);
+  if(parent)
+    list_pushback(&t->sibling, &parent->children);
 }
 
 struct thread *kthread_new(void (*func)(void *), void *arg, const char *name, u32 priority, int is_preemptive) {
@@ -90,10 +128,11 @@ struct thread *kthread_new(void (*func)(void *), void *arg, const char *name, u3
   struct thread *t = malloc(sizeof(struct thread));
   bzero(t, sizeof(struct thread));
   t->vmmap = vm_map_new();
+  t->fdtab = fdtable_new();
   t->state = TASK_STATE_RUNNING;
   t->name = name;
   t->pid = pid;
-  t->ppid = INVALID_PID;
+  thread_init_family(t, NULL);
   t->regs.cr3 = pagetbl_new();
   t->regs.eip = 0;
   //prepare kernel stack
@@ -109,6 +148,8 @@ struct thread *kthread_new(void (*func)(void *), void *arg, const char *name, u3
   *(u32 *)t->regs.esp = is_preemptive ? 0x200 : 0x000; //initial eflags
 
   t->priority = priority;
+  sched_fork(t, NULL);
+  sched_set_nice(t, priority_to_nice(priority));
 
   thread_tbl[t->pid] = t;
 
@@ -172,11 +213,23 @@ int thread_exec_in_usermode(const char *path, char *const argv[], char *const en
 
   lseek(f, 0, SEEK_SET);
 
+  //the killed siblings may still be using their files until they exit
+  struct fdtable *fdt = fdtable_unshare(current->fdtab);
+  if(fdt == NULL) {
+    close(f);
+    return -1;
+  }
+
   current->name = strdup(path);
 
-  vm_map_free(current->vmmap);
+  thread_kill_siblings();
+  current->fdtab = fdt;
+  fdtable_close_on_exec(current->fdtab);
+  fpu_release(current);
+  vm_map_release(current->vmmap);
   current->vmmap = vm_map_new();
   current->regs.cr3 = pagetbl_new();
+  vdso_map(current->vmmap, current->pid);
 
   void *brk;
   int (*entrypoint)(void) = elf32_load(f, &brk);
@@ -184,12 +237,12 @@ int thread_exec_in_usermode(const char *path, char *const argv[], char *const en
 
   //prepare user space stack
   struct mapper *m = anon_mapper_new();
-  current->user_stack_bottom = USER_STACK_BOTTOM;
-  current->user_stack_top = USER_STACK_BOTTOM - USER_STACK_INITIAL_SIZE;
-  vm_add_area(current->vmmap, current->user_stack_top, USER_STACK_INITIAL_SIZE, m, 0);
+  current->vmmap->user_stack_bottom = USER_STACK_BOTTOM;
+  current->vmmap->user_stack_top = USER_STACK_BOTTOM - USER_STACK_INITIAL_SIZE;
+  vm_add_area(current->vmmap, current->vmmap->user_stack_top, USER_STACK_INITIAL_SIZE, m, 0);
 
   //prepare argv&envp(continue)
-  void *stackpage = (char *)anon_mapper_add_page(m, USER_STACK_BOTTOM - PAGESIZE);
+  void *stackpage = kmap(anon_mapper_add_page(m, USER_STACK_BOTTOM - PAGESIZE));
   char *strptr = (u8 *)stackpage + strstart;
   char **tableptr = (u8 *)stackpage + tablestart - sizeof(int);
   memcpy(strptr, argsbuf, ARGSBUFSIZE - strstart);
@@ -205,8 +258,12 @@ int thread_exec_in_usermode(const char *path, char *const argv[], char *const en
     strptr = next_string(strptr);
   }
   *tableptr++ = NULL;
+  kunmap(stackpage);
 
-  current->brk = pagealign((u32)brk+(PAGESIZE-1));
+  current->vmmap->brk = pagealign((u32)brk+(PAGESIZE-1));
+  current->tls_base = 0;
+  current->clear_tid = NULL;
+  thread_load_tls();
 
   flushtlb(current->regs.cr3);
 
@@ -215,20 +272,47 @@ int thread_exec_in_usermode(const char *path, char *const argv[], char *const en
 }
 
 int fork_main(u32 ch_esp, u32 ch_eflags, u32 ch_edi, u32 ch_esi, u32 ch_ebx, u32 ch_ebp) {
-  pid_t childpid = get_next_pid();
-  if(childpid == INVALID_PID)
-    return NULL;
+  paddr_t cr3 = pagetbl_dup_for_fork((paddr_t)current->regs.cr3);
+  if(cr3 == 0)
+    return -1;
+  vm_map_flush_tlb(current->vmmap, current->regs.cr3);
 
   struct thread *t = malloc(sizeof(struct thread));
+  if(t == NULL) {
+    pagetbl_free(cr3);
+    return -1;
+  }
   memcpy(t, current, sizeof(struct thread));
+  if(fpu_fork(t, current) < 0) {
+    free(t);
+    pagetbl_free(cr3);
+    return -1;
+  }
+  t->fdtab = fdtable_dup(current->fdtab);
+  if(t->fdtab == NULL) {
+    free(t->fpu_mem);
+    free(t);
+    pagetbl_free(cr3);
+    return -1;
+  }
+  //taken last, the pid stays reserved until thread_free()
+  pid_t childpid = get_next_pid();
+  if(childpid == INVALID_PID) {
+    fdtable_release(t->fdtab);
+    free(t->fpu_mem);
+    free(t);
+    pagetbl_free(cr3);
+    return -1;
+  }
   t->vmmap = vm_map_new();
   t->state = TASK_STATE_RUNNING;
   if(t->curdir)
     vnode_hold(t->curdir);
   t->pid = childpid;
-  t->ppid = current->pid;
-  t->regs.cr3 = pagetbl_dup_for_fork((paddr_t)current->regs.cr3);
-  flushtlb(current->regs.cr3);
+  thread_init_family(t, current);
+  timer_init(&t->alarm, NULL, NULL);
+  sched_fork(t, current);
+  t->regs.cr3 = cr3;
 
   //prepare kernel stack
   t->kstack = get_zeropage(KSTACK_SIZE);
@@ -250,11 +334,10 @@ int fork_main(u32 ch_esp, u32 ch_eflags, u32 ch_edi, u32 ch_esi, u32 ch_ebx, u32
   t->regs.esp -= 4;
   *(u32 *)t->regs.esp = ch_eflags;
 
-  for(int i=0; i<MAX_FILES; i++)
-    if(current->files[i])
-      t->files[i] = dup(current->files[i]);
+  t->clear_tid = NULL;
 
   t->vmmap = vm_map_dup(current->vmmap);
+  vdso_fork(t->vmmap, t->regs.cr3, t->pid);
 
   t->flags = current->flags;
   t->num_pfs = 0;
@@ -268,35 +351,44 @@ int fork_main(u32 ch_esp, u32 ch_eflags, u32 ch_edi, u32 ch_esi, u32 ch_ebx, u32
 
 void thread_run(struct thread *t) {
   t->state = TASK_STATE_RUNNING;
-  if(current == NULL)
+  if(current == NULL) {
     current = t;
-  else
-    list_pushback(&(t->link), &run_queue[t->priority]);
+  } else {
+IRQ_DISABLE
+    //may go to an idle cpu
+    sched_wakeup(t);
+IRQ_RESTORE
+  }
 }
 
 static void thread_free(struct thread *t) {
   thread_tbl[t->pid] = NULL;
+  bitmap_clearbit(pid_map, t->pid);
+  timer_cancel(&t->alarm);
+  list_remove(&t->sibling);
 
-  for(int i=0; i<MAX_THREADS; i++) {
-    if(thread_tbl[i] && thread_tbl[i]->ppid == t->pid) {
-      thread_tbl[i]->ppid = INVALID_PID;
-      if(thread_tbl[i]->state == TASK_STATE_ZOMBIE)
-        thread_free(thread_tbl[i]);
-    }
-  }
-
+  fpu_release(t);
   page_free(t->kstack);
-  pagetbl_free(t->regs.cr3);
+  if(t->flags & THREAD_FREE_PDT)
+    pagetbl_free(t->regs.cr3);
   free(t);
 }
 
 void thread_sched() {
+  //a sleeping thread must reach wait_hash before another cpu can take
+  //the lock, or its wakeup is lost
+  if(current->state == TASK_STATE_RUNNING)
+    kernel_lock_relax();
+  sched_update_curr();
+  fpu_switch_out(current);
+  current->preempt_count = preempt_count;
+  current->lock_depth = kernel_lock_depth;
   switch(current->state) {
   case TASK_STATE_RUNNING:
-    list_pushback(&(current->link), &run_queue[current->priority]);
+    sched_enqueue(current);
     break;
   case TASK_STATE_WAITING:
-    list_pushback(&(current->link), &wait_queue);
+    list_pushback(&(current->link), &wait_hash[WAIT_HASH(current->waitcause)]);
     break;
   case TASK_STATE_EXITED:
     thread_free(current);
@@ -305,19 +397,12 @@ void thread_sched() {
     break;
   }
 
-  struct list_head *next = NULL;
-  for(int i=0; i<MAX_PRIORITY; i++) {
-    next = list_pop(&run_queue[i]);
-    if(next != NULL)
-      break;
-  }
-  if(next == NULL) {
-    puts("no thread!");
-    while(1)
-      cpu_halt();
-  }
-
-  current = container_of(next, struct thread, link);
+  current = sched_pick_next();
+  current->cpu = this_cpu;
+  preempt_count = current->preempt_count;
+  kernel_lock_depth = current->lock_depth;
+  thread_load_tls();
+  fpu_switch_in(current);
   //printf("sched: pid=%d\n", current->pid);
 }
 
@@ -337,9 +422,19 @@ void thread_sleep(const void *cause) {
   current->state = TASK_STATE_WAITING;
   current->waitcause = cause;
   thread_yield();
+  //the wakeup may have been a wake-one. pass it on before exiting.
+  if(current->signal > 0)
+    thread_wakeup_one(cause);
   thread_check_signal();
 }
 
+//for waits that must not be cut short. a signal is seen later.
+void thread_sleep_uninterruptible(const void *cause) {
+  current->state = TASK_STATE_WAITING;
+  current->waitcause = cause;
+  thread_yield();
+}
+
 void thread_sleep_after_unlock(void *cause, mutex *mtx) {
 IRQ_DISABLE
   mutex_unlock(mtx);
@@ -348,37 +443,86 @@ IRQ_RESTORE
 }
 
 
+static void wakeup_thread(struct thread *t) {
+  //printf("thread#%d (%s) wakeup for %x\n", t->pid, GET_THREAD_NAME(t), t->waitcause);
+  t->state = TASK_STATE_RUNNING;
+  list_remove(&t->link);
+  sched_wakeup(t);
+}
+
 void thread_wakeup(const void *cause) {
   struct list_head *h, *tmp;
-  list_foreach_safe(h, tmp, &wait_queue) {
+IRQ_DISABLE
+  list_foreach_safe(h, tmp, &wait_hash[WAIT_HASH(cause)]) {
+    struct thread *t = container_of(h, struct thread, link);
+    if(t->waitcause == cause)
+      wakeup_thread(t);
+  }
+IRQ_RESTORE
+}
+
+//wakes the longest waiting thread only. returns it, or NULL if none.
+struct thread *thread_wakeup_one(const void *cause) {
+  struct list_head *h;
+  struct thread *woken = NULL;
+IRQ_DISABLE
+  list_foreach(h, &wait_hash[WAIT_HASH(cause)]) {
     struct thread *t = container_of(h, struct thread, link);
     if(t->waitcause == cause) {
-      //printf("thread#%d (%s) wakeup for %x\n", t->pid, GET_THREAD_NAME(t), cause);
-      t->state = TASK_STATE_RUNNING;
-      list_remove(h);
-      list_pushfront(h, &run_queue[t->priority]);
+      wakeup_thread(t);
+      woken = t;
+      break;
     }
   }
+IRQ_RESTORE
+  return woken;
 }
 
+//wakes up the cause after the ticks. the previous alarm of the thread is cancelled.
 void thread_set_alarm(void *cause, u32 expire) {
-  timer_start(expire, thread_wakeup, cause);
+  timer_cancel(&current->alarm);
+  timer_init(&current->alarm, thread_wakeup, cause);
+  timer_add(&current->alarm, expire);
 }
 
 void thread_exit(int exit_code) {
-  for(int i=0; i<MAX_FILES; i++)
-    if(current->files[i])
-      close(current->files[i]);
+  if(current->clear_tid) {
+    //tells pthread_join. the user stack may be freed from here on.
+    u32 *tid = current->clear_tid;
+    current->clear_tid = NULL;
+    if(vm_write_u32(current->vmmap, current->regs.cr3, (vaddr_t)tid, 0) == 0)
+      futex_wake(tid, MAX_THREADS);
+  }
+
+  fdtable_release(current->fdtab);
+  current->fdtab = NULL;
 
   if(current->curdir)
     vnode_release(current->curdir);
 
-  vm_map_free(current->vmmap);
+  //the page directory is still in use until the switch
+  if(vm_map_release(current->vmmap))
+    current->flags |= THREAD_FREE_PDT;
+  current->vmmap = NULL;
+
+  //nobody waits for the children any more
+  struct list_head *p, *tmp;
+  list_foreach_safe(p, tmp, &current->children) {
+    struct thread *child = list_entry(p, struct thread, sibling);
+    list_remove(p);
+    child->parent = NULL;
+    child->ppid = INVALID_PID;
+  }
+  list_foreach_safe(p, tmp, &current->zombies)
+    thread_free(list_entry(p, struct thread, sibling));
 
-  if(thread_tbl[current->ppid]) {
+  struct thread *parent = current->parent;
+  if(parent) {
     current->state = TASK_STATE_ZOMBIE;
     current->exit_code = exit_code;
-    thread_wakeup(thread_tbl[current->ppid]);
+    list_remove(&current->sibling);
+    list_pushback(&current->sibling, &parent->zombies);
+    thread_wakeup(parent);
   } else {
     current->state = TASK_STATE_EXITED;
   }
@@ -392,18 +536,36 @@ void thread_exit_with_error() {
   thread_exit(-1);
 }
 
-int thread_yield_pages() {
-  int is_yielded = 0;
+//returns number of yielded pages
+int thread_yield_pages(int nr) {
+  int nyielded = 0;
+IRQ_DISABLE
+  for(int i=0; i<MAX_THREADS && nyielded < nr; i++) {
+    if(i != current->pid && thread_tbl[i] && thread_tbl[i]->vmmap)
+      nyielded += vm_map_yield(thread_tbl[i]->vmmap, thread_tbl[i]->regs.cr3, nr - nyielded);
+  }
+IRQ_RESTORE
+  return nyielded;
+}
+
+//makes every user mapping of vaddr to paddr fault until it is replaced
+void thread_block_mapping(vaddr_t vaddr, paddr_t paddr) {
+IRQ_DISABLE
+  for(int i=0; i<MAX_THREADS; i++) {
+    if(thread_tbl[i] && thread_tbl[i]->vmmap)
+      pagetbl_block_mapping((u32 *)thread_tbl[i]->regs.cr3, vaddr, paddr);
+  }
+IRQ_RESTORE
+}
+
+//moves the mappings blocked by thread_block_mapping() to another page
+void thread_replace_mapping(vaddr_t vaddr, paddr_t from, paddr_t to) {
 IRQ_DISABLE
   for(int i=0; i<MAX_THREADS; i++) {
-    if(i != current->pid && thread_tbl[i])
-      if(vm_map_yield(thread_tbl[i]->vmmap, thread_tbl[i]->regs.cr3) == 0) {
-        is_yielded = 1;
-        break;
-      }
+    if(thread_tbl[i] && thread_tbl[i]->vmmap)
+      pagetbl_replace_mapping((u32 *)thread_tbl[i]->regs.cr3, vaddr, from, to);
   }
 IRQ_RESTORE
-  return is_yielded ? 0 : -1;
 }
 
 int thread_chdir(const char *path) {
@@ -434,16 +596,18 @@ int gettents(struct threadent *thp, size_t count) {
       if(tname == NULL)
         tname = "???";
       strncpy(thp[nfoundent].name, tname, MAX_THREADNAME_LEN);
-      thp[nfoundent].brk   = thread_tbl[i]->brk;
+      struct vm_map *map = thread_tbl[i]->vmmap;
+      thp[nfoundent].brk   = map ? (u32)map->brk : 0;
       thp[nfoundent].user_stack_size =
-        thread_tbl[i]->user_stack_bottom - thread_tbl[i]->user_stack_top;
+        map ? map->user_stack_bottom - map->user_stack_top : 0;
       thp[nfoundent].num_pfs = thread_tbl[i]->num_pfs;
-      thp[nfoundent].num_files = 0;
-      for(int j=0; j<MAX_FILES; j++)
-        if(thread_tbl[i]->files[j])
-          thp[nfoundent].num_files++;
+      struct fdtable *fdt = thread_tbl[i]->fdtab;
+      thp[nfoundent].num_files = fdt ? fdtable_count(fdt) : 0;
 
       thp[nfoundent].priority = thread_tbl[i]->priority;
+      thp[nfoundent].nice = thread_tbl[i]->nice;
+      thp[nfoundent].utime = thread_tbl[i]->utime;
+      thp[nfoundent].stime = thread_tbl[i]->stime;
 
       nfoundent++;
       count -= sizeof(struct threadent);
@@ -464,17 +628,18 @@ int sys_fork(void) {
 
 int sys_wait(int *status) {
   while(1) {
-    for(int i=0; i<MAX_THREADS; i++) {
-      struct thread *th = thread_tbl[i];
-      if(th && th->state == TASK_STATE_ZOMBIE
-          && th->ppid == current->pid) {
-        if(status)
-          *status = th->exit_code;
-        pid_t child_pid = th->pid;
-        thread_free(th);
-        return child_pid;
-      }
+    if(!list_is_empty(&current->zombies)) {
+      struct thread *th = list_entry(current->zombies.next, struct thread, sibling);
+      if(status)
+        *status = th->exit_code;
+      current->cutime += th->utime + th->cutime;
+      current->cstime += th->stime + th->cstime;
+      pid_t child_pid = th->pid;
+      thread_free(th);
+      return child_pid;
     }
+    if(list_is_empty(&current->children))
+      return -1;
 
     thread_sleep(current);
   }
@@ -482,20 +647,21 @@ int sys_wait(int *status) {
 }
 
 int sys_sbrk(int incr) {
+  struct vm_map *map = current->vmmap;
   if(incr < 0)
     return -1;
   else if(incr == 0)
-    return current->brk;
+    return map->brk;
 
-  if(current->brk + incr > current->user_stack_top)
+  if(map->brk + incr > map->user_stack_top)
     return -1;
 
-  u32 prev_brk = (u32)current->brk;
-  u32 new_brk = pagealign((u32)current->brk + incr + (PAGESIZE-1));
+  u32 prev_brk = (u32)map->brk;
+  u32 new_brk = pagealign((u32)map->brk + incr + (PAGESIZE-1));
 
   //add mapping if brk go over the page boundary.
-  vm_add_area(current->vmmap, current->brk, new_brk-prev_brk, anon_mapper_new(), 0);
-  current->brk = new_brk;
+  vm_add_area(map, map->brk, new_brk-prev_brk, anon_mapper_new(), 0);
+  map->brk = new_brk;
 
   return (int)prev_brk;
 }
@@ -508,13 +674,105 @@ int sys_gettents(struct threadent *thp, size_t count) {
   return gettents(thp, count);
 }
 
+int sys_nice(int inc) {
+  return sched_set_nice(current, current->base_nice + inc);
+}
+
 int sys_kill(pid_t pid, int sig) {
   if(pid >= MAX_THREADS || thread_tbl[pid] == NULL)
     return -1;
 
   thread_tbl[pid]->signal = sig;
-  if(thread_tbl[pid]->state == TASK_STATE_WAITING)
-    thread_wakeup(thread_tbl[pid]->waitcause);
+  if(thread_tbl[pid]->state == TASK_STATE_WAITING && thread_tbl[pid] != current)
+    wakeup_thread(thread_tbl[pid]);
+
+  return 0;
+}
+
+//the other threads sharing the address space die on their next way
+//through the kernel
+static void thread_kill_siblings() {
+  for(int i=0; i<MAX_THREADS; i++) {
+    struct thread *t = thread_tbl[i];
+    if(t && t != current && t->vmmap == current->vmmap)
+      sys_kill(t->pid, SIGKILL);
+  }
+}
+
+//exit() ends the whole process
+int sys_exit(int exit_code) {
+  thread_kill_siblings();
+  thread_exit(exit_code);
+  return 0;
+}
+
+int sys_exit_thread(int exit_code) {
+  thread_exit(exit_code);
+  return 0;
+}
+
+static void clone_child_start(void *entry, void *stack) {
+  jmpto_userspace(entry, stack);
+}
+
+//starts a thread sharing the address space, descriptors and page
+//directory of current. it enters user mode at entry with the stack
+//pointer at stack, and is not waited for by anyone.
+int sys_clone(void *entry, void *stack, vaddr_t tls, u32 *clear_tid) {
+  if((vaddr_t)entry >= KERN_VMEM_ADDR || (vaddr_t)stack > KERN_VMEM_ADDR ||
+      (clear_tid && (((vaddr_t)clear_tid & 3) || buffer_check(clear_tid, sizeof(u32)))))
+    return -1;
+
+  struct thread *t = malloc(sizeof(struct thread));
+  if(t == NULL)
+    return -1;
+  memcpy(t, current, sizeof(struct thread));
+  if(fpu_fork(t, current) < 0) {
+    free(t);
+    return -1;
+  }
+  pid_t pid = get_next_pid();
+  if(pid == INVALID_PID) {
+    free(t->fpu_mem);
+    free(t);
+    return -1;
+  }
+  t->state = TASK_STATE_RUNNING;
+  t->pid = pid;
+  thread_init_family(t, NULL);
+  t->signal = 0;
+  t->num_pfs = 0;
+  t->tls_base = tls;
+  t->clear_tid = clear_tid;
+  vm_map_hold(t->vmmap);
+  fdtable_hold(t->fdtab);
+  if(t->curdir)
+    vnode_hold(t->curdir);
+  timer_init(&t->alarm, NULL, NULL);
+  sched_fork(t, current);
+
+  //switched to like a kernel thread, see kthread_new()
+  t->kstack = get_zeropage(KSTACK_SIZE);
+  t->kstacksize = KSTACK_SIZE;
+  u32 *sp = (u32 *)((u8 *)t->kstack + t->kstacksize);
+  *--sp = (u32)stack;
+  *--sp = (u32)entry;
+  *--sp = (u32)thread_exit_with_error;
+  *--sp = (u32)clone_child_start;
+  sp -= 4; //ebp, ebx, esi, edi
+  *--sp = 0; //eflags
+  t->regs.esp = (u32)sp;
+  t->regs.eip = 0;
+
+  thread_tbl[t->pid] = t;
+  thread_run(t);
+
+  return t->pid;
+}
 
+//the tls of the calling thread, for the main thread of a process
+int sys_set_tls(vaddr_t base) {
+  current->tls_base = base;
+  thread_load_tls();
   return 0;
 }
@@ -5,10 +5,12 @@
 #include <kern/file.h>
 #include <kern/fs.h>
 #include <kern/lock.h>
+#include <kern/timer.h>
 #include <stdint.h>
 #include <stddef.h>
 
 struct deferred_func;
+struct cpu;
 
 extern struct thread *current;
 
@@ -57,6 +59,11 @@ struct thread_state {
 #define PRIORITY_USER   1
 #define PRIORITY_IDLE   (MAX_PRIORITY-1)
 
+#define SIGKILL 9
+
+//flags
+#define THREAD_FREE_PDT 0x1 //was the last user of the page directory
+
 struct thread {
   struct thread_state regs; //do not move from here
   struct list_head link;
@@ -67,17 +74,41 @@ struct thread {
   u32 flags;
   pid_t pid;
   pid_t ppid;
+  struct thread *parent; //NULL if nobody waits for it
+  struct list_head sibling; //on children or zombies of the parent
+  struct list_head children; //running
+  struct list_head zombies; //exited and not yet waited for
   int exit_code;
   const void *waitcause;
-  struct file *files[MAX_FILES];
-  void *brk;
+  struct fdtable *fdtab;
   char *name;
   struct vnode *curdir;
-  vaddr_t user_stack_bottom;
-  vaddr_t user_stack_top;
+  vaddr_t tls_base; //of the gs segment in user mode
+  u32 *clear_tid; //zeroed and woken as a futex on exit
+  u8 *fpu_mem; //saved fpu state, NULL until the first use
+  struct cpu *fpu_cpu; //where its fpu registers were last loaded
   u32 num_pfs;
   u32 priority;
   int signal;
+  struct timer alarm;
+  //fair scheduler
+  int nice; //in effect, the lower of the two below
+  int base_nice;
+  int pi_nice; //lent by waiters of pi_mutexes
+  struct list_head pi_mutexes; //held and boosted
+  u32 weight;
+  u64 vruntime; //ns
+  u64 exec_start;
+  u64 sum_exec_runtime;
+  u64 prev_sum_exec_runtime; //when it was last picked
+  u32 utime; //ticks
+  u32 stime;
+  u32 cutime; //of waited children
+  u32 cstime;
+  int preempt_count; //saved while switched out
+  struct cpu *cpu; //the one it runs or last ran on
+  int lock_depth; //of the kernel lock, saved while switched out
+  int on_rq; //queued on the run queue of cpu
 };
 
 struct threadent {
@@ -91,6 +122,9 @@ struct threadent {
   u32 num_pfs;
   u32 num_files;
   u32 priority;
+  s32 nice;
+  u32 utime;
+  u32 stime;
 };
 
 #define GET_THREAD_NAME(th) ((th)->name?(th)->name:"???")
@@ -105,14 +139,18 @@ void thread_run(struct thread *t);
 void thread_sched(void);
 void thread_check_signal(void);
 void thread_sleep(const void *cause);
+void thread_sleep_uninterruptible(const void *cause);
 void thread_sleep_after_unlock(void *cause, mutex *mtx);
 void thread_wakeup(const void *cause);
+struct thread *thread_wakeup_one(const void *cause);
 void thread_yield(void);
 void thread_set_alarm(void *cause, u32 expire);
 void thread_exit(int exit_code);
 void thread_exit_with_error(void);
 int thread_chdir(const char *path);
-int thread_yield_pages(void);
+int thread_yield_pages(int nr);
+void thread_block_mapping(vaddr_t vaddr, paddr_t paddr);
+void thread_replace_mapping(vaddr_t vaddr, paddr_t from, paddr_t to);
 struct deferred_func *defer_exec(void (*func)(void *), void *arg, int priority, int delay);
 void *defer_cancel(struct deferred_func *f);
 
@@ -121,3 +159,8 @@ int sys_fork(void);
 int sys_sbrk(int incr);
 int sys_chdir(const char *path);
 int sys_gettents(struct threadent *thp, size_t count);
+int sys_nice(int inc);
+int sys_exit(int exit_code);
+int sys_exit_thread(int exit_code);
+int sys_clone(void *entry, void *stack, vaddr_t tls, u32 *clear_tid);
+int sys_set_tls(vaddr_t base);
@@ -1,50 +1,177 @@
 #include <kern/timer.h>
 #include <kern/kernlib.h>
 #include <kern/lock.h>
+#include <kern/hrtimer.h>
 
-struct timer_entry {
-  struct timer_entry *next;
-  u32 expire;
-  void (*func)(const void *);
-  void *arg;
-};
+//hierarchical timing wheel. the first level has one slot per tick, each
+//upper level slot covers a whole turn of the level below it. timers are
+//cascaded down to a finer level when its wheel wraps around.
+#define TVR_BITS 8
+#define TVN_BITS 6
+#define TVR_SIZE (1 << TVR_BITS)
+#define TVN_SIZE (1 << TVN_BITS)
+#define TVR_MASK (TVR_SIZE - 1)
+#define TVN_MASK (TVN_SIZE - 1)
+#define TVN_LEVELS 4
 
-static struct timer_entry *timer_head = NULL;
+#define LEVEL_SHIFT(n) (TVR_BITS + (n) * TVN_BITS)
+#define LEVEL_INDEX(expire, n) (((expire) >> LEVEL_SHIFT(n)) & TVN_MASK)
 
-void timer_start(u32 ticks, void (*func)(const void *), void *arg) {
-  struct timer_entry *t = malloc(sizeof(struct timer_entry));
-  t->expire = ticks;
+static struct list_head tv1[TVR_SIZE];
+static struct list_head tvn[TVN_LEVELS][TVN_SIZE];
+static u32 timer_ticks = 0;
+static int timer_initialized = 0;
+
+static void timer_wheel_init() {
+  for(int i=0; i<TVR_SIZE; i++)
+    list_init(&tv1[i]);
+  for(int n=0; n<TVN_LEVELS; n++)
+    for(int i=0; i<TVN_SIZE; i++)
+      list_init(&tvn[n][i]);
+  timer_initialized = 1;
+}
+
+//must be called with interrupts disabled
+static void internal_add(struct timer *t) {
+  u32 expire = t->expire;
+  u32 delta = expire - timer_ticks;
+  struct list_head *slot;
+
+  if((int)delta < 0) {
+    //already expired. runs on the next tick.
+    slot = &tv1[(timer_ticks + 1) & TVR_MASK];
+  } else if(delta < TVR_SIZE) {
+    slot = &tv1[expire & TVR_MASK];
+  } else {
+    int n;
+    for(n=0; n<TVN_LEVELS-1; n++)
+      if(delta < (1u << LEVEL_SHIFT(n+1)))
+        break;
+    slot = &tvn[n][LEVEL_INDEX(expire, n)];
+  }
+  list_pushback(&t->link, slot);
+  t->flags |= TIMER_PENDING;
+}
+
+void timer_init(struct timer *t, void (*func)(const void *), const void *arg) {
+  list_init(&t->link);
   t->func = func;
   t->arg = arg;
-  t->next = NULL;
+  t->expire = 0;
+  t->flags = 0;
+}
+
+//arms the timer to fire after the ticks. a pending timer is re-armed.
+void timer_add(struct timer *t, u32 ticks) {
+IRQ_DISABLE
+  if(!timer_initialized)
+    timer_wheel_init();
+  if(t->flags & TIMER_PENDING)
+    list_remove(&t->link);
+  //timer_ticks is stale while the boot processor's tick is stopped
+  t->expire = timer_ticks + tick_nohz_lag() + MAX(ticks, 1u);
+  internal_add(t);
+  tick_nohz_kick();
+IRQ_RESTORE
+}
+
+//returns 1 if the timer was pending
+int timer_cancel(struct timer *t) {
+  int pending;
+IRQ_DISABLE
+  pending = (t->flags & TIMER_PENDING) != 0;
+  if(pending) {
+    list_remove(&t->link);
+    t->flags &= ~TIMER_PENDING;
+  }
+IRQ_RESTORE
+  if(pending && (t->flags & TIMER_ALLOCATED))
+    free(t);
+  return pending;
+}
+
+int timer_pending(struct timer *t) {
+  return (t->flags & TIMER_PENDING) != 0;
+}
+
+//one-shot timer without caller's storage. the returned handle can be
+//passed to timer_cancel() until the timer fires.
+struct timer *timer_start(u32 ticks, void (*func)(const void *), void *arg) {
+  struct timer *t = malloc(sizeof(struct timer));
+  timer_init(t, func, arg);
+  t->flags = TIMER_ALLOCATED;
+  timer_add(t, ticks);
+  return t;
+}
+
+u32 timer_getticks() {
+  return timer_ticks;
+}
+
+//ticks until the earliest pending timer expires, at most max.
+//used to stop the tick while idle.
+u32 timer_next_expiry(u32 max) {
+  u32 next = max;
 IRQ_DISABLE
-  struct timer_entry **p = &timer_head;
-  while(*p!=NULL) {
-    if(t->expire < (*p)->expire) {
-      (*p)->expire -= t->expire;
-      break;
+  if(timer_initialized) {
+    for(u32 i=1; i<=TVR_SIZE && i<next; i++) {
+      if(!list_is_empty(&tv1[(timer_ticks + i) & TVR_MASK])) {
+        next = i;
+        break;
+      }
+    }
+    //the first occupied slot of each upper level holds its earliest timers
+    for(int n=0; n<TVN_LEVELS; n++) {
+      u32 index = LEVEL_INDEX(timer_ticks, n);
+      for(int i=1; i<=TVN_SIZE; i++) {
+        struct list_head *slot = &tvn[n][(index + i) & TVN_MASK];
+        if(list_is_empty(slot))
+          continue;
+        struct list_head *p;
+        list_foreach(p, slot)
+          next = MIN(next, list_entry(p, struct timer, link)->expire - timer_ticks);
+        break;
+      }
     }
-    t->expire -= (*p)->expire;
-    p = &((*p)->next);
   }
-  t->next = *p;
-  *p = t;
 IRQ_RESTORE
+  return next;
 }
 
+//moves timers of the current slot of a level to the lower levels
+static void cascade(int n) {
+  struct list_head *slot = &tvn[n][LEVEL_INDEX(timer_ticks, n)];
+  struct list_head *p, *tmp;
+  list_foreach_safe(p, tmp, slot) {
+    struct timer *t = list_entry(p, struct timer, link);
+    list_remove(p);
+    internal_add(t);
+  }
+}
 
+//called from the timer interrupt
 void timer_tick() {
-  if(timer_head == NULL)
-    return;
-  else
-    if(timer_head->expire > 0)
-      timer_head->expire--;
-
-  while(timer_head != NULL && timer_head->expire == 0) {
-    struct timer_entry *tmp = timer_head;
-    timer_head = timer_head->next;
-    (tmp->func)(tmp->arg);
-    free(tmp);
+  if(!timer_initialized)
+    timer_wheel_init();
+
+  timer_ticks++;
+  u32 index = timer_ticks & TVR_MASK;
+  if(index == 0) {
+    for(int n=0; n<TVN_LEVELS; n++) {
+      cascade(n);
+      if(LEVEL_INDEX(timer_ticks, n) != 0)
+        break;
+    }
   }
-}
 
+  struct list_head *slot = &tv1[index];
+  struct list_head *p;
+  while((p = list_pop(slot)) != NULL) {
+    struct timer *t = list_entry(p, struct timer, link);
+    t->flags &= ~TIMER_PENDING;
+    //the callback may re-arm the timer
+    (t->func)(t->arg);
+    if((t->flags & (TIMER_ALLOCATED | TIMER_PENDING)) == TIMER_ALLOCATED)
+      free(t);
+  }
+}
@@ -5,8 +5,22 @@
 #define HZ PIT_HZ
 #define msecs_to_ticks(msec) ((msec) * HZ / 1000)
 
-struct timer_entry;
+//embeddable timer. initialize with timer_init(), then arm with timer_add().
+struct timer {
+  struct list_head link;
+  u32 expire; //absolute tick
+  void (*func)(const void *);
+  const void *arg;
+  u32 flags;
+#define TIMER_PENDING   0x1
+#define TIMER_ALLOCATED 0x2 //allocated by timer_start(), freed when fired or cancelled
+};
 
-void timer_start(u32 ticks, void (*func)(const void *), void *arg);
+void timer_init(struct timer *t, void (*func)(const void *), const void *arg);
+void timer_add(struct timer *t, u32 ticks);
+int timer_cancel(struct timer *t);
+int timer_pending(struct timer *t);
+struct timer *timer_start(u32 ticks, void (*func)(const void *), void *arg);
+u32 timer_getticks(void);
+u32 timer_next_expiry(u32 max);
 void timer_tick(void);
-void *timer_getarg(struct timer_entry *t);
@@ -0,0 +1,71 @@
+; application processors start here in real mode. smp_boot_aps() copies
+; the code to AP_TRAMPOLINE_ADDR, so it only uses addresses relative to
+; ap_trampoline until it jumps to the kernel.
+
+trampoline_addr equ 0x7000 ; AP_TRAMPOLINE_ADDR
+boot_pdt        equ 0x2000 ; built by boot.asm, maps the first 4MB 1:1
+
+%define REL(x) ((x) - ap_trampoline + trampoline_addr)
+
+section .text
+
+extern ap_boot_cr3
+extern ap_boot_stack
+extern ap_main
+
+[bits 16]
+global ap_trampoline
+ap_trampoline:
+  cli
+  cld
+  xor ax, ax
+  mov ds, ax
+  lgdt [REL(tramp_gdtr)]
+  mov eax, cr0
+  or eax, 1
+  mov cr0, eax
+  jmp dword 0x08:REL(tramp_prot)
+
+[bits 32]
+tramp_prot:
+  mov ax, 0x10
+  mov ds, ax
+  mov es, ax
+  mov fs, ax
+  mov gs, ax
+  mov ss, ax
+  ; 4MB pages, like the boot processor
+  mov eax, cr4
+  or eax, 0x10
+  mov cr4, eax
+  mov eax, boot_pdt
+  mov cr3, eax
+  mov eax, cr0
+  or eax, 0x80000000
+  mov cr0, eax
+  mov eax, ap_start
+  jmp eax
+
+align 8
+tramp_gdt:
+  dq 0
+  dq 0x00cf9a000000ffff ; code
+  dq 0x00cf92000000ffff ; data
+tramp_gdtr:
+  dw 3*8-1
+  dd REL(tramp_gdt)
+
+global ap_trampoline_end
+ap_trampoline_end:
+
+; now in the kernel space
+global ap_start
+ap_start:
+  mov eax, [ap_boot_cr3]
+  mov cr3, eax
+  mov esp, [ap_boot_stack]
+  call ap_main
+.loop:
+  cli
+  hlt
+  jmp .loop
@@ -6,6 +6,10 @@
 #include <kern/kernlib.h>
 #include <kern/syscalls.h>
 
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+#define PF_USER    0x4
+
 struct trap_stack {
   u32 errcode;
   u32 eip;
@@ -18,7 +22,7 @@ void gpe_isr(int errcode) {
   thread_exit_with_error();
 }
 
-void pf_isr(vaddr_t addr, u32 eip, u32 esp, u32 eax) {
+void pf_isr(vaddr_t addr, u32 eip, u32 esp, u32 eax, u32 errcode) {
   thread_check_signal();
   //printf("Page fault in thread#%d (%s) addr=0x%x (eip=0x%x, esp=0x%x)\n", current->pid, GET_THREAD_NAME(current), addr, eip, esp);
   struct vm_area *varea;
@@ -26,12 +30,13 @@ void pf_isr(vaddr_t addr, u32 eip, u32 esp, u32 eax) {
   current->num_pfs++;
 try_findarea:
   varea = vm_findarea(current->vmmap, addr);
-  if(varea == NULL) {
-    if(addr > current->brk && addr < current->user_stack_bottom) {
+  if(varea == NULL || ((varea->flags & VM_AREA_READONLY) && (errcode & PF_WRITE))) {
+    struct vm_map *map = current->vmmap;
+    if(varea == NULL && addr > map->brk && addr < map->user_stack_bottom) {
       //stack auto grow
-      current->user_stack_top -= USER_STACK_GROW_SIZE;
-      if(current->brk < current->user_stack_top) {
-        vm_add_area(current->vmmap, current->user_stack_top, USER_STACK_GROW_SIZE, anon_mapper_new(), 0);
+      map->user_stack_top -= USER_STACK_GROW_SIZE;
+      if(map->brk < map->user_stack_top) {
+        vm_add_area(map, map->user_stack_top, USER_STACK_GROW_SIZE, anon_mapper_new(), 0);
         if(try++ < 5)
           goto try_findarea;
       }
@@ -40,9 +45,18 @@ try_findarea:
     thread_exit_with_error();
   } else {
     paddr_t paddr = varea->mapper->ops->request(varea->mapper, addr - varea->start);
-    pagetbl_add_mapping((u32 *)current->regs.cr3, addr, paddr);
-    u8 *vaddr = (u8 *)PHYS_TO_KERN_VMEM(paddr) + (addr & 0xfff);
-    flushtlb(current->regs.cr3);
+    int err;
+    if(paddr == 0)
+      err = -1;
+    else if(varea->flags & VM_AREA_READONLY)
+      err = pagetbl_add_readonly_mapping((u32 *)current->regs.cr3, addr, paddr);
+    else
+      err = pagetbl_add_mapping((u32 *)current->regs.cr3, addr, paddr);
+    if(err) {
+      printf("Out of memory in thread#%d (%s) addr = 0x%x (eip = 0x%x)\n", current->pid, GET_THREAD_NAME(current), addr, eip);
+      thread_exit_with_error();
+    }
+    vm_map_flush_tlb(current->vmmap, current->regs.cr3);
   }
 
   thread_check_signal();
@@ -0,0 +1,94 @@
+#include <kern/vdso.h>
+#include <kern/page.h>
+#include <kern/pagetbl.h>
+#include <kern/malloc.h>
+
+struct vdso_data *vdso_data = NULL;
+
+struct vdso_mapper {
+  struct mapper mapper;
+  struct vdso_proc *proc;
+};
+
+void vdso_init() {
+  vdso_data = get_zeropage(PAGESIZE);
+}
+
+//readers retry while seq is odd or has changed.
+//must be called with interrupts disabled.
+void vdso_update_begin() {
+  vdso_data->seq++;
+  __sync_synchronize();
+}
+
+void vdso_update_end() {
+  __sync_synchronize();
+  vdso_data->seq++;
+}
+
+static paddr_t vdso_mapper_request(struct mapper *m, vaddr_t offset) {
+  struct vdso_mapper *vm = container_of(m, struct vdso_mapper, mapper);
+  if(offset < PAGESIZE)
+    return KERN_VMEM_TO_PHYS(vdso_data);
+  return KERN_VMEM_TO_PHYS(vm->proc);
+}
+
+static int vdso_mapper_yield(struct mapper *m UNUSED, paddr_t pdt UNUSED, int nr UNUSED) {
+  return 0;
+}
+
+static void vdso_mapper_free(struct mapper *m) {
+  struct vdso_mapper *vm = container_of(m, struct vdso_mapper, mapper);
+  page_free(vm->proc);
+  free(vm);
+}
+
+static struct mapper *vdso_mapper_new(pid_t pid);
+
+static struct mapper *vdso_mapper_dup(struct mapper *m) {
+  struct vdso_mapper *vm = container_of(m, struct vdso_mapper, mapper);
+  return vdso_mapper_new(vm->proc->pid);
+}
+
+static const struct mapper_ops vdso_mapper_ops = {
+  .request = vdso_mapper_request,
+  .yield = vdso_mapper_yield,
+  .free = vdso_mapper_free,
+  .dup = vdso_mapper_dup,
+};
+
+static struct mapper *vdso_mapper_new(pid_t pid) {
+  struct vdso_mapper *vm;
+  if((vm = malloc(sizeof(struct vdso_mapper))) == NULL)
+    return NULL;
+  if((vm->proc = get_zeropage(PAGESIZE)) == NULL) {
+    free(vm);
+    return NULL;
+  }
+  vm->proc->pid = pid;
+  list_init(&vm->mapper.page_list);
+  vm->mapper.ops = &vdso_mapper_ops;
+  return &vm->mapper;
+}
+
+//called on exec. the pages are mapped on the first access.
+int vdso_map(struct vm_map *map, pid_t pid) {
+  struct mapper *m = vdso_mapper_new(pid);
+  if(m == NULL)
+    return -1;
+  if(vm_add_area(map, VDSO_ADDR, PAGESIZE * 2, m, VM_AREA_READONLY)) {
+    m->ops->free(m);
+    return -1;
+  }
+  return 0;
+}
+
+//the child got a copy of the parent's per-process page from vm_map_dup().
+//drop the inherited mapping so that the child faults its own page in.
+void vdso_fork(struct vm_map *map, paddr_t pdt, pid_t pid) {
+  struct vm_area *area = vm_findarea(map, VDSO_PROC_ADDR);
+  if(area == NULL || area->mapper->ops != &vdso_mapper_ops)
+    return;
+  container_of(area->mapper, struct vdso_mapper, mapper)->proc->pid = pid;
+  pagetbl_remove_mapping((u32 *)pdt, VDSO_PROC_ADDR);
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <kern/kernlib.h>
+#include <kern/vmem.h>
+
+//read-only pages mapped at VDSO_ADDR in every user address space.
+//the layouts are shared with userland (usr/minix/tinyos.h).
+#define VDSO_PROC_ADDR (VDSO_ADDR + PAGESIZE)
+
+#define VDSO_CLOCK_SYSCALL 0 //no usable tsc, use clock_gettime()
+#define VDSO_CLOCK_TSC     1
+
+#define VDSO_SYSENTER 0x1 //features
+
+//shared by all processes
+struct vdso_data {
+  u32 seq; //odd while the kernel is updating
+  u32 clock_mode;
+  u64 tsc_base;
+  u32 tsc_mult; //ns = (tsc - tsc_base) * tsc_mult >> tsc_shift
+  u32 tsc_shift;
+  u64 realtime_offset;
+  u32 features;
+};
+
+//one per process
+struct vdso_proc {
+  u32 pid;
+};
+
+extern struct vdso_data *vdso_data;
+
+void vdso_init(void);
+void vdso_update_begin(void);
+void vdso_update_end(void);
+int vdso_map(struct vm_map *map, pid_t pid);
+void vdso_fork(struct vm_map *map, paddr_t pdt, pid_t pid);
@@ -1,9 +1,13 @@
 #include <kern/kernlib.h>
 #include <kern/vmem.h>
 #include <kern/page.h>
+#include <kern/pagetbl.h>
 #include <kern/fs.h>
 #include <kern/file.h>
 #include <kern/thread.h>
+#include <kern/reclaim.h>
+#include <kern/kernasm.h>
+#include <kern/smp.h>
 
 struct page_entry {
   struct list_head link;
@@ -11,7 +15,7 @@ struct page_entry {
 };
 
 struct page_info {
-  void *addr;
+  paddr_t paddr;
   int ref;
   vaddr_t start;
   mutex mtx;
@@ -28,18 +32,21 @@ struct file_mapper {
   size_t len;
 };
 
+static int nr_file_pages = 0;
+
 struct page_entry *page_entry_new(vaddr_t start) {
-  void *p = get_zeropage(PAGESIZE);
-  if(p == NULL)
+  paddr_t p = page_alloc_phys(PAGESIZE, PAGE_ALLOC_ZEROPAGE | PAGE_ALLOC_HIGHMEM);
+  if(p == 0)
     return NULL;
 
   struct page_entry *pe = malloc(sizeof(struct page_entry));
   struct page_info *pi = malloc(sizeof(struct page_info));
-  pi->addr = p;
+  pi->paddr = p;
   pi->ref = 1;
   pi->start = start;
   mutex_init(&pi->mtx);
   pe->pinfo = pi;
+  page_set_owner(p, pi);
   return pe;
 }
 
@@ -53,51 +60,84 @@ struct page_entry *page_entry_find(struct list_head *page_list, vaddr_t start) {
   return NULL;
 }
 
-static void page_copy(struct page_entry *pe) {
+//returns -1 if out of memory, pe is left shared then
+static int page_copy(struct page_entry *pe) {
   if(pe->pinfo->ref == 1) {
-    return;
+    return 0;
   }
 
   struct page_info *pinew = malloc(sizeof(struct page_info));
+  if(pinew == NULL)
+    return -1;
   memcpy(pinew, pe->pinfo, sizeof(struct page_info));
-  pinew->addr = page_alloc(PAGESIZE, 0);
-  memcpy(pinew->addr, pe->pinfo->addr, PAGESIZE);
+  pinew->paddr = page_alloc_phys(PAGESIZE, PAGE_ALLOC_HIGHMEM);
+  if(pinew->paddr == 0) {
+    free(pinew);
+    return -1;
+  }
+  void *dst = kmap(pinew->paddr);
+  void *src = kmap(pe->pinfo->paddr);
+  memcpy_kernel(dst, src, PAGESIZE);
+  kunmap(src);
+  kunmap(dst);
   pinew->ref = 1;
   mutex_init(&pinew->mtx);
+  page_set_owner(pinew->paddr, pinew);
   pe->pinfo->ref--;
   pe->pinfo = pinew;
+  return 0;
+}
+
+//moves the contents of a user page and updates every mapping of it.
+//called by the page allocator with interrupts disabled.
+int vmem_migrate_page(void *owner, paddr_t from, paddr_t to) {
+  struct page_info *pi = owner;
+  if(pi->paddr != from || mutex_trylock(&pi->mtx))
+    return -1;
+
+  //a fault on another cpu waits for the kernel lock until the new page is in
+  thread_block_mapping(pi->start, from);
+  void *dst = kmap(to);
+  void *src = kmap(from);
+  memcpy_kernel(dst, src, PAGESIZE);
+  kunmap(src);
+  kunmap(dst);
+  pi->paddr = to;
+  thread_replace_mapping(pi->start, from, to);
+  mutex_unlock(&pi->mtx);
+  return 0;
 }
 
 paddr_t anon_mapper_request(struct mapper *m, vaddr_t offset) {
   struct anon_mapper *am = container_of(m, struct anon_mapper, mapper);
   vaddr_t start = pagealign(m->area->start+offset);
-  vaddr_t page = anon_mapper_add_page(m, start);
-  return KERN_VMEM_TO_PHYS(page);
+  return anon_mapper_add_page(m, start);
 }
 
-int anon_mapper_yield(struct mapper *m UNUSED, paddr_t pdt UNUSED) {
+int anon_mapper_yield(struct mapper *m UNUSED, paddr_t pdt UNUSED, int nr UNUSED) {
   //TODO: swapping
-  return -1;
+  return 0;
 }
 
-vaddr_t anon_mapper_add_page(struct mapper *m, vaddr_t start) {
+paddr_t anon_mapper_add_page(struct mapper *m, vaddr_t start) {
   struct anon_mapper *am = container_of(m, struct anon_mapper, mapper);
   struct page_entry *pe;
   if((pe = page_entry_find(&m->page_list, start))) {
-    page_copy(pe);
+    if(page_copy(pe))
+      return 0;
   } else {
     pe = page_entry_new(start);
     if(pe == NULL)
-      return NULL;
+      return 0;
     list_pushback(&pe->link, &m->page_list);
   }
 
-  return pe->pinfo->addr;
+  return pe->pinfo->paddr;
 }
 
 static void page_entry_free(struct page_entry *pe) {
   if(--(pe->pinfo->ref) == 0) {
-    page_free(pe->pinfo->addr);
+    page_free_phys(pe->pinfo->paddr);
     free(pe->pinfo);
   }
   free(pe);
@@ -156,12 +196,14 @@ paddr_t file_mapper_request(struct mapper *m, vaddr_t in_area_off) {
   struct page_entry *pe;
   if((pe = page_entry_find(&m->page_list, start))) {
     //this page already exists but requested ... copy-on-write
-    page_copy(pe);
+    if(page_copy(pe))
+      return 0;
   } else {
     pe = page_entry_new(start);
     if(pe == NULL)
-      return NULL;
+      return 0;
     list_pushback(&pe->link, &m->page_list);
+    nr_file_pages++;
 
     u32 a_page = pagealign(in_area_off);
     u32 f_st_page = pagealign(m->area->offset);
@@ -186,7 +228,9 @@ paddr_t file_mapper_request(struct mapper *m, vaddr_t in_area_off) {
       u32 read_bytes;
       mutex_lock(&pe->pinfo->mtx);
       lseek(fm->file, a_page + buf_write_off + fm->file_off - m->area->offset, SEEK_SET);
-      read_bytes = read(fm->file, pe->pinfo->addr + buf_write_off, readlen);
+      u8 *vaddr = kmap(pe->pinfo->paddr);
+      read_bytes = read(fm->file, vaddr + buf_write_off, readlen);
+      kunmap(vaddr);
 
       if(read_bytes < readlen)
         puts("fatal: read failed");
@@ -195,36 +239,36 @@ paddr_t file_mapper_request(struct mapper *m, vaddr_t in_area_off) {
     }
   }
 
-  return KERN_VMEM_TO_PHYS(pe->pinfo->addr);
+  return pe->pinfo->paddr;
 }
 
-int file_mapper_yield(struct mapper *m, paddr_t pdt) {
-  //TODO: pages may be dirty!
-  return -1;
-  /*
-  struct file_mapper *fm = container_of(m, struct file_mapper, mapper);
-
+//drops clean, unshared pages. they are read from the file again on the next fault.
+int file_mapper_yield(struct mapper *m, paddr_t pdt, int nr) {
   int count = 0;
   struct list_head *p, *tmp;
   list_foreach_safe(p, tmp, &m->page_list) {
+    if(count >= nr)
+      break;
     struct page_entry *pe = list_entry(p, struct page_entry, link);
     if(mutex_trylock(&pe->pinfo->mtx) == 0) {
-      if(pe->pinfo->ref == 1) {
-        pagetbl_remove_mapping(pdt, pe->pinfo->start);
+      if(pe->pinfo->ref == 1 && pagetbl_remove_clean_mapping((u32 *)pdt, pe->pinfo->start)) {
         list_remove(&pe->link);
         page_entry_free(pe);
+        nr_file_pages--;
         count++;
       } else {
         mutex_unlock(&pe->pinfo->mtx);
       }
     }
   }
-  return (count > 0)?0:-1;
-  */
+  return count;
 }
 
 void file_mapper_free(struct mapper *m) {
   struct file_mapper *fm = container_of(m, struct file_mapper, mapper);
+  struct list_head *p;
+  list_foreach(p, &m->page_list)
+    nr_file_pages--;
   list_free_all(&m->page_list, struct page_entry, link, page_entry_free);
   close(fm->file);
   free(fm);
@@ -233,11 +277,14 @@ void file_mapper_free(struct mapper *m) {
 struct mapper *file_mapper_dup(struct mapper *m) {
   struct file_mapper *fmold = container_of(m, struct file_mapper, mapper);
   struct file_mapper *fmnew = malloc(sizeof(struct file_mapper));
+  struct list_head *p;
   memcpy(fmnew, fmold, sizeof(struct file_mapper));
 
   fmnew->file = dup(fmold->file);
   list_init(&fmnew->mapper.page_list);
   page_list_dup(&fmold->mapper.page_list, &fmnew->mapper.page_list);
+  list_foreach(p, &fmnew->mapper.page_list)
+    nr_file_pages++;
   return &fmnew->mapper;
 }
 
@@ -269,6 +316,9 @@ struct vm_map *vm_map_new() {
 
   list_init(&m->area_list);
   m->flags = 0;
+  m->ref = 1;
+  m->brk = NULL;
+  m->user_stack_bottom = m->user_stack_top = 0;
   return m;
 }
 
@@ -282,6 +332,10 @@ struct vm_map *vm_map_dup(struct vm_map *oldm) {
 
   list_init(&newm->area_list);
   newm->flags = oldm->flags;
+  newm->ref = 1;
+  newm->brk = oldm->brk;
+  newm->user_stack_bottom = oldm->user_stack_bottom;
+  newm->user_stack_top = oldm->user_stack_top;
 
   struct list_head *p;
   list_foreach(p, &oldm->area_list) {
@@ -311,17 +365,42 @@ void vm_map_free(struct vm_map *vmmap) {
   free(vmmap);
 }
 
-int vm_map_yield(struct vm_map *vmmap, paddr_t pdt) {
+struct vm_map *vm_map_hold(struct vm_map *vmmap) {
+  vmmap->ref++;
+  return vmmap;
+}
+
+//frees the areas when the last thread lets go of the map. returns 1 then.
+int vm_map_release(struct vm_map *vmmap) {
+  if(--vmmap->ref > 0)
+    return 0;
+  vm_map_free(vmmap);
+  return 1;
+}
+
+//a copy-on-write break changes the page under the other threads of the
+//map as well, so they are flushed on every cpu
+void vm_map_flush_tlb(struct vm_map *vmmap, paddr_t pdt) {
+  if(vmmap->ref > 1)
+    smp_flush_tlb_user(pdt);
+  else
+    flushtlb((void *)pdt);
+}
+
+//returns number of yielded pages
+int vm_map_yield(struct vm_map *vmmap, paddr_t pdt, int nr) {
+  int count = 0;
   struct list_head *p;
   list_foreach(p, &vmmap->area_list) {
+    if(count >= nr)
+      break;
     struct vm_area *area = list_entry(p, struct vm_area, link);
-    if(area->mapper->ops->yield(area->mapper, pdt) == 0)
-      return 0;
+    count += area->mapper->ops->yield(area->mapper, pdt, nr - count);
   }
-  return -1;
+  return count;
 }
 
-int vm_add_area(struct vm_map *map, u32 start, size_t size, struct mapper *mapper, u32 flags UNUSED) {
+int vm_add_area(struct vm_map *map, u32 start, size_t size, struct mapper *mapper, u32 flags) {
   struct list_head *p;
 
   size += start & (PAGESIZE-1);
@@ -344,7 +423,7 @@ int vm_add_area(struct vm_map *map, u32 start, size_t size, struct mapper *mappe
   new->start = start;
   new->size = size;
   new->offset = offset;
-  new->flags = 0;
+  new->flags = flags;
   new->mapper = mapper;
   list_pushback(&new->link, &map->area_list);
   mapper->area = new;
@@ -362,6 +441,44 @@ struct vm_area *vm_findarea(struct vm_map *map, vaddr_t addr) {
   return NULL;
 }
 
+//resolves addr like a write fault does, so the page is private to this map
+//afterwards. returns NULL if addr is not writable.
+struct page_info *vm_get_page(struct vm_map *map, paddr_t pdt, vaddr_t addr) {
+  struct vm_area *a = vm_findarea(map, addr);
+  if(a == NULL || (a->flags & VM_AREA_READONLY))
+    return NULL;
+
+  paddr_t paddr = a->mapper->ops->request(a->mapper, addr - a->start);
+  if(paddr == 0 || pagetbl_add_mapping((u32 *)pdt, addr, paddr))
+    return NULL;
+  vm_map_flush_tlb(map, pdt);
+  return page_entry_find(&a->mapper->page_list, pagealign(addr))->pinfo;
+}
+
+//stores to an aligned user word. CR0.WP is clear, so a plain store from
+//the kernel would go through a copy-on-write mapping into a shared page.
+int vm_write_u32(struct vm_map *map, paddr_t pdt, vaddr_t addr, u32 val) {
+  struct page_info *pi = vm_get_page(map, pdt, addr);
+  if(pi == NULL)
+    return -1;
+  u32 *page = kmap(pi->paddr);
+  page[(addr & (PAGESIZE-1)) / sizeof(u32)] = val;
+  kunmap(page);
+  return 0;
+}
+
+//loads an aligned user word without faulting. returns -1 if addr is not
+//writable.
+int vm_read_u32(struct vm_map *map, paddr_t pdt, vaddr_t addr, u32 *val) {
+  struct page_info *pi = vm_get_page(map, pdt, addr);
+  if(pi == NULL)
+    return -1;
+  u32 *page = kmap(pi->paddr);
+  *val = page[(addr & (PAGESIZE-1)) / sizeof(u32)];
+  kunmap(page);
+  return 0;
+}
+
 void vm_show_area(struct vm_map *map) {
   struct list_head *p, *p2;
   puts("----- ----- -----");
@@ -371,11 +488,26 @@ void vm_show_area(struct vm_map *map) {
     list_foreach(p2, &(a->mapper->page_list)) {
       struct page_entry *pe = list_entry(p2, struct page_entry, link);
       struct page_info *i = pe->pinfo;
-      printf("    addr %x ref %x start %x\n", i->addr, i->ref, i->start);
+      printf("    paddr %x ref %x start %x\n", i->paddr, i->ref, i->start);
     }
   }
   puts("----- ----- -----");
 }
 
+static int mapper_shrinker_count() {
+  return nr_file_pages;
+}
+
+static int mapper_shrinker_scan(int nr) {
+  return thread_yield_pages(nr);
+}
+
+static struct shrinker mapper_shrinker = {
+  .name = "mapper",
+  .count = mapper_shrinker_count,
+  .scan = mapper_shrinker_scan,
+};
+
 void vmem_init() {
+  shrinker_register(&mapper_shrinker);
 }
@@ -7,10 +7,16 @@
 
 struct mapper;
 struct vm_map;
+struct page_info;
 
+//an address space, shared by the threads of a process
 struct vm_map {
   struct list_head area_list;
   u32 flags;
+  int ref;
+  void *brk;
+  vaddr_t user_stack_bottom;
+  vaddr_t user_stack_top;
 };
 
 struct vm_area {
@@ -19,12 +25,13 @@ struct vm_area {
   off_t offset;
   size_t size;
   u32 flags;
+#define VM_AREA_READONLY 0x1 //writes are segmentation faults
   struct mapper *mapper;
 };
 
 struct mapper_ops {
   paddr_t (*request)(struct mapper *m, vaddr_t offset);
-  int (*yield)(struct mapper *m, paddr_t pdt);
+  int (*yield)(struct mapper *m, paddr_t pdt, int nr);
   void (*free)(struct mapper *m);
   struct mapper *(*dup)(struct mapper *m);
 };
@@ -37,13 +44,20 @@ struct mapper {
 
 struct vm_map *vm_map_new(void);
 void vm_map_free(struct vm_map *vmmap);
-int vm_map_yield(struct vm_map *vmmap, paddr_t pdt);
+struct vm_map *vm_map_hold(struct vm_map *vmmap);
+int vm_map_release(struct vm_map *vmmap);
+void vm_map_flush_tlb(struct vm_map *vmmap, paddr_t pdt);
+int vm_map_yield(struct vm_map *vmmap, paddr_t pdt, int nr);
 struct vm_map *vm_map_dup(struct vm_map *oldm);
 int vm_add_area(struct vm_map *map, vaddr_t start, size_t size, struct mapper *mapper, u32 flags);
 struct vm_area *vm_findarea(struct vm_map *map, vaddr_t addr);
+struct page_info *vm_get_page(struct vm_map *map, paddr_t pdt, vaddr_t addr);
+int vm_read_u32(struct vm_map *map, paddr_t pdt, vaddr_t addr, u32 *val);
+int vm_write_u32(struct vm_map *map, paddr_t pdt, vaddr_t addr, u32 val);
 void vm_show_area(struct vm_map *map);
 void vmem_init(void);
 
 struct mapper *anon_mapper_new(void);
-vaddr_t anon_mapper_add_page(struct mapper *m, vaddr_t start);
+paddr_t anon_mapper_add_page(struct mapper *m, vaddr_t start);
+int vmem_migrate_page(void *owner, paddr_t from, paddr_t to);
 struct mapper *file_mapper_new(struct file *file, off_t file_off, size_t len);
@@ -1,65 +1,182 @@
 #include <kern/workqueue.h>
 #include <kern/thread.h>
 #include <kern/timer.h>
+#include <kern/clock.h>
 #include <kern/kernlib.h>
+#include <kern/syscalls.h>
 
-struct workqueue {
-  struct list_head queue;
-  struct thread *thread;
-};
+//a pool of worker threads taking items in FIFO order, high priority
+//ones first. with more than one worker a slow item doesn't hold up the
+//rest. different items may run in parallel, but an item never runs on
+//two workers at once: queueing it while it runs defers it until it returns.
 
-struct work {
+struct workqueue {
   struct list_head link;
-  void (*func)(void *);
-  void *arg;
-  struct workqueue *wq;
+  struct list_head queue[2]; //by priority
+  const char *name;
+  struct workqueue_stats stats;
 };
 
+static struct list_head workqueue_list = {&workqueue_list, &workqueue_list};
+
+//call with interrupts disabled
+static void enqueue(struct work *w) {
+  struct workqueue *wq = w->wq;
+  list_pushback(&w->link, &wq->queue[w->priority]);
+  wq->stats.depth++;
+  wq->stats.max_depth = MAX(wq->stats.max_depth, wq->stats.depth);
+}
+
+static struct work *dequeue(struct workqueue *wq) {
+  struct list_head *item = list_pop(&wq->queue[WORK_PRIO_HIGH]);
+  if(item == NULL)
+    item = list_pop(&wq->queue[WORK_PRIO_NORMAL]);
+  return item ? container_of(item, struct work, link) : NULL;
+}
+
 static void workqueue_thread(void *arg) {
   struct workqueue *wq = (struct workqueue *)arg;
   while(1) {
-    struct list_head *item;
-    while((cli(), (item = list_pop(&wq->queue))) == NULL) {
-      sti();
+    struct work *w;
+IRQ_DISABLE
+    while((w = dequeue(wq)) == NULL)
       thread_sleep(wq);
-    }
-    sti();
-    struct work *w = container_of(item, struct work, link);
+    w->flags &= ~WORK_PENDING;
+    w->flags |= WORK_RUNNING;
+    u64 latency = clock_monotonic_ns() - w->queued_at;
+    wq->stats.depth--;
+    wq->stats.nbusy++;
+    wq->stats.nrun++;
+    wq->stats.total_latency += latency;
+    wq->stats.max_latency = MAX(wq->stats.max_latency, latency);
+IRQ_RESTORE
+    int allocated = w->flags & WORK_ALLOCATED;
     (w->func)(w->arg);
-    free(w);
+    if(allocated)
+      free(w);
+IRQ_DISABLE
+    wq->stats.nbusy--;
+    if(!allocated) {
+      w->flags &= ~WORK_RUNNING;
+      if(w->flags & WORK_DEFERRED) {
+        //queued again while running. a delayed item still waiting for its
+        //timer is not deferred, the timer queues it.
+        w->flags &= ~WORK_DEFERRED;
+        enqueue(w);
+        if(w->wq != wq)
+          thread_wakeup_one(w->wq);
+      }
+    }
+IRQ_RESTORE
   }
 }
 
-struct workqueue *workqueue_new(const char *name) {
+struct workqueue *workqueue_new_pool(const char *name, int nworkers) {
   struct workqueue *wq = malloc(sizeof(struct workqueue));
-  list_init(&wq->queue);
-  wq->thread = kthread_new(workqueue_thread, wq, name, PRIORITY_SYSTEM, 1);
-  thread_run(wq->thread);
+  bzero(wq, sizeof(struct workqueue));
+  list_init(&wq->queue[WORK_PRIO_NORMAL]);
+  list_init(&wq->queue[WORK_PRIO_HIGH]);
+  wq->name = name;
+  wq->stats.nworkers = MAX(nworkers, 1);
+  list_pushback(&wq->link, &workqueue_list);
+  for(u32 i = 0; i < wq->stats.nworkers; i++)
+    thread_run(kthread_new(workqueue_thread, wq, name, PRIORITY_SYSTEM, 1));
   return wq;
 }
 
+struct workqueue *workqueue_new(const char *name) {
+  return workqueue_new_pool(name, 1);
+}
+
+void work_init(struct work *w, void (*func)(void *), void *arg, int priority) {
+  bzero(w, sizeof(struct work));
+  w->func = func;
+  w->arg = arg;
+  w->priority = priority ? WORK_PRIO_HIGH : WORK_PRIO_NORMAL;
+}
+
+//may be called from interrupt handlers
 static void _workqueue_add(const void *arg) {
   struct work *w = (struct work *)arg;
+  struct workqueue *wq = w->wq;
+  int running;
 IRQ_DISABLE
-  list_pushfront(&w->link, &w->wq->queue);
+  w->queued_at = clock_monotonic_ns();
+  //a running item is put on the queue by its worker when it returns
+  running = w->flags & WORK_RUNNING;
+  if(running)
+    w->flags |= WORK_DEFERRED;
+  else
+    enqueue(w);
 IRQ_RESTORE
-  thread_wakeup(w->wq);
+  //one idle worker is enough
+  if(!running)
+    thread_wakeup_one(wq);
+}
+
+//returns -1 if the work is already pending, it runs only once then.
+//may be called from interrupt handlers.
+int workqueue_queue_delayed(struct workqueue *wq, struct work *w, int ticks) {
+  int ret = 0;
+IRQ_DISABLE
+  if(w->flags & WORK_PENDING) {
+    ret = -1;
+  } else {
+    w->flags |= WORK_PENDING;
+    w->wq = wq;
+    if(ticks == 0) {
+      _workqueue_add(w);
+    } else {
+      timer_init(&w->timer, _workqueue_add, w);
+      timer_add(&w->timer, ticks);
+    }
+  }
+IRQ_RESTORE
+  return ret;
+}
+
+int workqueue_queue(struct workqueue *wq, struct work *w) {
+  return workqueue_queue_delayed(wq, w, 0);
 }
 
 void workqueue_add_delayed(struct workqueue *wq, void (*func)(void *), void *arg, int ticks) {
   struct work *w = malloc(sizeof(struct work));
-  w->func = func;
-  w->arg = arg;
-  w->wq = wq;
-
-  if(ticks == 0)
-    _workqueue_add(w);
-  else
-    timer_start(ticks, _workqueue_add, w);
+  work_init(w, func, arg, WORK_PRIO_NORMAL);
+  w->flags = WORK_ALLOCATED;
+  workqueue_queue_delayed(wq, w, ticks);
 }
 
 void workqueue_add(struct workqueue *wq, void (*func)(void *), void *arg) {
   return workqueue_add_delayed(wq, func, arg, 0);
 }
 
+int sys_getwents(struct workqueueent *wqp, size_t count) {
+  if(buffer_check(wqp, count))
+    return -1;
+
+  size_t nfoundent = 0;
+  struct list_head *p;
+  list_foreach(p, &workqueue_list) {
+    if(count < sizeof(struct workqueueent)) break;
+
+    struct workqueue *wq = list_entry(p, struct workqueue, link);
+    struct workqueueent *ent = &wqp[nfoundent];
+    strncpy(ent->name, wq->name, MAX_WQNAME_LEN);
+    ent->name[MAX_WQNAME_LEN - 1] = '\0';
+IRQ_DISABLE
+    ent->nworkers = wq->stats.nworkers;
+    ent->nbusy = wq->stats.nbusy;
+    ent->depth = wq->stats.depth;
+    ent->max_depth = wq->stats.max_depth;
+    ent->nrun = wq->stats.nrun;
+    ent->avg_latency = wq->stats.nrun ?
+      (u32)(wq->stats.total_latency / wq->stats.nrun / 1000) : 0;
+    ent->max_latency = (u32)(wq->stats.max_latency / 1000);
+IRQ_RESTORE
 
+    nfoundent++;
+    count -= sizeof(struct workqueueent);
+  }
+
+  return nfoundent * sizeof(struct workqueueent);
+}
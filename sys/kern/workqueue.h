@@ -1,8 +1,58 @@
+#pragma once
 #include <kern/kernlib.h>
+#include <kern/list.h>
+#include <kern/timer.h>
 
 struct workqueue;
 
+//embeddable work item. initialize with work_init(), then queue with
+//workqueue_queue(). it may be queued again as soon as its function starts,
+//it then runs again after the function returns.
+struct work {
+  struct list_head link;
+  void (*func)(void *);
+  void *arg;
+  struct workqueue *wq;
+  struct timer timer;
+  u64 queued_at; //ns
+  u8 priority;
+#define WORK_PRIO_NORMAL 0
+#define WORK_PRIO_HIGH   1 //runs before every normal item
+  u8 flags;
+#define WORK_PENDING   0x1
+#define WORK_ALLOCATED 0x2 //allocated by workqueue_add(), freed after it ran
+#define WORK_RUNNING   0x4
+#define WORK_DEFERRED  0x8 //to be queued when its run returns
+};
+
+struct workqueue_stats {
+  u32 nworkers;
+  u32 nbusy;
+  u32 depth; //queued items
+  u32 max_depth;
+  u32 nrun;
+  u64 total_latency; //ns from queueing to start, summed over nrun
+  u64 max_latency;
+};
+
+#define MAX_WQNAME_LEN 32
+
+struct workqueueent {
+  char name[MAX_WQNAME_LEN];
+  u32 nworkers;
+  u32 nbusy;
+  u32 depth;
+  u32 max_depth;
+  u32 nrun;
+  u32 avg_latency; //us
+  u32 max_latency;
+};
+
 struct workqueue *workqueue_new(const char *name);
+struct workqueue *workqueue_new_pool(const char *name, int nworkers);
+void work_init(struct work *w, void (*func)(void *), void *arg, int priority);
+int workqueue_queue(struct workqueue *wq, struct work *w);
+int workqueue_queue_delayed(struct workqueue *wq, struct work *w, int ticks);
 void workqueue_add_delayed(struct workqueue *wq, void (*func)(void *), void *arg, int ticks);
 void workqueue_add(struct workqueue *wq, void (*func)(void *), void *arg);
-
+int sys_getwents(struct workqueueent *wqp, size_t count);
@@ -2,6 +2,7 @@
 #include <net/ether/protohdr.h>
 #include <net/inet/arp.h>
 #include <net/inet/ip.h>
+#include <net/inet/params.h>
 #include <net/util.h>
 #include <kern/pktbuf.h>
 #include <kern/thread.h>
@@ -17,7 +18,8 @@ struct workqueue *ether_wq;
 
 
 NET_INIT void ether_init() {
-  ether_wq = workqueue_new("ether wq");
+  //a frame whose processing blocks on a transmit doesn't hold up the next ones
+  ether_wq = workqueue_new_pool("ether wq", ETHER_WQ_WORKERS);
 }
 
 void ether_rx(devno_t devno) {
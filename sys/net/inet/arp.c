@@ -10,6 +10,8 @@
 #include <kern/netdev.h>
 #include <kern/thread.h>
 #include <kern/timer.h>
+#include <kern/page.h>
+#include <kern/reclaim.h>
 
 struct pending_frame {
   struct list_head link;
@@ -26,7 +28,8 @@ struct arpentry {
   struct list_head pending; //アドレス解決待ちのフレーム
 };
 
-struct arpentry arptable[MAX_ARPTABLE];
+struct arpentry *arptable;
+static int arptable_size;
 static int next_register = 0; //次の登録位置
 
 enum arpresult {
@@ -35,17 +38,29 @@ enum arpresult {
   RESULT_ADD_LIST    = 2,
 };
 
-static mutex arptbl_mtx;
+static rwlock arptbl_lock; //resolved lookups share it
 
 static void arp_10sec_thread(void *);
+static int arp_shrinker_count(void);
+static int arp_shrinker_scan(int nr);
+
+static struct shrinker arp_shrinker = {
+  .name = "arp_pending",
+  .count = arp_shrinker_count,
+  .scan = arp_shrinker_scan,
+};
 
 NET_INIT void arp_init() {
-  mutex_init(&arptbl_mtx);
+  rwlock_init(&arptbl_lock);
 
-  for(int i=0;i<MAX_ARPTABLE;i++)
+  arptable_size = MIN(MAX(page_getnfree() / 64, MIN_ARPTABLE), MAX_ARPTABLE);
+  arptable = malloc(sizeof(struct arpentry) * arptable_size);
+  bzero(arptable, sizeof(struct arpentry) * arptable_size);
+  for(int i=0;i<arptable_size;i++)
     list_init(&arptable[i].pending);
 
   thread_run(kthread_new(arp_10sec_thread, NULL, "arp_10sec", PRIORITY_SYSTEM, 1));
+  shrinker_register(&arp_shrinker);
 }
 
 static struct pending_frame *pending_frame_new(struct pktbuf *frm, u16 proto, devno_t devno) {
@@ -69,10 +84,30 @@ static void pending_remove_all_preserve_pkts(struct list_head *pending) {
   list_free_all(pending, struct pending_frame, link, free);
 }
 
+//the common case, a resolved entry, only needs the lock shared
+static int arp_lookup(in_addr_t ipaddr, struct etheraddr *macaddr) {
+  int found = 0;
+  read_lock(&arptbl_lock);
+  for(int i=0; i<arptable_size; i++) {
+    if(arptable[i].ipaddr == ipaddr && arptable[i].timeout>0) {
+      if(list_is_empty(&arptable[i].pending)) {
+        *macaddr = arptable[i].macaddr;
+        found = 1;
+      }
+      break;
+    }
+  }
+  read_unlock(&arptbl_lock);
+  return found;
+}
+
 static int arp_resolve(in_addr_t ipaddr, struct etheraddr *macaddr, struct pktbuf *frm, u16 proto, devno_t devno) {
-  mutex_lock(&arptbl_mtx);
+  if(arp_lookup(ipaddr, macaddr))
+    return RESULT_FOUND;
+
+  write_lock(&arptbl_lock);
 
-  for(int i=0; i<MAX_ARPTABLE; i++){
+  for(int i=0; i<arptable_size; i++){
     if(arptable[i].ipaddr == ipaddr &&  arptable[i].timeout>0){
       int result;
       if(list_is_empty(&arptable[i].pending)){
@@ -85,7 +120,7 @@ static int arp_resolve(in_addr_t ipaddr, struct etheraddr *macaddr, struct pktbu
         list_pushback(&pending_frame_new(frm, proto, devno)->link, &arptable[i].pending);
         result = RESULT_ADD_LIST;
       }
-      mutex_unlock(&arptbl_mtx);
+      write_unlock(&arptbl_lock);
       return result;
     }
   }
@@ -97,17 +132,17 @@ static int arp_resolve(in_addr_t ipaddr, struct etheraddr *macaddr, struct pktbu
   list_pushfront(&pending_frame_new(frm, proto, devno)->link, &arptable[next_register].pending);
   arptable[next_register].timeout = ARBTBL_TIMEOUT_CLC;
   arptable[next_register].ipaddr = ipaddr;
-  next_register = (next_register+1) % MAX_ARPTABLE;
+  next_register = (next_register+1) % arptable_size;
 
-  mutex_unlock(&arptbl_mtx);
+  write_unlock(&arptbl_lock);
   return RESULT_NOT_FOUND;
 }
 
 void register_arptable(in_addr_t ipaddr, struct etheraddr macaddr, int is_permanent){
-  mutex_lock(&arptbl_mtx);
+  write_lock(&arptbl_lock);
 
   //IPアドレスだけ登録されている（アドレス解決待ち）エントリを探す
-  for(int i=0; i<MAX_ARPTABLE; i++) {
+  for(int i=0; i<arptable_size; i++) {
     if(arptable[i].ipaddr == ipaddr && arptable[i].timeout>0){
       arptable[i].timeout = is_permanent ? ARPTBL_PERMANENT : ARBTBL_TIMEOUT_CLC; //延長
       if(!list_is_empty(&arptable[i].pending)){
@@ -119,7 +154,7 @@ void register_arptable(in_addr_t ipaddr, struct etheraddr macaddr, int is_perman
         }
         pending_remove_all_preserve_pkts(&arptable[i].pending);
       }
-      mutex_unlock(&arptbl_mtx);
+      write_unlock(&arptbl_lock);
       return;
     }
   }
@@ -128,8 +163,8 @@ void register_arptable(in_addr_t ipaddr, struct etheraddr macaddr, int is_perman
   arptable[next_register].timeout = is_permanent?ARPTBL_PERMANENT:ARBTBL_TIMEOUT_CLC;
   arptable[next_register].ipaddr = ipaddr;
   arptable[next_register].macaddr = macaddr;
-  next_register = (next_register+1) % MAX_ARPTABLE;
-  mutex_unlock(&arptbl_mtx);
+  next_register = (next_register+1) % arptable_size;
+  write_unlock(&arptbl_lock);
   return;
 }
 
@@ -149,16 +184,21 @@ void arp_rx(struct pktbuf *frm){
   {
     devno_t devno;
     struct list_head *p;
-    int found = 0;
-    list_foreach(p, &ifaddr_tbl[PF_INET]) {
-      struct ifaddr_in *inaddr =
-         list_entry(p, struct ifaddr_in, family_link);
-      if(inaddr->addr == earp->arp_tpa) {
-        devno = inaddr->devno;
-        found = 1;
-        break;
+    int found;
+    u32 seq;
+    do {
+      seq = read_seqbegin(&ifaddr_seq);
+      found = 0;
+      list_foreach(p, &ifaddr_tbl[PF_INET]) {
+        struct ifaddr_in *inaddr =
+           list_entry(p, struct ifaddr_in, family_link);
+        if(inaddr->addr == earp->arp_tpa) {
+          devno = inaddr->devno;
+          found = 1;
+          break;
+        }
       }
-    }
+    } while(read_seqretry(&ifaddr_seq, seq));
     if(!found) {
       pktbuf_free(frm);
       break;
@@ -182,6 +222,35 @@ void arp_rx(struct pktbuf *frm){
   return;
 }
 
+static int arp_shrinker_count() {
+  int count = 0;
+  struct list_head *p;
+  for(int i=0; i<arptable_size; i++) {
+    list_foreach(p, &arptable[i].pending)
+      count++;
+  }
+  return count;
+}
+
+//frames waiting for address resolution are dropped. upper layers will resend them.
+//an entry with empty pending list is regarded as resolved, so the entry is invalidated too.
+static int arp_shrinker_scan(int nr) {
+  int count = 0;
+  if(write_trylock(&arptbl_lock))
+    return 0;
+  for(int i=0; i<arptable_size && count < nr; i++) {
+    if(list_is_empty(&arptable[i].pending))
+      continue;
+    struct list_head *p;
+    list_foreach(p, &arptable[i].pending)
+      count++;
+    pending_remove_all(&arptable[i].pending);
+    arptable[i].timeout = 0;
+  }
+  write_unlock(&arptbl_lock);
+  return count;
+}
+
 static void send_arprequest(in_addr_t dstaddr, devno_t devno){
   struct pktbuf *req =
     pktbuf_alloc(MAX_HDRLEN_ETHER + sizeof(struct ether_arp), 0);
@@ -208,22 +277,22 @@ static void arp_10sec_thread(void *arg UNUSED) {
     thread_set_alarm(arp_10sec_thread, msecs_to_ticks(10000));
     thread_sleep(arp_10sec_thread);
 
-    mutex_lock(&arptbl_mtx);
-    for(int i=0; i<MAX_ARPTABLE; i++) {
+    write_lock(&arptbl_lock);
+    for(int i=0; i<arptable_size; i++) {
       if(arptable[i].timeout > 0 &&
          arptable[i].timeout != ARPTBL_PERMANENT) {
         arptable[i].timeout--;
       }
       if(arptable[i].timeout == 0) {
         if(!list_is_empty(&arptable[i].pending))
-          list_free_all(&arptable[i].pending, struct pktbuf, link, pktbuf_free);
+          pending_remove_all(&arptable[i].pending);
       } else {
         if(!list_is_empty(&arptable[i].pending)) {
           send_arprequest(arptable[i].ipaddr, list_entry(list_first(&arptable[i].pending), struct pending_frame, link)->devno);
         }
       }
     }
-    mutex_unlock(&arptbl_mtx);
+    write_unlock(&arptbl_lock);
   }
 }
 
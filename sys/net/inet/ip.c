@@ -268,16 +268,18 @@ void fill_iphdr(struct ip_hdr *iphdr, u16 datalen, u16 id,
   return;
 }
 
-static in_addr_t defaultgw;
+static in_addr_t defaultgw; //under ifaddr_seq
 void ip_set_defaultgw(in_addr_t addr) {
+  write_seqlock(&ifaddr_seq);
   defaultgw = addr;
+  write_sequnlock(&ifaddr_seq);
 }
 
 in_addr_t ip_get_defaultgw() {
   return defaultgw;
 }
 
-int ip_routing_src(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
+static int route_src(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
   struct list_head *p;
   list_foreach(p, &ifaddr_tbl[PF_INET]) {
     struct ifaddr_in *inaddr = list_entry(p, struct ifaddr_in, family_link);
@@ -293,9 +295,9 @@ int ip_routing_src(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_ad
 }
 
 
-int ip_routing(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
+static int route(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
   if(orig_src != INADDR_ANY)
-    return ip_routing_src(orig_src, orig_dst, src, dst, devno);
+    return route_src(orig_src, orig_dst, src, dst, devno);
 
   struct list_head *p;
   list_foreach(p, &ifaddr_tbl[PF_INET]) {
@@ -311,7 +313,29 @@ int ip_routing(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t
   if(orig_dst == defaultgw)
     return -1;
 
-  return ip_routing(orig_src, defaultgw, src, dst, devno);
+  return route(orig_src, defaultgw, src, dst, devno);
+}
+
+//lookups run in parallel without a lock, retrying if the addresses or
+//the gateway changed meanwhile
+int ip_routing_src(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
+  int ret;
+  u32 seq;
+  do {
+    seq = read_seqbegin(&ifaddr_seq);
+    ret = route_src(orig_src, orig_dst, src, dst, devno);
+  } while(read_seqretry(&ifaddr_seq, seq));
+  return ret;
+}
+
+int ip_routing(in_addr_t orig_src, in_addr_t orig_dst, in_addr_t *src, in_addr_t *dst, devno_t *devno) {
+  int ret;
+  u32 seq;
+  do {
+    seq = read_seqbegin(&ifaddr_seq);
+    ret = route(orig_src, orig_dst, src, dst, devno);
+  } while(read_seqretry(&ifaddr_seq, seq));
+  return ret;
 }
 
 u16 ip_getid(){
@@ -6,12 +6,15 @@
 #define MTU 1500
 #define MSS (MTU-40)
 #define IP_TTL 64
+#define MIN_ARPTABLE 64
 #define MAX_ARPTABLE 1024
 #define ARBTBL_TIMEOUT_CLC 720 //10sec * 720 = 2hours
 #define IPFRAG_TIMEOUT_CLC 6 //10sec * 6 = 1min
 
 #define UDP_RECVQUEUE_LEN 32
 
+#define ETHER_WQ_WORKERS 1 //rx runs as one non-reentrant item, frames stay in order
+
 #define TCP_TIMER_UNIT 200 //msec
 
 #define TCP_RTT_INIT 3
@@ -29,6 +29,7 @@ static mutex tcp_mtx;
 static struct list_head tcpcb_list;
 static struct workqueue *tcp_tx_wq;
 static struct workqueue *tcp_timer_wq;
+static struct work tcp_tx_work; //walks every connection, so one pending is enough
 
 struct tcp_arrival {
   struct list_head link;
@@ -230,6 +231,7 @@ static const struct socket_ops tcp_sock_ops = {
 NET_INIT void tcp_init() {
   tcp_tx_wq = workqueue_new("tcp_tx workqueue");
   tcp_timer_wq = workqueue_new("tcp_timer workqueue");
+  work_init(&tcp_tx_work, tcp_tx, NULL, WORK_PRIO_NORMAL);
   list_init(&tcpcb_list);
   mutex_init(&tcp_mtx);
   socket_register_ops(PF_INET, SOCK_STREAM, &tcp_sock_ops);
@@ -531,7 +533,7 @@ void tcp_rx_listen(struct pktbuf *pkt, struct ip_hdr *ih, struct tcp_hdr *th, st
     newcb->mss = MSS;
 
     list_pushback(&newcb->link, &tcpcb_list);
-    thread_wakeup(cb);
+    thread_wakeup_one(cb); //one connection for one acceptor
   }
 
 exit:
@@ -1505,7 +1507,6 @@ void tcp_timer_do(void *arg) {
         if(cb->snd_wnd == 0){
           tinfo->type = TCP_TIMER_TYPE_RESEND;
           tcpcb_timer_add(tinfo->cb, MIN(tinfo->msec*2, TCP_PERSIST_WAIT_MAX), tinfo);
-          timinfo_free(tinfo);
         }else{
           cb->snd_persisttim_enabled = false;
           timinfo_free(tinfo);
@@ -1564,5 +1565,5 @@ void tcp_tx(void *arg UNUSED) {
 }
 
 void tcp_tx_request() {
-  workqueue_add(tcp_tx_wq, tcp_tx, NULL);
+  workqueue_queue(tcp_tx_wq, &tcp_tx_work);
 }
@@ -179,64 +179,95 @@ int sys_socket(int domain, int type) {
   int fd = fd_get();
   if(fd < 0)
     return -1;
-  current->files[fd] = socket(domain, type);
-  if(current->files[fd] == NULL)
-    return -1;
-  return fd;
+  return fd_install(fd, socket(domain, type));
 }
 
 int sys_bind(int fd, const struct sockaddr *addr) {
-  if(is_invalid_fd(fd) || buffer_check(addr, sizeof(struct sockaddr)))
+  if(buffer_check(addr, sizeof(struct sockaddr)))
+    return -1;
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return bind(current->files[fd], addr);
+  int result = bind(f, addr);
+  close(f);
+  return result;
 }
 
 int sys_sendto(int fd, const char *msg, size_t len, int flags, const struct sockaddr *to_addr) {
-  if(is_invalid_fd(fd) || buffer_check(msg, len) || buffer_check(to_addr, sizeof(struct sockaddr)))
+  if(buffer_check(msg, len) || buffer_check(to_addr, sizeof(struct sockaddr)))
+    return -1;
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return sendto(current->files[fd], msg, len, flags, to_addr);
+  int result = sendto(f, msg, len, flags, to_addr);
+  close(f);
+  return result;
 }
 
 int sys_recvfrom(int fd, char *buf, size_t len, int flags, struct sockaddr *from_addr) {
-  if(is_invalid_fd(fd) || buffer_check(buf, len) || buffer_check(from_addr, sizeof(struct sockaddr)))
+  if(buffer_check(buf, len) || buffer_check(from_addr, sizeof(struct sockaddr)))
     return -1;
-  return recvfrom(current->files[fd], buf, len, flags, from_addr);
+  struct file *f = fget(fd);
+  if(f == NULL)
+    return -1;
+  int result = recvfrom(f, buf, len, flags, from_addr);
+  close(f);
+  return result;
 }
 
 int sys_connect(int fd, const struct sockaddr *to_addr) {
-  if(is_invalid_fd(fd) || buffer_check(to_addr, sizeof(struct sockaddr)))
+  if(buffer_check(to_addr, sizeof(struct sockaddr)))
+    return -1;
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return connect(current->files[fd], to_addr);
+  int result = connect(f, to_addr);
+  close(f);
+  return result;
 }
 
 int sys_listen(int fd, int backlog){
-  if(is_invalid_fd(fd))
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return listen(current->files[fd], backlog);
+  int result = listen(f, backlog);
+  close(f);
+  return result;
 }
 
 int sys_accept(int fd, struct sockaddr *client_addr) {
-  if(is_invalid_fd(fd) || buffer_check(client_addr, sizeof(struct sockaddr)))
+  if(buffer_check(client_addr, sizeof(struct sockaddr)))
     return -1;
-  int newfd = fd_get();
-  if(newfd < 0)
-    return -1;
-  current->files[newfd] = accept(current->files[fd], client_addr);
-  if(current->files[newfd] == NULL)
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
+  int newfd = fd_get();
+  if(newfd >= 0)
+    newfd = fd_install(newfd, accept(f, client_addr));
+  close(f);
   return newfd;
 }
 
 int sys_send(int fd, const char *msg, size_t len, int flags) {
-  if(is_invalid_fd(fd) || buffer_check(msg, len))
+  if(buffer_check(msg, len))
     return -1;
-  return send(current->files[fd], msg, len, flags);
+  struct file *f = fget(fd);
+  if(f == NULL)
+    return -1;
+  int result = send(f, msg, len, flags);
+  close(f);
+  return result;
 }
 
 int sys_recv(int fd, char *buf, size_t len, int flags) {
-  if(is_invalid_fd(fd) || buffer_check(buf, len))
+  if(buffer_check(buf, len))
+    return -1;
+  struct file *f = fget(fd);
+  if(f == NULL)
     return -1;
-  return recv(current->files[fd], buf, len, flags);
+  int result = recv(f, buf, len, flags);
+  close(f);
+  return result;
 }
 
 int sys_getsents(struct sockent *sockp, size_t count) {
@@ -0,0 +1,262 @@
+#include "pthread.h"
+#include "tinyos.h"
+#include "syscall.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+
+#define THREAD_JOINABLE 0
+#define THREAD_DETACHED 1
+#define THREAD_EXITED   2
+
+struct pthread {
+  struct pthread *self; //read through gs, must be first
+  void *(*start)(void *);
+  void *arg;
+  void *retval;
+  volatile uint32_t running; //cleared and woken by the kernel on exit
+  volatile uint32_t state;
+  void *stack;
+  struct pthread *next; //on dead_threads
+};
+
+static struct pthread main_thread;
+static int tls_ready;
+
+//detached threads that have exited. their stacks are freed by the next
+//pthread_create, since a thread can't free the stack it runs on.
+static struct pthread *dead_threads;
+static pthread_mutex_t dead_threads_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void tls_init(void) {
+  main_thread.self = &main_thread;
+  main_thread.running = 1;
+  syscall_1(40, &main_thread);
+  tls_ready = 1;
+}
+
+static void free_thread(struct pthread *t) {
+  free(t->stack);
+  free(t);
+}
+
+static void reap_dead_threads(void) {
+  pthread_mutex_lock(&dead_threads_mutex);
+  struct pthread **p = &dead_threads;
+  while(*p) {
+    struct pthread *t = *p;
+    if(t->running == 0) {
+      *p = t->next;
+      free_thread(t);
+    } else {
+      p = &t->next;
+    }
+  }
+  pthread_mutex_unlock(&dead_threads_mutex);
+}
+
+int pthread_attr_init(pthread_attr_t *attr) {
+  attr->stacksize = PTHREAD_STACK_DEFAULT;
+  attr->detachstate = PTHREAD_CREATE_JOINABLE;
+  return 0;
+}
+
+int pthread_attr_destroy(pthread_attr_t *attr __attribute__((unused))) {
+  return 0;
+}
+
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize) {
+  if(stacksize < PTHREAD_STACK_MIN)
+    return EINVAL;
+  attr->stacksize = stacksize;
+  return 0;
+}
+
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detachstate) {
+  if(detachstate != PTHREAD_CREATE_JOINABLE && detachstate != PTHREAD_CREATE_DETACHED)
+    return EINVAL;
+  attr->detachstate = detachstate;
+  return 0;
+}
+
+static void thread_start(struct pthread *t) {
+  pthread_exit(t->start(t->arg));
+}
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg) {
+  size_t stacksize = attr ? attr->stacksize : PTHREAD_STACK_DEFAULT;
+  if(!tls_ready)
+    tls_init();
+  reap_dead_threads();
+
+  struct pthread *t = calloc(1, sizeof(struct pthread));
+  if(t == NULL)
+    return EAGAIN;
+  if((t->stack = malloc(stacksize)) == NULL) {
+    free(t);
+    return EAGAIN;
+  }
+  t->self = t;
+  t->start = start_routine;
+  t->arg = arg;
+  t->running = 1;
+  t->state = (attr && attr->detachstate == PTHREAD_CREATE_DETACHED) ? THREAD_DETACHED : THREAD_JOINABLE;
+
+  //thread_start(t) called from nowhere, with the argument 16-byte aligned
+  uint32_t *sp = (uint32_t *)(((uintptr_t)t->stack + stacksize) & ~(uintptr_t)15);
+  sp -= 3;
+  *--sp = (uint32_t)t;
+  *--sp = 0;
+
+  *thread = t;
+  if(syscall_4(38, thread_start, sp, t, &t->running) < 0) {
+    free_thread(t);
+    return EAGAIN;
+  }
+  return 0;
+}
+
+int pthread_join(pthread_t thread, void **retval) {
+  uint32_t running;
+  if(thread->state == THREAD_DETACHED || thread == pthread_self())
+    return EINVAL;
+  while((running = thread->running) != 0)
+    futex_wait(&thread->running, running, NULL);
+  if(retval)
+    *retval = thread->retval;
+  free_thread(thread);
+  return 0;
+}
+
+int pthread_detach(pthread_t thread) {
+  if(__sync_bool_compare_and_swap(&thread->state, THREAD_JOINABLE, THREAD_DETACHED))
+    return 0;
+  //too late, it is on its way out and nobody else will free it
+  if(thread->state == THREAD_EXITED)
+    return pthread_join(thread, NULL);
+  return EINVAL;
+}
+
+void pthread_exit(void *retval) {
+  struct pthread *self = pthread_self();
+  self->retval = retval;
+  if(self != &main_thread &&
+      !__sync_bool_compare_and_swap(&self->state, THREAD_JOINABLE, THREAD_EXITED)) {
+    pthread_mutex_lock(&dead_threads_mutex);
+    self->next = dead_threads;
+    dead_threads = self;
+    pthread_mutex_unlock(&dead_threads_mutex);
+  }
+  syscall_1(39, 0);
+  while(1);
+}
+
+pthread_t pthread_self(void) {
+  pthread_t self;
+  if(!tls_ready)
+    return &main_thread;
+  __asm__ volatile("movl %%gs:0, %0" : "=r"(self));
+  return self;
+}
+
+int pthread_equal(pthread_t t1, pthread_t t2) {
+  return t1 == t2;
+}
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr __attribute__((unused))) {
+  mutex->state = 0;
+  return 0;
+}
+
+int pthread_mutex_destroy(pthread_mutex_t *mutex) {
+  return mutex->state ? EBUSY : 0;
+}
+
+//the uncontended paths don't enter the kernel
+int pthread_mutex_lock(pthread_mutex_t *mutex) {
+  uint32_t c = __sync_val_compare_and_swap(&mutex->state, 0, 1);
+  if(c == 0)
+    return 0;
+  if(c != 2)
+    c = __sync_lock_test_and_set(&mutex->state, 2);
+  while(c != 0) {
+    futex_wait(&mutex->state, 2, NULL);
+    c = __sync_lock_test_and_set(&mutex->state, 2);
+  }
+  return 0;
+}
+
+int pthread_mutex_trylock(pthread_mutex_t *mutex) {
+  return __sync_bool_compare_and_swap(&mutex->state, 0, 1) ? 0 : EBUSY;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex) {
+  if(__sync_fetch_and_sub(&mutex->state, 1) != 1) {
+    mutex->state = 0;
+    futex_wake(&mutex->state, 1);
+  }
+  return 0;
+}
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr __attribute__((unused))) {
+  cond->seq = 0;
+  cond->mutex = NULL;
+  return 0;
+}
+
+int pthread_cond_destroy(pthread_cond_t *cond __attribute__((unused))) {
+  return 0;
+}
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex) {
+  uint32_t seq = cond->seq;
+  cond->mutex = mutex;
+  pthread_mutex_unlock(mutex);
+  futex_wait(&cond->seq, seq, NULL);
+  //others may have been requeued onto the mutex with us, so it is taken
+  //as contended to pass the wakeup on
+  while(__sync_lock_test_and_set(&mutex->state, 2) != 0)
+    futex_wait(&mutex->state, 2, NULL);
+  return 0;
+}
+
+int pthread_cond_signal(pthread_cond_t *cond) {
+  __sync_fetch_and_add(&cond->seq, 1);
+  futex_wake(&cond->seq, 1);
+  return 0;
+}
+
+//wakes one waiter and moves the rest to the mutex, where they would
+//only block again
+int pthread_cond_broadcast(pthread_cond_t *cond) {
+  __sync_fetch_and_add(&cond->seq, 1);
+  if(cond->mutex)
+    futex_requeue(&cond->seq, 1, &cond->mutex->state, INT_MAX);
+  else
+    futex_wake(&cond->seq, INT_MAX);
+  return 0;
+}
+
+//newlib's malloc is not thread safe by itself. it calls these around
+//every heap operation, possibly nested.
+static pthread_mutex_t malloc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t malloc_owner;
+static int malloc_depth;
+
+struct _reent;
+
+void __malloc_lock(struct _reent *r __attribute__((unused))) {
+  pthread_t self = pthread_self();
+  if(malloc_owner != self) {
+    pthread_mutex_lock(&malloc_mutex);
+    malloc_owner = self;
+  }
+  malloc_depth++;
+}
+
+void __malloc_unlock(struct _reent *r __attribute__((unused))) {
+  if(--malloc_depth == 0) {
+    malloc_owner = NULL;
+    pthread_mutex_unlock(&malloc_mutex);
+  }
+}
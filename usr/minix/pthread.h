@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+//threads on top of the clone and futex syscalls. each thread's struct
+//pthread is also its tls block, found through gs.
+
+typedef struct pthread *pthread_t;
+
+typedef struct {
+  size_t stacksize;
+  int detachstate;
+} pthread_attr_t;
+
+#define PTHREAD_CREATE_JOINABLE 0
+#define PTHREAD_CREATE_DETACHED 1
+
+#define PTHREAD_STACK_MIN     4096
+#define PTHREAD_STACK_DEFAULT 65536
+
+//0: unlocked, 1: locked, 2: locked and maybe waited for
+typedef struct {
+  volatile uint32_t state;
+} pthread_mutex_t;
+
+typedef struct {
+  int unused;
+} pthread_mutexattr_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+
+typedef struct {
+  volatile uint32_t seq;
+  pthread_mutex_t *mutex; //the waiters are requeued onto it
+} pthread_cond_t;
+
+typedef struct {
+  int unused;
+} pthread_condattr_t;
+
+#define PTHREAD_COND_INITIALIZER {0, NULL}
+
+int pthread_attr_init(pthread_attr_t *attr);
+int pthread_attr_destroy(pthread_attr_t *attr);
+int pthread_attr_setstacksize(pthread_attr_t *attr, size_t stacksize);
+int pthread_attr_setdetachstate(pthread_attr_t *attr, int detachstate);
+
+int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg);
+int pthread_join(pthread_t thread, void **retval);
+int pthread_detach(pthread_t thread);
+void pthread_exit(void *retval) __attribute__((noreturn));
+pthread_t pthread_self(void);
+int pthread_equal(pthread_t t1, pthread_t t2);
+
+int pthread_mutex_init(pthread_mutex_t *mutex, const pthread_mutexattr_t *attr);
+int pthread_mutex_destroy(pthread_mutex_t *mutex);
+int pthread_mutex_lock(pthread_mutex_t *mutex);
+int pthread_mutex_trylock(pthread_mutex_t *mutex);
+int pthread_mutex_unlock(pthread_mutex_t *mutex);
+
+int pthread_cond_init(pthread_cond_t *cond, const pthread_condattr_t *attr);
+int pthread_cond_destroy(pthread_cond_t *cond);
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex);
+int pthread_cond_signal(pthread_cond_t *cond);
+int pthread_cond_broadcast(pthread_cond_t *cond);
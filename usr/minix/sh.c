@@ -18,6 +18,7 @@ struct command {
 void cmd_ls(void);
 void cmd_ps(void);
 void cmd_netstat(void);
+void cmd_wq(void);
 void cmd_rm(void);
 void cmd_ln(void);
 void cmd_cat(void);
@@ -30,6 +31,7 @@ struct command cmd_table[] = {
   {"ls", cmd_ls},
   {"ps", cmd_ps},
   {"netstat", cmd_netstat},
+  {"wq", cmd_wq},
   {"rm", cmd_rm},
   {"ln", cmd_ln},
   {"cat", cmd_cat},
@@ -111,10 +113,12 @@ void cmd_ps() {
   struct threadent threadents[64];
   int bytes = gettents(threadents, sizeof(threadents));
   for(int i=0; i<bytes/sizeof(struct threadent); i++) {
+    //cpu time in 1/100 sec
+    unsigned int cputime = threadents[i].utime + threadents[i].stime;
     if(threadents[i].brk == 0)
-      printf("%3u %3u %s (kernel thread)               \"%s\" \n", threadents[i].pid, threadents[i].ppid, thread_state_name[threadents[i].state], threadents[i].name);
+      printf("%3u %3u %s %3d %4u.%02u (kernel thread)               \"%s\" \n", threadents[i].pid, threadents[i].ppid, thread_state_name[threadents[i].state], threadents[i].nice, cputime / 100, cputime % 100, threadents[i].name);
     else
-      printf("%3u %3u %s %2d %8x %8x %3d %4d \"%s\" \n", threadents[i].pid, threadents[i].ppid, thread_state_name[threadents[i].state], threadents[i].priority, threadents[i].brk, threadents[i].user_stack_size, threadents[i].num_files, threadents[i].num_pfs, threadents[i].name);
+      printf("%3u %3u %s %3d %4u.%02u %2d %8x %8x %3d %4d \"%s\" \n", threadents[i].pid, threadents[i].ppid, thread_state_name[threadents[i].state], threadents[i].nice, cputime / 100, cputime % 100, threadents[i].priority, threadents[i].brk, threadents[i].user_stack_size, threadents[i].num_files, threadents[i].num_pfs, threadents[i].name);
   }
 }
 
@@ -153,6 +157,15 @@ void cmd_netstat() {
   }
 }
 
+void cmd_wq() {
+  struct workqueueent wqents[32];
+  int bytes = getwents(wqents, sizeof(wqents));
+  for(int i=0; i<bytes/sizeof(struct workqueueent); i++) {
+    //latency in us from queueing to start
+    printf("%2u/%2u %4u %4u %8u %8u %8u \"%s\"\n", wqents[i].nbusy, wqents[i].nworkers, wqents[i].depth, wqents[i].max_depth, wqents[i].nrun, wqents[i].avg_latency, wqents[i].max_latency, wqents[i].name);
+  }
+}
+
 #define MAX_ARGS 128
 char *argv[MAX_ARGS];
 
@@ -0,0 +1,37 @@
+#include "syscall.h"
+#include "tinyos.h"
+#include <stdio.h>
+#include <unistd.h>
+#include <time.h>
+
+#define NCALLS 100000
+#define SYS_GETPID 3
+
+static uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench(const char *name, int (*func)(int)) {
+  uint64_t start = now_ns();
+  for(int i=0; i<NCALLS; i++)
+    func(SYS_GETPID);
+  uint64_t ns = now_ns() - start;
+  printf("%-12s %5u.%u ns/call\n", name, (unsigned)(ns / NCALLS), (unsigned)(ns * 10 / NCALLS % 10));
+}
+
+static int vdso_getpid_wrapper(int unused __attribute__((unused))) {
+  return vdso_getpid();
+}
+
+int main() {
+  printf("null syscall latency (getpid x %d)\n", NCALLS);
+  bench("int 0x80", syscall_0_int80);
+  if(sysenter_available())
+    bench("sysenter", syscall_0_sysenter);
+  else
+    puts("sysenter     not supported");
+  bench("vdso", vdso_getpid_wrapper);
+  return 0;
+}
@@ -2,10 +2,54 @@
 
 section .text
 
+VDSO_FEATURES equ 0xbfffe000 + 32 ; struct vdso_data.features
+VDSO_SYSENTER equ 0x1
+
+; sysenter when the kernel supports it, int 0x80 otherwise
 %macro systemcall 0
+  test dword [VDSO_FEATURES], VDSO_SYSENTER
+  jz %%int80
+  call sysenter_call
+  jmp %%done
+%%int80:
   int 0x80
+%%done:
 %endmacro
 
+; the kernel returns to the address on top of the stack pointed by ebp
+sysenter_call:
+  push ebp
+  push ecx
+  push edx
+  push dword .return
+  mov ebp, esp
+  sysenter
+.return:
+  add esp, 4
+  pop edx
+  pop ecx
+  pop ebp
+  ret
+
+global sysenter_available
+sysenter_available:
+  mov eax, [VDSO_FEATURES]
+  and eax, VDSO_SYSENTER
+  ret
+
+; for benchmarking each entry path
+global syscall_0_int80
+syscall_0_int80:
+  mov eax, [esp+4]
+  int 0x80
+  ret
+
+global syscall_0_sysenter
+syscall_0_sysenter:
+  mov eax, [esp+4]
+  call sysenter_call
+  ret
+
 global do_cli
 do_cli:
   cli
@@ -24,3 +24,6 @@ int syscall_2(int a0, int a1, int a2);
 int syscall_3(int a0, int a1, int a2, int a3);
 int syscall_4(int a0, int a1, int a2, int a3, int a4);
 int syscall_5(int a0, int a1, int a2, int a3, int a4, int a5);
+int sysenter_available(void);
+int syscall_0_int80(int a0);
+int syscall_0_sysenter(int a0);
@@ -0,0 +1,51 @@
+#include "syscall.h"
+#include "pthread.h"
+#include <stdio.h>
+
+#define NTHREADS 4
+#define NLOOPS   100000
+
+static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static int counter = 0;
+static int nstarted = 0;
+
+static void *worker(void *arg) {
+  pthread_mutex_lock(&mutex);
+  nstarted++;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+
+  for(int i=0; i<NLOOPS; i++) {
+    pthread_mutex_lock(&mutex);
+    counter++;
+    pthread_mutex_unlock(&mutex);
+  }
+  return arg;
+}
+
+int main() {
+  pthread_t threads[NTHREADS];
+  puts("thread test");
+
+  for(int i=0; i<NTHREADS; i++) {
+    if(pthread_create(&threads[i], NULL, worker, (void *)i)) {
+      puts("pthread_create failed");
+      return -1;
+    }
+  }
+
+  pthread_mutex_lock(&mutex);
+  while(nstarted < NTHREADS)
+    pthread_cond_wait(&cond, &mutex);
+  pthread_mutex_unlock(&mutex);
+  printf("all %d threads started\n", NTHREADS);
+
+  for(int i=0; i<NTHREADS; i++) {
+    void *ret;
+    pthread_join(threads[i], &ret);
+    printf("joined thread %d\n", (int)ret);
+  }
+  printf("counter = %d (expected %d)\n", counter, NTHREADS * NLOOPS);
+  return 0;
+}
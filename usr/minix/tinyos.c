@@ -1,6 +1,8 @@
 #include "tinyos.h"
 #include "syscall.h"
 #include <sys/types.h>
+#include <fcntl.h>
+#include <stdarg.h>
 
 int getdents(int fd, struct dirent *dirp, size_t count) {
   return syscall_3(28, fd, dirp, count);
@@ -13,3 +15,108 @@ int gettents(struct threadent *thp, size_t count) {
 int getsents(struct sockent *sockp, size_t count) {
   return syscall_2(33, sockp, count);
 }
+
+int getwents(struct workqueueent *wqp, size_t count) {
+  return syscall_2(42, wqp, count);
+}
+
+static inline uint64_t rdtsc(void) {
+  uint64_t tsc;
+  __asm__ volatile("rdtsc" : "=A"(tsc));
+  return tsc;
+}
+
+//reads the clock from the vdso page without a syscall. returns -1 if the
+//kernel has no tsc clocksource.
+static int vdso_clock_ns(clockid_t clock_id, uint64_t *ns) {
+  const volatile struct vdso_data *vd = (const volatile struct vdso_data *)VDSO_ADDR;
+  uint32_t seq;
+  uint64_t t;
+  if(vd->clock_mode != VDSO_CLOCK_TSC ||
+      (clock_id != CLOCK_MONOTONIC && clock_id != CLOCK_REALTIME))
+    return -1;
+  do {
+    seq = vd->seq;
+    __sync_synchronize();
+    uint64_t cycles = rdtsc() - vd->tsc_base;
+    t = ((cycles >> 32) * vd->tsc_mult << (32 - vd->tsc_shift)) +
+          ((cycles & 0xffffffff) * vd->tsc_mult >> vd->tsc_shift);
+    if(clock_id == CLOCK_REALTIME)
+      t += vd->realtime_offset;
+    __sync_synchronize();
+  } while((seq & 1) || seq != vd->seq);
+  *ns = t;
+  return 0;
+}
+
+//supports F_DUPFD, F_GETFD and F_SETFD
+int fcntl(int fd, int cmd, ...) {
+  va_list ap;
+  va_start(ap, cmd);
+  int arg = va_arg(ap, int);
+  va_end(ap);
+  return syscall_3(41, fd, cmd, arg);
+}
+
+//returns the new nice value
+int nice(int inc) {
+  return syscall_1(36, inc);
+}
+
+int clock_gettime(clockid_t clock_id, struct timespec *tp) {
+  uint64_t ns;
+  if(vdso_clock_ns(clock_id, &ns) == 0) {
+    tp->tv_sec = ns / 1000000000;
+    tp->tv_nsec = ns % 1000000000;
+    return 0;
+  }
+
+  struct ktimespec kts;
+  if(syscall_2(34, clock_id, &kts) < 0)
+    return -1;
+  tp->tv_sec = kts.tv_sec;
+  tp->tv_nsec = kts.tv_nsec;
+  return 0;
+}
+
+int gettimeofday(struct timeval *tv, void *tz __attribute__((unused))) {
+  uint64_t ns;
+  if(vdso_clock_ns(CLOCK_REALTIME, &ns) == 0) {
+    tv->tv_sec = ns / 1000000000;
+    tv->tv_usec = ns % 1000000000 / 1000;
+    return 0;
+  }
+
+  struct ktimeval ktv;
+  if(syscall_1(35, &ktv) < 0)
+    return -1;
+  tv->tv_sec = ktv.tv_sec;
+  tv->tv_usec = ktv.tv_usec;
+  return 0;
+}
+
+//the pid cached in the per-process vdso page
+pid_t vdso_getpid() {
+  return ((const volatile struct vdso_proc *)VDSO_PROC_ADDR)->pid;
+}
+
+//sleeps while *uaddr == val. returns -1 if the value differs, on timeout or
+//on a signal.
+int futex_wait(volatile uint32_t *uaddr, uint32_t val, const struct timespec *timeout) {
+  struct ktimespec kts;
+  if(timeout) {
+    kts.tv_sec = timeout->tv_sec;
+    kts.tv_nsec = timeout->tv_nsec;
+  }
+  return syscall_5(37, uaddr, FUTEX_WAIT, val, timeout ? &kts : NULL, NULL);
+}
+
+//returns the number of woken waiters
+int futex_wake(volatile uint32_t *uaddr, int nwake) {
+  return syscall_5(37, uaddr, FUTEX_WAKE, nwake, 0, NULL);
+}
+
+//wakes nwake waiters and moves up to nrequeue others to uaddr2
+int futex_requeue(volatile uint32_t *uaddr, int nwake, volatile uint32_t *uaddr2, int nrequeue) {
+  return syscall_5(37, uaddr, FUTEX_REQUEUE, nwake, nrequeue, uaddr2);
+}
@@ -1,4 +1,6 @@
 #include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
 
 #define MAX_FILENAME_LEN   255 //null is not contained
 #define MAX_THREADNAME_LEN 64  //null is not contained
@@ -21,6 +23,9 @@ struct threadent {
   uint32_t num_pfs;
   uint32_t num_files;
   uint32_t priority;
+  int32_t nice;
+  uint32_t utime; //ticks
+  uint32_t stime;
 };
 
 struct sockent {
@@ -29,6 +34,63 @@ struct sockent {
   int state;
 };
 
+#define MAX_WQNAME_LEN 32
+
+struct workqueueent {
+  char name[MAX_WQNAME_LEN];
+  uint32_t nworkers;
+  uint32_t nbusy;
+  uint32_t depth;
+  uint32_t max_depth;
+  uint32_t nrun;
+  uint32_t avg_latency; //us
+  uint32_t max_latency;
+};
+
+//layouts used by the kernel
+struct ktimespec {
+  uint64_t tv_sec;
+  uint32_t tv_nsec;
+};
+
+struct ktimeval {
+  uint64_t tv_sec;
+  uint32_t tv_usec;
+};
+
+//read-only pages mapped by the kernel (see sys/kern/vdso.h)
+#define VDSO_ADDR 0xbfffe000
+#define VDSO_PROC_ADDR (VDSO_ADDR + 0x1000)
+
+#define VDSO_CLOCK_SYSCALL 0
+#define VDSO_CLOCK_TSC     1
+
+struct vdso_data {
+  uint32_t seq;
+  uint32_t clock_mode;
+  uint64_t tsc_base;
+  uint32_t tsc_mult;
+  uint32_t tsc_shift;
+  uint64_t realtime_offset;
+};
+
+//futex operations (see sys/kern/futex.h)
+#define FUTEX_WAIT    0
+#define FUTEX_WAKE    1
+#define FUTEX_REQUEUE 3
+
+struct vdso_proc {
+  uint32_t pid;
+};
+
 int getdents(int fd, struct dirent *dirp, size_t count);
 int gettents(struct threadent *thp, size_t count);
 int getsents(struct sockent *sockp, size_t count);
+int getwents(struct workqueueent *wqp, size_t count);
+int clock_gettime(clockid_t clock_id, struct timespec *tp);
+int gettimeofday(struct timeval *tv, void *tz);
+pid_t vdso_getpid(void);
+int nice(int inc);
+int futex_wait(volatile uint32_t *uaddr, uint32_t val, const struct timespec *timeout);
+int futex_wake(volatile uint32_t *uaddr, int nwake);
+int futex_requeue(volatile uint32_t *uaddr, int nwake, volatile uint32_t *uaddr2, int nrequeue);